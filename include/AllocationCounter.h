@@ -0,0 +1,22 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+/**
+  * Counts the heap allocations of the process: malloc, calloc, realloc, the aligned allocators (posix_memalign,
+  * memalign, aligned_alloc, valloc) and everything built on top of them (operator new including its aligned
+  * variants, std containers, Eigen's dynamic matrices).
+  * Only available if the package is built with WBC_COUNT_ALLOCATIONS (or in allocation_test), since this replaces malloc
+  */
+class AllocationCounter {
+
+public:
+
+    /** Returns true if allocations are counted */
+    static bool enabled();
+
+    /** Returns the number of allocations since startup (always 0 if not enabled) */
+    static unsigned long count();
+
+};
+
+#endif // ALLOCATIONCOUNTER_H
@@ -9,11 +9,44 @@
 
 // Eigen
 #include <Eigen/Core>
-
+#include <Eigen/SVD>
+#include <Eigen/QR>
+
+#include <string>
+#include <vector>
+
+#include "TaskStack.h"
+#include "PivotedLDLT.h"
+
+/**
+  * Projects the torques of every priority level into the nullspace of all higher priority levels
+  * tau = t_0 + N_0 * t_1 + N_1 * t_2 + ..., with N_i the projection into the nullspace of levels 0..i
+  *
+  * The projections are never formed as nxn matrices. With C_i the part of the torques that level i removes,
+  * N_i = I - C_0 - ... - C_i, hence tau = sum_i t_i - sum_i C_i * (t_(i+1) + ... + t_last).
+  * C_i = Jr_i^T * (Jr_i*A*Jr_i^T)^(-1) * Jr_i*A, with Jr_i the Jacobian of level i restricted to the
+  * nullspace of the higher levels. Only the small (rows x rows) system of every level is decomposed.
+  *
+  * With identity weighting, rows of Jr that have no nonzero column in common are independent: Jr*Jr^T is block
+  * diagonal after permuting the rows. With block sparsity (LDLT only), every block is decomposed on its own,
+  * only using the columns it touches. Tasks on different branches (e.g., an arm and the head) then do not
+  * couple, a shared joint such as the torso merges the blocks of both branches.
+  */
 class ComputeNullspace {
 
 public:
 
+    /** Decomposition of the restricted Jacobian of a level */
+    enum Decomposition
+    {
+        /** SVD of Jr*A*Jr^T, the most robust and most expensive */
+        SVD,
+        /** Column pivoting QR of Jr^T, only for identity weighting (LDLT is used otherwise) */
+        COLPIV_QR,
+        /** LDLT of Jr*A*Jr^T, pivoting on the Schur complement such that the pivots reveal the rank */
+        LDLT
+    };
+
     /**
      * Constructor
      */
@@ -26,33 +59,127 @@ public:
 
     /*
      * Initialize function required for resizing etc
+     * @param num_joints Number of joints
+     * @param A Weighting matrix, the identity is recognized and skipped
+     * @param decomposition Decomposition of the restricted Jacobians
+     * @param block_sparse Decompose independent blocks of rows separately (LDLT and identity weighting only)
      */
-    void initialize(const uint num_joints, const Eigen::MatrixXd& A);
+    void initialize(const uint num_joints, const Eigen::MatrixXd& A, Decomposition decomposition = LDLT, bool block_sparse = true);
 
     /*
-     * Update function
+     * Parses the name of a decomposition ("svd", "qr" or "ldlt")
+     * @return false if the name is unknown
      */
-    void update(const Eigen::MatrixXd& J, Eigen::MatrixXd& N);
+    static bool getDecomposition(const std::string& name, Decomposition& decomposition);
 
+    /*
+     * Update function, does not allocate memory once every number of rows has been seen at every level
+     * @param task_stack Jacobians and torques of all priority levels
+     * @param tau Output: pre-allocated sum of the projected torques
+     */
+    void update(const TaskStack& task_stack, Eigen::VectorXd& tau);
 
+    /** Returns the rank of the restricted Jacobian of a level in the last update */
+    unsigned int getRank(unsigned int level) const;
+
+    /** Returns the number of independent blocks of a level in the last update (0 if not block sparse) */
+    unsigned int getNrBlocks(unsigned int level) const;
 
 protected:
 
     //! Weighting Matrix
     Eigen::MatrixXd A_;
 
-    //! Unity Matrix
-    Eigen::MatrixXd I_;
+    //! Whether A_ is the identity
+    bool identity_weight_;
+
+    //! Used decomposition
+    Decomposition decomposition_;
+
+    //! Singular values (or pivots) of Jr*A*Jr^T below this fraction of the largest squared norm of the rows
+    //! of the level (before the restriction) are not inverted, they are zero up to rounding errors
+    double rank_tolerance_;
+
+    //! Whether independent blocks of rows are decomposed separately
+    bool block_sparse_;
+
+    //! Intermediate results of a level, allocated once for every number of active rows
+    struct Workspace
+    {
+        //! Restricted Jacobian (transposed): Jr^T = N^T * J^T, with N the projection of the higher levels
+        Eigen::MatrixXd JrT;
+
+        //! A*Jr^T (only if A is not the identity)
+        Eigen::MatrixXd AJt;
+
+        //! Jr*A*Jr^T and its decompositions
+        Eigen::MatrixXd WJ;
+        Eigen::JacobiSVD<Eigen::MatrixXd> WJsvd;
+        PivotedLDLT WJldlt;
+
+        //! Decomposition of Jr^T
+        Eigen::ColPivHouseholderQR<Eigen::MatrixXd> JrTqr;
+
+        //! Inverted singular values or pivots
+        Eigen::VectorXd Dinv;
+
+        //! V * Sinv and (J*A*J^T)^(-1)
+        Eigen::MatrixXd VSinv, WJinv;
+
+        //! G = (Jr*A*Jr^T)^(-1) * Jr*A, hence C = Jr^T * G (SVD and LDLT)
+        Eigen::MatrixXd G;
+
+        //! Intermediate vector (rows)
+        Eigen::VectorXd y;
+
+        //! Number of independent blocks, 0 if the level is not decomposed by block
+        unsigned int num_blocks;
+
+        //! Rows and columns of Jr in block order, block b has rows row_begin[b]..row_begin[b+1]-1 of block_rows
+        std::vector<unsigned int> block_rows, block_cols, row_begin, col_begin;
+
+        //! Union-find of the rows, the first row that uses a column and the block of a root row
+        std::vector<int> parent, col_owner, block_index;
+
+        //! Jr^T of every block (columns x rows) on the diagonal; G then holds the G of every block on its diagonal
+        Eigen::MatrixXd B;
+
+        Workspace() : num_blocks(0) {}
+    };
+
+    //! Decomposition of a block, indexed by its number of rows and only used while decomposing a level
+    struct BlockSolver
+    {
+        Eigen::MatrixXd W;
+        PivotedLDLT ldlt;
+    };
+    std::vector<BlockSolver> block_solvers_;
+
+    //! Workspaces indexed by level and number of active rows
+    std::vector<std::vector<Workspace> > workspaces_;
+
+    //! Workspace and rank of every level in the current update, NULL if the level has no rows
+    std::vector<Workspace*> levels_;
+    std::vector<unsigned int> ranks_;
+
+    //! Sum of the torques of the lower levels and work vectors (n)
+    Eigen::VectorXd suffix_, w_, gathered_;
+
+    //! Returns the workspace for a level and number of active rows (allocates on first use)
+    Workspace& getWorkspace(unsigned int level, unsigned int num_rows);
 
-    //! Weighted pseudo-inverse
-    ///Eigen::MatrixXd Jpinv_;
+    //! Computes the restricted Jacobian of a level and decomposes it
+    void addLevel(unsigned int level, const Eigen::MatrixXd& J, unsigned int num_rows);
 
-    //! Matrix containing inverted singular values
-    Eigen::MatrixXd Sinv_;
+    //! Returns the largest squared norm (weighted by A) of the first num_rows rows of J
+    double getRowScale(const Eigen::MatrixXd& J, unsigned int num_rows);
 
-    //! Number of DoFs active during previous update
-    uint previous_num_active_dofs_;
+    //! Partitions the rows of ws.JrT into independent blocks and decomposes every block, returns the rank
+    unsigned int decomposeBlocks(Workspace& ws, double threshold);
 
+    //! v -= C_level * x, for a vector x (w_ and gathered_ are used, hence x must not be one of them)
+    template<typename In, typename Out>
+    void subtractLevelComponent(unsigned int level, const Eigen::MatrixBase<In>& x, const Eigen::MatrixBase<Out>& v_);
 
 };
 
@@ -0,0 +1,128 @@
+#ifndef DISTANCECACHE_H_
+#define DISTANCECACHE_H_
+
+#include <cstddef>
+#include <vector>
+
+// Eigen
+#include <Eigen/Core>
+
+/**
+  * Last computed distances of collision pairs, to skip the pairs that can not have come closer than the cutoff
+  *
+  * Every body has an odometer: an upper bound on the distance that any point of the body travelled, accumulated
+  * from its poses in subsequent cycles. If the distance d of a pair was computed when the odometers of both bodies
+  * read o_a and o_b, the pair is still at least d - (odometer_a - o_a) - (odometer_b - o_b) apart. As long as this
+  * lower bound exceeds the minimum distance found so far, the distance of the pair does not have to be computed.
+  *
+  * Self-collision pairs use odometers relative to the root of the robot, such that driving does not invalidate them.
+  * Environment pairs use odometers in map frame and are cleared whenever the world (version) changes, the objects
+  * of a world are assumed to be static until its version changes. Every body has a fixed number of slots for its
+  * environment pairs, found by hashing the object: when the probed slots are taken by other objects, the first one
+  * is overwritten. Such a pair is computed again later, hence the cache never allocates after initialize().
+  *
+  * The pair functions can be called concurrently, as long as every pair (self-collision) or every body (environment)
+  * is only used by a single thread.
+  */
+class DistanceCache {
+
+public:
+
+    /** Constructor */
+    DistanceCache();
+
+    /** Deconstructor */
+    virtual ~DistanceCache();
+
+    /**
+      * Clears the cache
+      * @param radii Radius of every body around the origin of its pose, indexed by body
+      * @param world_slots Number of environment pairs that every body can store, rounded up to a power of two
+      */
+    void initialize(const std::vector<double>& radii, unsigned int world_slots = 64);
+
+    /**
+      * Advances the odometers of a body to its new pose
+      * @param body Index of the body
+      * @param rotation, position Pose of the body (in map frame)
+      * @param root_rotation, root_position Pose of the root of the robot (in map frame)
+      */
+    void updatePose(unsigned int body, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& position,
+                    const Eigen::Matrix3d& root_rotation, const Eigen::Vector3d& root_position);
+
+    /**
+      * Clears the environment pairs if the world or its version changed
+      * @param world Identifies the world
+      * @param version Version of the world, 0 if the world is not versioned: environment pairs are not cached
+      */
+    void setWorld(const void* world, unsigned long version);
+
+    /** Whether self-collision pair (a, b) is certainly further apart than min_distance */
+    bool isSelfPairBeyond(unsigned int a, unsigned int b, double min_distance);
+
+    /** Stores the distance (or a lower bound) of self-collision pair (a, b) */
+    void setSelfPair(unsigned int a, unsigned int b, double distance);
+
+    /** Whether a body and a world object are certainly further apart than min_distance */
+    bool isWorldPairBeyond(unsigned int body, const void* object, double min_distance);
+
+    /** Stores the distance (or a lower bound) between a body and a world object */
+    void setWorldPair(unsigned int body, const void* object, double distance);
+
+    /** Returns the number of pairs that were skipped and computed since the previous call */
+    void getStatistics(unsigned int& num_skipped, unsigned int& num_computed);
+
+protected:
+
+    //! Distance of a pair and the odometer (sum) at which it was computed
+    struct Entry
+    {
+        double distance;
+        double odometer;
+    };
+
+    //! Pose and odometers of a body
+    struct Body
+    {
+        double radius;
+        bool has_pose;
+        Eigen::Matrix3d rotation, relative_rotation;
+        Eigen::Vector3d position, relative_position;
+        double odometer, relative_odometer;
+    };
+    std::vector<Body> bodies_;
+
+    //! Self-collision pairs, (a, b) with a < b is stored at a * num_bodies + b. Empty entries have distance -infinity
+    std::vector<Entry> self_pairs_;
+
+    //! Environment pair, only valid if it was stored in the current generation
+    struct WorldEntry
+    {
+        const void* object;
+        unsigned long generation;
+        Entry entry;
+    };
+
+    //! Environment pairs, the slots of body i start at i * world_slots_
+    std::vector<WorldEntry> world_pairs_;
+    std::size_t world_slots_;
+
+    //! World of which the environment pairs are stored, changing it starts a new generation
+    const void* world_;
+    unsigned long world_version_;
+    unsigned long world_generation_;
+
+    //! Statistics, incremented atomically
+    volatile unsigned int num_skipped_, num_computed_;
+
+    //! Returns the slot of a pair of a body, or NULL if it is not stored. If insert is set, the slot to store the
+    //! pair in is returned instead: its own, an empty one or the first probed one
+    WorldEntry* findWorldPair(unsigned int body, const void* object, bool insert);
+
+    //! Upper bound on the displacement of any point within radius of the origin between two poses
+    static double getDisplacement(const Eigen::Matrix3d& rotation_old, const Eigen::Vector3d& position_old,
+                                  const Eigen::Matrix3d& rotation_new, const Eigen::Vector3d& position_new, double radius);
+
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef ENVIRONMENTDISTANCEFIELD_H_
+#define ENVIRONMENTDISTANCEFIELD_H_
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+// Eigen
+#include <Eigen/Core>
+
+#include <octomap/OcTreeStamped.h>
+
+#include "ShapeDistance.h"
+
+/**
+  * Euclidean signed distance field of the occupied voxels of an octomap, in a window that moves with the robot
+  *
+  * The field is built by a background thread: a new octomap is rasterized into the cells of the window and only the
+  * cells within max_distance of cells of which the occupancy changed are recomputed (exact Euclidean distance transform,
+  * Felzenszwalb and Huttenlocher), the other distances are copied from the previous grid. Moving the window rebuilds it.
+  * Every grid is immutable once published, the control loop holds on to the grid of the current cycle and queries the
+  * distance and gradient of a point by trilinear interpolation of its 8 surrounding cells.
+  *
+  * The distance of a free cell is the distance between its center and the center of the nearest occupied cell minus half
+  * a cell, occupied cells get the negated distance to the nearest free cell. Distances are clamped to +-max_distance and
+  * unknown space is free.
+  */
+class EnvironmentDistanceField {
+
+public:
+
+    typedef octomap::OcTreeStamped OctreeType;
+
+    /** Distances of the cells of a window, immutable once published */
+    struct Grid
+    {
+        /** Cell size in [m] */
+        double resolution;
+
+        /** Center of cell (0, 0, 0) (in map frame) */
+        Eigen::Vector3d origin;
+
+        /** Number of cells in x, y and z */
+        int size[3];
+
+        /** Clamped signed distance and occupancy of every cell, x runs fastest */
+        std::vector<float> distance;
+        std::vector<unsigned char> occupied;
+
+        /** Distance that is returned outside the window */
+        double max_distance;
+
+        /** Incremented for every published grid */
+        unsigned long version;
+
+        int getIndex(int x, int y, int z) const
+        {
+            return x + size[0] * (y + size[1] * z);
+        }
+
+        /**
+          * Returns the interpolated distance of a point and its gradient
+          * @param point Point (in map frame)
+          * @param gradient Output: gradient of the distance, zero outside the window
+          */
+        double getDistance(const Eigen::Vector3d& point, Eigen::Vector3d& gradient) const;
+    };
+
+    /** Constructor */
+    EnvironmentDistanceField();
+
+    /** Deconstructor, stops the background thread */
+    virtual ~EnvironmentDistanceField();
+
+    /**
+      * Starts the background thread, can be called once
+      * @param resolution Cell size in [m]
+      * @param size Size of the window in [m], the window is centered around the robot in x and y and starts at its base in z
+      * @param max_distance Distances are clamped to +-max_distance
+      */
+    void initialize(double resolution, const Eigen::Vector3d& size, double max_distance);
+
+    /** Hands a new octomap to the background thread, which builds the grid of the current window from it */
+    void setOctoMap(const boost::shared_ptr<const OctreeType>& tree);
+
+    /**
+      * Sets the position of the robot base (in map frame), the window is moved once the robot has left
+      * the center quarter of the window. Does not wait for the background thread
+      */
+    void setRobotPosition(const Eigen::Vector3d& position);
+
+    /** Returns the latest grid, NULL until the first octomap has been processed */
+    boost::shared_ptr<const Grid> getGrid() const;
+
+    /**
+      * Samples the surface of a shape, such that the distance of the shape is the minimum distance of its samples minus the margin
+      * Spheres and capsules are sampled on their core (with their radius as margin), the other shapes on their surface
+      * @param shape Shape, the samples are expressed in the frame of its pose
+      * @param spacing Maximum distance between neighbouring samples
+      * @param points Output: samples
+      * @return Margin
+      */
+    static double sampleShape(const ConvexShape& shape, double spacing, std::vector<Eigen::Vector3d>& points);
+
+protected:
+
+    double resolution_;
+    Eigen::Vector3d size_;
+    double max_distance_;
+
+    /** Protects the members below, work_ is signalled when there is work or when stopping */
+    mutable boost::mutex mutex_;
+    boost::condition_variable work_;
+
+    /** Latest grid */
+    boost::shared_ptr<Grid> grid_;
+
+    /** Work for the background thread */
+    boost::shared_ptr<const OctreeType> pending_tree_;
+    Eigen::Vector3d robot_position_;
+    bool recenter_;
+    bool stopping_;
+
+    boost::thread thread_;
+
+    /** Grid before the latest one, owned by the background thread and reused once the control loop released it */
+    boost::shared_ptr<Grid> spare_;
+
+    /** Version of the latest grid */
+    unsigned long version_;
+
+    /** Loop of the background thread */
+    void work();
+
+    /** Builds the grid of a window (cell (0, 0, 0) at origin) from a tree, incrementally from previous if it has the same origin */
+    void build(const OctreeType& tree, const Eigen::Vector3d& origin, const Grid* previous, Grid& grid);
+
+    /** Rasterizes the occupied leafs of a tree into the cells of a grid */
+    void rasterize(const OctreeType& tree, Grid& grid) const;
+
+    /** Recomputes the distances of the cells in [lo, hi) of a grid, only the occupancy of cells within max_distance is used */
+    void computeDistances(const int* lo, const int* hi, Grid& grid) const;
+
+    /** Origin of a window around a position, snapped to the cells */
+    Eigen::Vector3d getOrigin(const Eigen::Vector3d& position) const;
+
+    /** Whether the window with an origin can be kept for a robot position */
+    bool isCentered(const Eigen::Vector3d& origin, const Eigen::Vector3d& position) const;
+
+    /** Number of cells beyond which distances are clamped */
+    int getRadius() const;
+
+    /** One dimensional squared distance transform of f (n samples, unit spacing) into d, v and z are work arrays of n and n+1 */
+    static void distanceTransform(const double* f, int n, double* d, int* v, double* z);
+
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef GENERATEDKINEMATICS_H
+#define GENERATEDKINEMATICS_H
+
+#include <vector>
+
+#include <kdl/frames.hpp>
+#include <kdl/jntarray.hpp>
+
+#include <Eigen/Core>
+
+/**
+  * Kinematics of one specific robot model, generated at build time by scripts/generate_kinematics
+  * from the URDF and the chain description. The generated code is unrolled for the model: all
+  * fixed transforms are constants and there are no loops over the segments.
+  * Tree only uses it if it has been generated from the same model as the loaded tree
+  */
+class GeneratedKinematics
+{
+
+public:
+
+    virtual ~GeneratedKinematics() {}
+
+    /** Returns number of segments, ordered as in Tree::initializeSegments */
+    virtual unsigned int getNrSegments() const = 0;
+
+    /** Returns the name of a segment */
+    virtual const char* getSegmentName(unsigned int index) const = 0;
+
+    /** Returns the index of the parent of a segment (-1 for the root) */
+    virtual int getParentIndex(unsigned int index) const = 0;
+
+    /** Returns number of (controlled) joints */
+    virtual unsigned int getNrJoints() const = 0;
+
+    /** Returns the name of the joint with the given whole body index */
+    virtual const char* getJointName(unsigned int index) const = 0;
+
+    /**
+      * Updates the poses of all segments except the root, see Tree::calcFK
+      * @param q Whole body joint positions
+      * @param dirty Segments of which the joint position changed
+      * @param poses In/output: segment poses, poses[0] must have been set
+      * @param updated In/output: updated[0] must have been set, the others are computed
+      */
+    virtual void calcFK(const KDL::JntArray& q, const std::vector<bool>& dirty, std::vector<KDL::Frame>& poses, std::vector<bool>& updated) const = 0;
+
+    /**
+      * Computes the Jacobian of a segment, see Tree::calcJacobian
+      * @param segment_index Index of the segment
+      * @param poses Segment poses computed by calcFK
+      * @param jacobian Output: pre-allocated 6xn Jacobian
+      */
+    virtual void calcJacobian(unsigned int segment_index, const std::vector<KDL::Frame>& poses, Eigen::MatrixXd& jacobian) const = 0;
+
+};
+
+/**
+  * Returns the generated kinematics (to be deleted by the caller)
+  * or NULL if no robot model has been given at build time (see WBC_KINEMATICS_URDF in CMakeLists.txt)
+  */
+GeneratedKinematics* createGeneratedKinematics();
+
+#endif // GENERATEDKINEMATICS_H
@@ -0,0 +1,56 @@
+#ifndef MOTIONOBJECTIVEPOOL_H_
+#define MOTIONOBJECTIVEPOOL_H_
+
+#include <vector>
+
+#include "WorkerPool.h"
+#include "amigo_whole_body_controller/motionobjectives/MotionObjective.h"
+
+/**
+  * Applies the motion objectives concurrently on a WorkerPool. Once the FK solution has been
+  * computed, the motion objectives only read the robot state and write their own torques and Jacobian,
+  * hence they can be evaluated in any order. The caller combines the results in a fixed order,
+  * which makes the outcome identical to applying the motion objectives one by one
+  */
+class MotionObjectivePool {
+
+public:
+
+    /** Constructor */
+    MotionObjectivePool();
+
+    /** Deconstructor, stops the worker threads */
+    virtual ~MotionObjectivePool();
+
+    /**
+      * Starts the worker threads, can be called once
+      * @param num_threads Number of worker threads besides the calling thread, 0 applies the motion objectives serially
+      */
+    void initialize(unsigned int num_threads);
+
+    /** Returns the number of worker threads */
+    unsigned int getNrThreads() const;
+
+    /**
+      * Applies all motion objectives and returns when all of them are done
+      * The calling thread applies motion objectives as well
+      */
+    void apply(const std::vector<MotionObjective*>& motionobjectives, RobotState& robotstate);
+
+protected:
+
+    /** Applies motion objective i of the current apply (task of pool_) */
+    void applyMotionObjective(unsigned int i);
+
+    WorkerPool pool_;
+
+    /** Bound once, see WorkerPool::run */
+    WorkerPool::Task apply_task_;
+
+    /** Work of the current apply */
+    const std::vector<MotionObjective*>* motionobjectives_;
+    RobotState* robot_state_;
+
+};
+
+#endif
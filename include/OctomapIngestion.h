@@ -0,0 +1,71 @@
+#ifndef OCTOMAPINGESTION_H_
+#define OCTOMAPINGESTION_H_
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <octomap/OcTreeStamped.h>
+#include <octomap_msgs/Octomap.h>
+
+/**
+  * Converts octomap messages to trees in a background thread, such that the control loop only swaps pointers
+  *
+  * The subscriber callback hands over the message (a pointer copy), the background thread deserializes the latest one
+  * and publishes the tree as a snapshot. The control loop takes the snapshot when a new one is available. Trees that
+  * are no longer published are also destroyed in the background thread, once the control loop and the consumers
+  * of the tree (e.g. the environment distance field) released them, such that freeing a large tree does not stall
+  * the control loop either.
+  */
+class OctomapIngestion {
+
+public:
+
+    typedef octomap::OcTreeStamped OctreeType;
+
+    /** Constructor, starts the background thread */
+    OctomapIngestion();
+
+    /** Deconstructor, stops the background thread */
+    virtual ~OctomapIngestion();
+
+    /** Hands a message to the background thread, a message that has not been converted yet is dropped */
+    void setMessage(const octomap_msgs::Octomap::ConstPtr& msg);
+
+    /**
+      * Returns the latest tree if it was not returned before
+      * @param tree Output: latest tree, which must not be modified (copy it instead)
+      * @return Whether a new tree is available
+      */
+    bool getOctoMap(boost::shared_ptr<OctreeType>& tree);
+
+protected:
+
+    /** Protects the members below, work_ is signalled when there is a message or when stopping */
+    boost::mutex mutex_;
+    boost::condition_variable work_;
+
+    /** Message that has not been converted yet */
+    octomap_msgs::Octomap::ConstPtr pending_;
+
+    /** Latest tree and its number, taken_ is the number of the tree that was returned last */
+    boost::shared_ptr<OctreeType> published_;
+    unsigned long num_published_, num_taken_;
+
+    bool stopping_;
+
+    boost::thread thread_;
+
+    /** Trees that are no longer published but may still be in use, only accessed by the background thread */
+    std::vector<boost::shared_ptr<OctreeType> > retired_;
+
+    /** Loop of the background thread */
+    void work();
+
+    /** Destroys the retired trees that are no longer in use */
+    void releaseRetired();
+
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef PIVOTEDLDLT_H_
+#define PIVOTEDLDLT_H_
+
+#include <vector>
+
+// Eigen
+#include <Eigen/Core>
+
+/**
+  * Rank revealing LDL^T factorization of a positive semidefinite matrix: P*W*P^T = L*D*L^T
+  * Every step pivots on the largest diagonal entry of the remaining Schur complement, hence the pivots do not
+  * increase (Eigen::LDLT pivots on the diagonal of W instead). Once the largest diagonal entry is below the
+  * threshold, so are all entries of the (semidefinite) Schur complement: it is zero and the factorization stops.
+  * The factorization is stored in place, nothing is allocated once it has been resized
+  */
+class PivotedLDLT {
+
+public:
+
+    /** Constructor */
+    PivotedLDLT();
+
+    /** Allocates a factorization of size x size matrices */
+    void resize(unsigned int size);
+
+    /**
+      * Factorizes W
+      * @param W Positive semidefinite matrix (size x size), only the lower triangle is used
+      * @param threshold Pivots below this value are zero
+      * @return Rank of W
+      */
+    unsigned int compute(const Eigen::MatrixXd& W, double threshold);
+
+    /** Returns the rank of the last factorization */
+    unsigned int getRank() const;
+
+    /**
+      * Solves W*X = B in place in the least squares sense: X = P^T * L1^-T * D1^-1 * L1^-1 * P * B, with L1 and D1
+      * the first rank rows and columns of L and D. With B = J*A, W = J*A*J^T, J^T*X projects onto the range of J^T
+      * @param B_ In/output: size rows
+      */
+    template<typename Derived>
+    void solveInPlace(const Eigen::MatrixBase<Derived>& B_) const;
+
+protected:
+
+    /** L (strictly lower triangle) and D (diagonal) of the first rank columns, the Schur complement is not kept */
+    Eigen::MatrixXd LD_;
+
+    /** Row k was swapped with row transpositions_[k] in step k */
+    std::vector<int> transpositions_;
+
+    unsigned int rank_;
+
+};
+
+template<typename Derived>
+void PivotedLDLT::solveInPlace(const Eigen::MatrixBase<Derived>& B_) const {
+
+    // Writable view on the output, see "Writing Functions Taking Eigen Types as Parameters"
+    Eigen::MatrixBase<Derived>& B = const_cast<Eigen::MatrixBase<Derived>&>(B_);
+
+    for (unsigned int k = 0; k < rank_; ++k) {
+        B.row(k).swap(B.row(transpositions_[k]));
+    }
+
+    /// The rows beyond the rank belong to zero pivots, L1^-T does not depend on them
+    LD_.topLeftCorner(rank_, rank_).triangularView<Eigen::UnitLower>().solveInPlace(B.topRows(rank_));
+    for (unsigned int k = 0; k < rank_; ++k) {
+        B.row(k) /= LD_(k, k);
+    }
+    LD_.topLeftCorner(rank_, rank_).triangularView<Eigen::UnitLower>().transpose().solveInPlace(B.topRows(rank_));
+    B.bottomRows(B.rows() - rank_).setZero();
+
+    for (int k = rank_ - 1; k >= 0; --k) {
+        B.row(k).swap(B.row(transpositions_[k]));
+    }
+
+}
+
+#endif
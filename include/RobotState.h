@@ -14,7 +14,8 @@
 #include <geometry_msgs/PoseStamped.h>
 
 #include <kdl/frames.hpp>
-#include <kdl/treefksolverpos_recursive.hpp>
+
+#include <boost/thread/mutex.hpp>
 
 // Choose what collision library will be used
 #define USE_FCL
@@ -40,8 +41,12 @@ public:
     virtual ~RobotState();
 
     // Map containing segment names and corresponding poses (in map frame)
+    // Compatibility view on fk_frames_: the keys are created once in initialize(), collectFKSolutions() only refreshes the values
     std::map<std::string, KDL::Frame> fk_poses_;
 
+    // Poses of all segments (in map frame), indexed as the sorted segments of tree_
+    std::vector<KDL::Frame> fk_frames_;
+
     // Collision Model
     // ToDo: why have both name_collision_body and frame_id? --> Convenient when adding objects to gripper
     struct CollisionBody
@@ -58,6 +63,7 @@ public:
             } dimensions;
         } collision_shape;
         std::string frame_id;
+        int frame_handle;    // Handle of frame_id, see RobotState::getFrameHandle
         KDL::Frame fk_pose;  // Link pose in MAP frame
         KDL::Frame fix_pose; // Delta transform from fk_pose to collision shape
 
@@ -126,12 +132,15 @@ public:
     KDL::Frame amcl_pose_;
 
     /**
-      * Forward Kinematics Solver
+      * Allocates the FK storage and resolves the frames of the collision bodies,
+      * must be called after the tree and the collision model have been parsed
+      * @return false if a collision body refers to an unknown frame
       */
-    KDL::TreeFkSolverPos_recursive* fk_solver_;
+    bool initialize();
 
     /**
-      * Store all FK solutions in a map
+      * Updates the FK solutions in a single sweep over the tree and refreshes fk_poses_
+      * Only the segments below a joint that changed (see Tree::setJointPosition) are recomputed
       */
     void collectFKSolutions();
 
@@ -151,11 +160,72 @@ public:
       */
     KDL::Frame getFK(const std::string& tip_frame);
 
+    /**
+      * Resolves a frame name to a handle. Resolve once (e.g., when a motion objective
+      * is initialized) and use the handle in the control loop
+      * @param frame_name Name of the frame
+      * @return Handle of the frame or -1 if the frame is not part of the FK solution
+      */
+    int getFrameHandle(const std::string& frame_name) const;
+
+    /**
+      * Returns the KDL frame (in map frame) corresponding to a handle
+      * @param frame_handle Valid handle obtained from getFrameHandle
+      */
+    const KDL::Frame& getFK(int frame_handle) const
+    {
+        return fk_frames_[frame_handle];
+    }
+
+    /**
+      * Computes the current pose of a single frame (in map frame) without updating the complete FK solution:
+      * only the chain from the root to this frame is evaluated, with the latest joint positions
+      * Meant for callbacks (e.g., accepting a goal), the FK solution and Jacobian cache are not changed
+      * @param frame_handle Valid handle obtained from getFrameHandle
+      */
+    KDL::Frame calcFK(int frame_handle) const;
+
+    /**
+      * Returns the 6xn Jacobian of a frame (in map frame, reference point at the frame origin)
+      * The Jacobians are cached: a Jacobian is only recomputed if its frame moved
+      * Can be called concurrently by motion objectives (see MotionObjectivePool)
+      * @param frame_handle Valid handle obtained from getFrameHandle
+      */
+    const Eigen::MatrixXd& getJacobian(int frame_handle);
+
+    /**
+      * Computes the 6xn Jacobian of a point that is rigidly attached to a frame. Does not allocate memory
+      * @param frame_handle Valid handle obtained from getFrameHandle
+      * @param point_in_map Point expressed in map frame
+      * @param jacobian Output: pre-allocated 6xn Jacobian (in map frame)
+      */
+    void getPointJacobian(int frame_handle, const KDL::Vector& point_in_map, Eigen::MatrixXd& jacobian);
+
     void setAmclPose(KDL::Frame& amcl_pose);
 
     /** Returns number of joints */
     unsigned int getNrJoints();
 
+protected:
+
+    /** Handle of base_link if this frame is not part of the tree, -1 otherwise */
+    int base_link_alias_handle_;
+
+    /** Iterators into fk_poses_, indexed as fk_frames_ */
+    std::vector<std::map<std::string, KDL::Frame>::iterator> fk_poses_view_;
+
+    /** Frames of which the pose has been recomputed in the last collectFKSolutions, indexed as fk_frames_ */
+    std::vector<bool> fk_updated_;
+
+    /** Cached Jacobians, indexed as fk_frames_ */
+    std::vector<Eigen::MatrixXd> jacobians_;
+
+    /** Cached Jacobians that are consistent with fk_frames_ */
+    std::vector<bool> jacobian_valid_;
+
+    /** Protects the Jacobian cache */
+    boost::mutex jacobian_mutex_;
+
 };
 
 #endif // ROBOTSTATE_H
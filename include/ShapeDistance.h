@@ -0,0 +1,177 @@
+#ifndef SHAPEDISTANCE_H_
+#define SHAPEDISTANCE_H_
+
+#include <vector>
+
+// Eigen
+#include <Eigen/Core>
+
+/**
+  * Convex primitive described by its dimensions and pose instead of a tessellated mesh
+  * Spheres and capsules are a point and a segment (the core) with a margin (the radius),
+  * boxes, cylinders and cones are described by their support mapping. The axis of capsules,
+  * cylinders and cones is the local z-axis, the apex of a cone points into positive z
+  */
+struct ConvexShape
+{
+    enum Type
+    {
+        SPHERE,
+        CAPSULE,
+        BOX,
+        CYLINDER,
+        CONE
+    };
+
+    Type type;
+
+    /** Half extents of a box, for the other shapes x is the radius and z the half length */
+    Eigen::Vector3d dimensions;
+
+    /** Pose in world */
+    Eigen::Matrix3d rotation;
+    Eigen::Vector3d position;
+};
+
+/**
+  * Distance between two convex primitives
+  * Pairs of spheres and capsules are computed in closed form (closest points of two segments),
+  * all other pairs by GJK on the support mappings of the cores, after which the margins are subtracted.
+  * Does not allocate memory.
+  */
+class ShapeDistance {
+
+public:
+
+    /**
+      * Computes the distance between two shapes
+      * @param a First shape
+      * @param b Second shape
+      * @param point_a Output: nearest point on a (in world)
+      * @param point_b Output: nearest point on b (in world)
+      * @return Distance, negative if the margins (radii) overlap and 0 if the other shapes intersect.
+      * point_a - point_b always points away from b: if the shapes overlap, the points are moved
+      * along the line between the cores or, if the cores intersect, are the centers of the shapes
+      */
+    static double compute(const ConvexShape& a, const ConvexShape& b, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b);
+
+    /** Maximum number of GJK iterations */
+    static const unsigned int MAX_ITERATIONS = 64;
+
+protected:
+
+    /** Returns the radius that is added to the core of a shape */
+    static double getMargin(const ConvexShape& shape);
+
+    /** Whether the core of a shape is a point or a segment */
+    static bool hasSegmentCore(const ConvexShape& shape);
+
+    /** Returns the end points of the core of a sphere (twice the center) or capsule */
+    static void getSegment(const ConvexShape& shape, Eigen::Vector3d& p0, Eigen::Vector3d& p1);
+
+    /** Returns the point of the core of a shape that is furthest in direction d (in world) */
+    static Eigen::Vector3d support(const ConvexShape& shape, const Eigen::Vector3d& d);
+
+    /**
+      * Closest points of the segments p0-p1 and q0-q1 (which may be points)
+      * @return Squared distance
+      */
+    static double closestSegmentSegment(const Eigen::Vector3d& p0, const Eigen::Vector3d& p1, const Eigen::Vector3d& q0, const Eigen::Vector3d& q1,
+                                        Eigen::Vector3d& point_p, Eigen::Vector3d& point_q);
+
+    /**
+      * GJK distance between the cores of two shapes
+      * @return false if the cores intersect
+      */
+    static bool gjk(const ConvexShape& a, const ConvexShape& b, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b);
+
+    /**
+      * Reduces a simplex (w, with the support points of a and b) to the smallest subsimplex that contains the point closest to the origin
+      * @param lambda Output: barycentric coordinates of the closest point in the reduced simplex
+      * @return false if the origin is inside the simplex (tetrahedron)
+      */
+    static bool reduceSimplex(Eigen::Vector3d* w, Eigen::Vector3d* sa, Eigen::Vector3d* sb, unsigned int& size, double* lambda);
+
+    /**
+      * Closest point of the triangle abc to the origin (Ericson, Real-Time Collision Detection, 5.1.5)
+      * @param index Output: indices (0, 1 or 2) of the vertices that span the closest feature
+      * @param lambda Output: barycentric coordinates on this feature
+      * @return Number of vertices of the closest feature
+      */
+    static unsigned int closestTriangle(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+                                        unsigned int* index, double* lambda);
+
+};
+
+/**
+  * Distances of many pairs of convex primitives, computed together
+  * Pairs of spheres are stored in a structure of arrays (one array per coordinate) and computed without branches,
+  * two pairs at a time with SSE2 instructions. The other pairs are computed one by one by ShapeDistance::compute.
+  * The results agree with ShapeDistance::compute up to rounding. Nothing is allocated once enough pairs have been reserved.
+  */
+class ShapeDistanceBatch {
+
+public:
+
+    /** Constructor */
+    ShapeDistanceBatch();
+
+    /** Allocates room for a number of pairs */
+    void reserve(unsigned int capacity);
+
+    /** Removes all pairs */
+    void clear();
+
+    /**
+      * Adds a pair, grows the batch (allocates) if it is full
+      * @return Index of the pair
+      */
+    unsigned int add(const ConvexShape& a, const ConvexShape& b);
+
+    /** Returns the number of pairs */
+    unsigned int size() const;
+
+    /** Computes the distances of all pairs */
+    void compute();
+
+    /**
+      * Returns the result of a pair after compute(), as ShapeDistance::compute
+      * @param i Index of the pair
+      * @param point_a Output: nearest point on the first shape (in world)
+      * @param point_b Output: nearest point on the second shape (in world)
+      * @return Distance
+      */
+    double getDistance(unsigned int i, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b) const;
+
+protected:
+
+    /** Grows the arrays of the sphere pairs to a capacity, keeping the pairs */
+    void resizeSpheres(unsigned int capacity);
+
+    /** Distances and nearest points of the sphere pairs */
+    void computeSpheres();
+
+    /** Distance and nearest points of sphere pair i, one pair at a time */
+    void computeSphere(unsigned int i);
+
+    //! Per pair: whether it is a sphere pair and its index in the sphere or the other pairs
+    std::vector<bool> is_sphere_;
+    std::vector<unsigned int> slot_;
+
+    //! Sphere pairs: centers (per coordinate) and radii
+    unsigned int num_spheres_;
+    Eigen::ArrayXd center_a_[3], center_b_[3];
+    Eigen::ArrayXd radius_a_, radius_b_;
+
+    //! Results of the sphere pairs
+    Eigen::ArrayXd distance_;
+    Eigen::ArrayXd point_a_[3], point_b_[3];
+
+    //! Other pairs and their results
+    std::vector<ConvexShape> general_a_, general_b_;
+    std::vector<double> general_distance_;
+    std::vector<Eigen::Vector3d> general_point_a_, general_point_b_;
+
+};
+
+#endif
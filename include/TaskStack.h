@@ -0,0 +1,93 @@
+#ifndef TASKSTACK_H_
+#define TASKSTACK_H_
+
+#include <vector>
+
+// Eigen
+#include <Eigen/Core>
+
+/**
+  * Stacked Jacobians and summed torques of the motion objectives, one level per priority
+  * Only the rows that are used are cleared every cycle. The capacity of a level is reserved when a motion
+  * objective is added; should the rows of a level still not fit, its capacity is doubled (counted by getNrGrowths)
+  */
+class TaskStack {
+
+public:
+
+    /** Constructor */
+    TaskStack();
+
+    /** Deconstructor */
+    virtual ~TaskStack();
+
+    /**
+      * Allocates the buffers
+      * @param num_levels Number of priority levels
+      * @param num_joints Number of joints
+      * @param initial_rows Initial number of rows of every level
+      */
+    void initialize(unsigned int num_levels, unsigned int num_joints, unsigned int initial_rows);
+
+    /**
+      * Makes sure that a level has room for a number of rows, such that adding the tasks does not allocate
+      * @param level Level (0 is the highest priority)
+      * @param rows Total number of rows of the tasks of the level
+      */
+    void reserve(unsigned int level, unsigned int rows);
+
+    /** Clears the rows used in the previous cycle and the torques of all levels */
+    void clear();
+
+    /**
+      * Appends the Jacobian and adds the torques of a motion objective to a level
+      * @param level Level (0 is the highest priority)
+      * @param jacobian Jacobian of the motion objective (may have zero rows)
+      * @param torques Torques of the motion objective
+      */
+    void addTask(unsigned int level, const Eigen::MatrixXd& jacobian, const Eigen::VectorXd& torques);
+
+    /**
+      * Appends the first rows of the Jacobian and adds the torques of a motion objective to a level
+      * @param number_rows Number of rows of the Jacobian that are used
+      */
+    void addTask(unsigned int level, const Eigen::MatrixXd& jacobian, unsigned int number_rows, const Eigen::VectorXd& torques);
+
+    /** Returns the number of levels */
+    unsigned int getNrLevels() const;
+
+    /** Returns the stacked Jacobian of a level, only the first getNrRows(level) rows are used */
+    const Eigen::MatrixXd& getJacobian(unsigned int level) const;
+
+    /** Returns the number of used rows of a level */
+    unsigned int getNrRows(unsigned int level) const;
+
+    /** Returns the summed torques of a level */
+    Eigen::VectorXd& getTorques(unsigned int level);
+    const Eigen::VectorXd& getTorques(unsigned int level) const;
+
+    /** Returns the number of allocated rows of a level */
+    unsigned int getCapacity(unsigned int level) const;
+
+    /** Returns the maximum number of used rows of a level since initialization */
+    unsigned int getMaxRows(unsigned int level) const;
+
+    /** Returns how often the capacity of a level has been increased */
+    unsigned int getNrGrowths() const;
+
+protected:
+
+    /** Stacked Jacobians */
+    std::vector<Eigen::MatrixXd> jacobians_;
+
+    /** Summed torques */
+    std::vector<Eigen::VectorXd> torques_;
+
+    /** Used and maximum used number of rows */
+    std::vector<unsigned int> rows_, max_rows_;
+
+    unsigned int num_growths_;
+
+};
+
+#endif
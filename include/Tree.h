@@ -5,6 +5,11 @@
 #include <map>
 
 #include <kdl/treejnttojacsolver.hpp>
+#include <kdl/frames.hpp>
+
+#include <boost/shared_ptr.hpp>
+
+#include "GeneratedKinematics.h"
 
 class Tree {
 
@@ -14,20 +19,79 @@ public:
 
     virtual ~Tree();
 
-    void calcPartialJacobian(const std::string &link_name, Eigen::MatrixXd &jacobian);
-
     void getJointNames(std::map<std::string, unsigned int>& jnt_name_to_index_in, std::map<std::string, unsigned int> &jnt_name_to_index_out);
 
     void getTreeJointIndex(KDL::Tree& tree, std::vector<int>& tree_joint_index);
 
     void rearrangeJntArrayToTree(KDL::JntArray &q_in);
 
+    /**
+      * Sets the position of a single joint and marks the subtree of this joint as dirty
+      * @param index Index of the joint in the whole body joint vector
+      * @param pos Joint position
+      */
+    void setJointPosition(unsigned int index, double pos);
+
     unsigned int getNrJoints();
 
-    KDL::Tree kdl_tree_;
+    /**
+      * Sorts the segments of kdl_tree_ in topological order (parents before children, siblings by name),
+      * allocates the joint arrays and selects the generated kinematics if these match kdl_tree_
+      * Must be called once after kdl_tree_ and tree_joint_index_ have been constructed
+      */
+    void initializeSegments();
+
+    /** Returns number of segments */
+    unsigned int getNrSegments() const;
+
+    /**
+      * Returns the index of a segment in the sorted segment list
+      * @param segment_name Name of the segment
+      * @return Index or -1 if the segment is not part of the tree
+      */
+    int getSegmentIndex(const std::string& segment_name) const;
+
+    /** Returns the name of the segment with the given index */
+    const std::string& getSegmentName(unsigned int index) const;
+
+    /**
+      * Updates the poses of the segments in a single sweep over the sorted segments
+      * Only dirty subtrees (joint positions or root pose changed since the previous call) are recomputed
+      * @param root_pose Pose of the root segment
+      * @param poses In/output: poses of all segments (expressed in the frame of root_pose), indexed as the sorted segments
+      * @param updated Output: true for every segment of which the pose has been recomputed
+      */
+    void calcFK(const KDL::Frame& root_pose, std::vector<KDL::Frame>& poses, std::vector<bool>& updated);
+
+    /**
+      * Computes the pose of a single segment from the current joint positions
+      * Only the chain from the root to this segment is evaluated, the dirty flags are not changed
+      * @param segment_index Index of the segment
+      * @param root_pose Pose of the root segment
+      * @return Pose of the segment (expressed in the frame of root_pose)
+      */
+    KDL::Frame calcSegmentFK(unsigned int segment_index, const KDL::Frame& root_pose) const;
+
+    /**
+      * Computes the Jacobian of a segment from the segment poses computed by calcFK
+      * The Jacobian is expressed in the frame of the poses, its reference point is the segment origin
+      * and its columns are ordered as the whole body joint vector
+      * @param segment_index Index of the segment
+      * @param poses Segment poses computed by calcFK
+      * @param jacobian Output: pre-allocated 6xn Jacobian
+      */
+    void calcJacobian(unsigned int segment_index, const std::vector<KDL::Frame>& poses, Eigen::MatrixXd& jacobian) const;
+
+    /** Returns true if kinematics have been generated for this robot model */
+    bool hasGeneratedKinematics() const;
+
+    /**
+      * Selects the generated kinematics or the generic KDL implementation
+      * @param use Use the generated kinematics (ignored if hasGeneratedKinematics() is false)
+      */
+    void useGeneratedKinematics(bool use);
 
-    /** Jacobian Solver */
-    KDL::TreeJntToJacSolver* jac_solver_;
+    KDL::Tree kdl_tree_;
 
     std::map<std::string, unsigned int> joint_name_to_index_;
 
@@ -37,9 +101,44 @@ public:
 
 protected:
 
+    /** Segments in topological order, the root comes first */
+    std::vector<KDL::SegmentMap::const_iterator> segments_;
+
+    /** Index of the parent of every sorted segment (-1 for the root) */
+    std::vector<int> segment_parent_index_;
+
+    /** Maps segment names to indices in segments_ */
+    std::map<std::string, unsigned int> segment_name_to_index_;
+
+    /** Segments of which the joint position changed since the last calcFK */
+    std::vector<bool> segment_dirty_;
+
+    /** Maps whole body joint indices to indices in q_tree_ and to the index of the segment of the joint */
+    std::vector<int> joint_tree_index_, joint_segment_index_;
+
     /** Number of joints in this tree */
     int number_of_joints_;
 
+    /** Whole body joint positions, input of the generated kinematics */
+    KDL::JntArray q_joints_;
+
+    /** Kinematics generated for this robot model (NULL if not available or not matching) */
+    boost::shared_ptr<GeneratedKinematics> generated_kinematics_;
+
+    bool use_generated_kinematics_;
+
+    /** Generic implementation of calcFK for all segments except the root */
+    void calcFKKDL(std::vector<KDL::Frame>& poses, std::vector<bool>& updated) const;
+
+    /** Generic implementation of calcJacobian */
+    void calcJacobianKDL(unsigned int segment_index, const std::vector<KDL::Frame>& poses, Eigen::MatrixXd& jacobian) const;
+
+    /**
+      * Checks if the generated kinematics have been generated from this tree by comparing
+      * the structure and the results for a test configuration with the KDL implementation
+      */
+    bool matchesGeneratedKinematics();
+
 };
 
 #endif // TREE_H
@@ -16,10 +16,15 @@
 
 #include "AdmittanceController.h"
 #include "ComputeNullspace.h"
+#include "MotionObjectivePool.h"
+#include "TaskStack.h"
 #include "amigo_whole_body_controller/Tracing.hpp"
 
 #include <profiling/StatsPublisher.h>
 
+#include <ros/publisher.h>
+#include <amigo_whole_body_controller/TaskStackStatistics.h>
+
 class WholeBodyController {
 
 public:
@@ -95,6 +100,12 @@ public:
       */
     double getCost();
 
+    /**
+      * Returns the number of heap allocations during the last update, excluding the publishing of the statistics
+      * (always 0 if allocations are not counted, see AllocationCounter)
+      */
+    unsigned long getNrAllocations() const;
+
     RobotState robot_state_;
     
     /**
@@ -126,6 +137,10 @@ protected:
     /** Vector containing pointers to the various motion objectives */
     std::vector<MotionObjective*> motionobjectives_;
 
+    /** Profiling timer names, constructed once since update() must not allocate */
+    std::string timer_name_update_, timer_name_motionobjectives_;
+    std::vector<std::string> motionobjective_timer_names_;
+
     /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
     /** Admittance controller: integrates desired torques to velocities and positions
@@ -143,15 +158,18 @@ protected:
       Is projected into the task null space to avoid interference with the main tasks */
     PostureControl PostureControl_;
 
-    /** Matrix containing the combined Jacobian (Cartesian impedances + collision avoidance) */
-    std::vector<Eigen::MatrixXd> Jacobians_;
+    /** Applies the motion objectives concurrently if ~motion_objective_threads > 0 */
+    MotionObjectivePool motionobjective_pool_;
+
+    /** Stacked Jacobians and torques of the motion objectives, one level per priority */
+    TaskStack task_stack_;
+
+    /** Number of priority levels (~number_of_priority_levels, default 4) */
+    unsigned int num_priority_levels_;
 
-    /** Nullspace projection matrices */
-    std::vector<Eigen::MatrixXd> Ns_;
 
     /** Vector containing the desired joint torques */
     Eigen::VectorXd tau_;
-    std::vector<Eigen::VectorXd> taus_;
 
     /** Vector containing the desired joint velocities */
     Eigen::VectorXd qdot_reference_;
@@ -159,6 +177,56 @@ protected:
     /** Vector containing the desired joint positions */
     Eigen::VectorXd q_reference_;
 
+    /** Posture targets, traced */
+    std::vector<double> q0s_;
+
+    /** Number of updates since the last change of the motion objectives */
+    unsigned int number_of_updates_;
+
+    /** Publishes the utilization of the task stack every task_stack_statistics_period_ updates */
+    ros::Publisher task_stack_pub_;
+    amigo_whole_body_controller::TaskStackStatistics task_stack_statistics_;
+    unsigned int task_stack_statistics_period_, number_of_cycles_;
+
+    /** Publishes the utilization of the task stack (if someone listens) */
+    void publishTaskStackStatistics();
+
+    /** Heap allocations of every motion objective and in total during the last update */
+    std::vector<unsigned long> motionobjective_allocations_;
+    unsigned long allocations_;
+
+    /** Update schedule of a motion objective, see MotionObjective::getUpdatePeriod */
+    struct MotionObjectiveSchedule
+    {
+        /** Number of cycles between updates (1: every cycle) and since the last update */
+        unsigned int period, cycles_since_update;
+
+        /** Whether the motion objective is applied in the current cycle */
+        bool due;
+
+        /** Number of updates so far, the first order hold needs two */
+        unsigned int num_updates;
+
+        /** Torques of the update before the last one and the extrapolated torques */
+        Eigen::VectorXd tau_previous, tau_hold;
+    };
+
+    /** Schedules of the motion objectives, indexed as motionobjectives_ */
+    std::vector<MotionObjectiveSchedule> motionobjective_schedules_;
+
+    /** Motion objectives that are applied in the current cycle */
+    std::vector<MotionObjective*> due_motionobjectives_;
+
+    /** Sample time */
+    double Ts_;
+
+    /**
+      * After a warm-up, update() must not allocate: reports allocations if these are counted
+      * (see AllocationCounter, build with WBC_COUNT_ALLOCATIONS)
+      * @param allocations Number of allocations during the last update
+      */
+    void checkAllocations(unsigned long allocations);
+
     /** Initialize function */
     bool initialize(const double Ts);
 
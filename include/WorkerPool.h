@@ -0,0 +1,75 @@
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+/**
+  * Worker threads that run a task for every index of a range concurrently, the calling thread takes part as well.
+  * A task may only write the results of its own index, the caller combines them in index order afterwards,
+  * which makes the outcome independent of the number of threads (MotionObjectivePool applies the motion objectives on it)
+  */
+class WorkerPool {
+
+public:
+
+    /** Task for a single index */
+    typedef boost::function<void (unsigned int)> Task;
+
+    /** Constructor */
+    WorkerPool();
+
+    /** Deconstructor, stops the worker threads */
+    virtual ~WorkerPool();
+
+    /**
+      * Starts the worker threads, can be called once
+      * @param num_threads Number of worker threads besides the calling thread, 0 runs the tasks serially
+      */
+    void initialize(unsigned int num_threads);
+
+    /** Returns the number of worker threads */
+    unsigned int getNrThreads() const;
+
+    /**
+      * Runs task(i) for i = 0 .. num_tasks-1 and returns when all of them are done
+      * The task must outlive the call, store it to avoid constructing a boost::function every cycle
+      */
+    void run(unsigned int num_tasks, const Task& task);
+
+protected:
+
+    /** Loop of a worker thread */
+    void work();
+
+    /** Runs the indices that have not been claimed by another thread, until none are left */
+    void runRemaining();
+
+    /** Stops and joins the worker threads */
+    void stop();
+
+    boost::thread_group threads_;
+    unsigned int num_threads_;
+
+    /** Protects the members below, start_ is signalled for every run, done_ when all workers have finished */
+    boost::mutex mutex_;
+    boost::condition_variable start_, done_;
+
+    /** Incremented for every run, the workers start when it changes */
+    unsigned int generation_;
+
+    /** Number of workers that have not finished the current generation */
+    unsigned int num_busy_;
+
+    bool stopping_;
+
+    /** Work of the current generation */
+    const Task* task_;
+    unsigned int num_tasks_;
+
+    /** Next index to run, claimed atomically */
+    volatile unsigned int next_index_;
+
+};
+
+#endif
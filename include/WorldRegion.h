@@ -0,0 +1,93 @@
+#ifndef WORLDREGION_H_
+#define WORLDREGION_H_
+
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+// FCL
+#include <fcl/BV/AABB.h>
+#include <fcl/collision_object.h>
+#include <fcl/shape/geometric_shapes.h>
+#include <fcl/broadphase/broadphase_dynamic_AABB_tree.h>
+
+#include "amigo_whole_body_controller/world.h"
+
+/**
+  * Objects of the world within reach of the robot, such that the environment distances of the bodies are only
+  * queried against a small local collision manager instead of the manager of the whole (building-scale) world
+  *
+  * The envelope of the robot is the bounding box of its bodies, enlarged by the cutoff of the environment distances:
+  * every object outside of the envelope is further than the cutoff from all bodies. The region is the envelope
+  * enlarged by a margin, it is kept as long as the envelope stays inside. Once the base or the arms move the envelope
+  * out of it, the region is moved and only the objects that left or entered it are removed from or added to the
+  * local manager. A new version of the world replaces all objects.
+  *
+  * Worlds that are not versioned (version 0) may change without notice, they are always queried as a whole.
+  */
+class WorldRegion {
+
+public:
+
+    /** Constructor */
+    WorldRegion();
+
+    /** Deconstructor */
+    virtual ~WorldRegion();
+
+    /**
+      * Clears the region
+      * @param margin Distance in [m] by which the region exceeds the envelope on every side
+      */
+    void initialize(double margin);
+
+    /**
+      * Updates the objects in the region
+      * @param world World of which the objects are selected, it is kept until the next update
+      * @param envelope Bounding box of the robot bodies enlarged by the cutoff (in map frame)
+      * @return Collision manager with the objects in the region, or the manager of the world if it is not versioned
+      */
+    fcl::BroadPhaseCollisionManager* update(const wbc::WorldPtr& world, const fcl::AABB& envelope);
+
+    /** Returns the number of objects in the region */
+    unsigned int getNrObjects() const;
+
+    /** Returns the number of objects that were added to and removed from the region since the previous call */
+    void getStatistics(unsigned int& num_added, unsigned int& num_removed);
+
+protected:
+
+    //! World of which the objects are registered and its version
+    wbc::WorldPtr world_;
+    unsigned long world_version_;
+
+    //! Distance by which the region exceeds the envelope
+    double margin_;
+
+    //! Current region (in map frame), invalid until the first update
+    fcl::AABB region_;
+    bool has_region_;
+
+    //! Box of the region with which the world is queried, reused such that moving the region does not allocate
+    boost::shared_ptr<fcl::Box> region_box_;
+    boost::scoped_ptr<fcl::CollisionObject> region_object_;
+
+    //! Objects in the region, sorted by address
+    std::vector<fcl::CollisionObject*> objects_;
+
+    //! Workspaces: objects in the new region and the objects that left or entered it
+    std::vector<fcl::CollisionObject*> candidates_, changes_;
+
+    //! Local collision manager with the objects in the region
+    fcl::DynamicAABBTreeCollisionManager manager_;
+
+    //! Statistics
+    unsigned int num_added_, num_removed_;
+
+    //! Collects the objects of a world manager that overlap region_ in candidates_, sorted by address
+    void selectObjects(fcl::BroadPhaseCollisionManager* manager);
+
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef FILEWORLDCLIENT_H
+#define FILEWORLDCLIENT_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcl/broadphase/broadphase_dynamic_AABB_tree.h>
+#include <fcl/collision_object.h>
+#include <fcl/data_types.h>
+
+#include "worldclient.h"
+
+namespace wbc {
+
+/**
+ * World of static collision objects
+ */
+class StaticWorld : public World
+{
+public:
+    StaticWorld();
+
+    void addObject(const boost::shared_ptr<fcl::CollisionObject>& object);
+
+    /** Registers the objects in the collision manager, must be called once after all objects have been added */
+    void setup();
+
+    fcl::BroadPhaseCollisionManager* getCollisionManager();
+
+    unsigned int getNrObjects() const;
+
+protected:
+    std::vector< boost::shared_ptr<fcl::CollisionObject> > objects_;
+
+    fcl::DynamicAABBTreeCollisionManager manager_;
+};
+
+/**
+ * Loads a static world from a scene file, as a stand-in for a world model (for benchmarks and offline testing)
+ *
+ * A scene file has an object per line, poses are in map frame with angles in [rad], lengths in [m]
+ * and lines starting with # are comments:
+ *
+ *   box      <size x> <size y> <size z>  <x> <y> <z> [<roll> <pitch> <yaw>]
+ *   cylinder <radius> <length>           <x> <y> <z> [<roll> <pitch> <yaw>]
+ *   sphere   <radius>                    <x> <y> <z>
+ *   mesh     <file> <scale>              <x> <y> <z> [<roll> <pitch> <yaw>]
+ *
+ * Meshes are COLLADA files (triangles only, e.g. data/cone.dae), relative to the directory of the scene file.
+ * Every mesh file is loaded once and shared by the objects that use it with the same scale.
+ */
+class FileWorldClient : public WorldClient
+{
+public:
+    FileWorldClient(const std::string& filename);
+
+    /** Loads the scene file */
+    void initialize();
+
+    /** Publishes the loaded world */
+    void start();
+
+    /** Whether the scene file has been loaded without errors */
+    bool isLoaded() const;
+
+    /** Returns the number of objects in the loaded world */
+    unsigned int getNrObjects() const;
+
+    /**
+     * Loads the triangles of a COLLADA file
+     * @param filename COLLADA file
+     * @param scale Scale of the vertices
+     * @param vertices, triangles Output: mesh, converted to z up if the file is y up
+     * @return false if the file could not be read or has no triangles
+     */
+    static bool loadMesh(const std::string& filename, double scale, std::vector<fcl::Vec3f>& vertices, std::vector<fcl::Triangle>& triangles);
+
+protected:
+    std::string filename_;
+
+    boost::shared_ptr<StaticWorld> world_;
+
+    /** Meshes that have been loaded, by file and scale */
+    std::map<std::pair<std::string, double>, boost::shared_ptr<fcl::CollisionGeometry> > meshes_;
+
+    /** Parses a line of the scene file and adds its object to the world */
+    bool parseObject(const std::string& line, const std::string& directory);
+
+    /** Returns the (cached) mesh of a COLLADA file, NULL if it can not be loaded */
+    boost::shared_ptr<fcl::CollisionGeometry> getMesh(const std::string& filename, double scale);
+};
+
+} // namespace
+
+#endif // FILEWORLDCLIENT_H
@@ -78,8 +78,12 @@ protected:
 
     /** Matrix containing the combined Jacobian matrix of this objective */
     Eigen::MatrixXd jacobian_pre_alloc_;
+    /** 6xn Jacobian of the end-effector (in map frame) */
+    Eigen::MatrixXd partial_jacobian_;
     /** Vector containing all relevant wrench entries */
     Eigen::VectorXd wrenches_pre_alloc_;
+    /** Wrench of the impedance (in map frame) */
+    Eigen::VectorXd F_task_;
 
     // Converts Converts geometry_msgs::PoseStamped to KDL::Frame
     void stampedPoseToKDLframe(const geometry_msgs::PoseStamped& pose, KDL::Frame& frame);
@@ -128,13 +132,26 @@ protected:
 
     ros::Publisher vis_pub;
 
+    /** Markers for the goal constraint and an arrow from tip to goal */
+    visualization_msgs::Marker marker_, marker_arrow_;
+
     /** Tracing object */
     Tracing tracer_;
 
     /** For transforming goals to the robot */
     tf::TransformListener *listener_;
 
-    bool lookupTransform(const RobotState &robotstate, const std::string &in_frame, KDL::Frame &out_frame);
+    /** Handles of the tip and root frames in the FK solution
+      * The root frame handle is -1 if the root frame is not part of the tree (tf is used instead) */
+    int tip_frame_handle_, root_frame_handle_;
+
+    /** Resolves the frame handles, returns false if the tip or root frame cannot be found */
+    bool resolveFrames(const RobotState &robotstate);
+
+    bool lookupTransform(const RobotState &robotstate, int frame_handle, const std::string &in_frame, KDL::Frame &out_frame);
+
+    /** As lookupTransform, but frames in the tree are computed from the latest joint positions (see RobotState::calcFK) */
+    bool lookupCurrentTransform(const RobotState &robotstate, int frame_handle, const std::string &in_frame, KDL::Frame &out_frame);
 };
 
 #endif
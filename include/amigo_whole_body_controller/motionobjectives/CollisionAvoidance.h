@@ -16,12 +16,18 @@
 #include "Tree.h"
 #include "amigo_whole_body_controller/worldclient.h"
 #include "amigo_whole_body_controller/Tracing.hpp"
+#include "ShapeDistance.h"
+#include "DistanceCache.h"
+#include "WorkerPool.h"
+#include "EnvironmentDistanceField.h"
+#include "WorldRegion.h"
 
 
 #ifdef USE_BULLET
 // Bullet GJK Closest Point calculation
 #include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
 #include <BulletCollision/CollisionShapes/btBoxShape.h>
+#include <BulletCollision/CollisionShapes/btCapsuleShape.h>
 #include <BulletCollision/CollisionShapes/btConeShape.h>
 #include <BulletCollision/CollisionShapes/btCylinderShape.h>
 #include <BulletCollision/CollisionShapes/btSphereShape.h>
@@ -55,7 +61,7 @@ namespace wbc {
  */
 struct CollisionGeometryData
 {
-  CollisionGeometryData(RobotState::CollisionBody *link)
+  CollisionGeometryData(RobotState::CollisionBody *link, unsigned int id) : id(id)
   {
     ptr.link = link;
   }
@@ -105,6 +111,55 @@ struct CollisionGeometryData
     const void                      *raw;
   } ptr;
 
+  /** \brief Dense index of the collision body, in the order of the collision groups (see AllowedCollisionMatrix) */
+  unsigned int id;
+
+#ifdef USE_FCL
+  /** \brief Pose of the shape in the collision body frame, for primitives that are not aligned with their fcl axis (CylinderY) */
+  fcl::Transform3f local_transform;
+#endif
+
+};
+
+/**
+ * @brief Pairs of collision bodies of which the distance is not computed, indexed by CollisionGeometryData::id
+ *
+ * Built once from the collision groups (bodies in the same group) and the exclusions, such that
+ * the broadphase callback only has to test a single bit per candidate pair.
+ */
+class AllowedCollisionMatrix
+{
+public:
+
+  /** \brief Clears the matrix for num_bodies bodies, no pair is allowed */
+  void initialize(unsigned int num_bodies)
+  {
+    num_bodies_ = num_bodies;
+    bits_.assign(num_bodies * num_bodies, false);
+  }
+
+  /** \brief Allows the pair (a, b) and (b, a) */
+  void allow(unsigned int a, unsigned int b)
+  {
+    bits_[a * num_bodies_ + b] = true;
+    bits_[b * num_bodies_ + a] = true;
+  }
+
+  /** \brief Whether the distance between a and b is not computed */
+  bool isAllowed(unsigned int a, unsigned int b) const
+  {
+    return bits_[a * num_bodies_ + b];
+  }
+
+  unsigned int getNrBodies() const
+  {
+    return num_bodies_;
+  }
+
+private:
+
+  unsigned int num_bodies_;
+  std::vector<bool> bits_;
 };
 
 class CollisionAvoidance : public MotionObjective
@@ -127,8 +182,36 @@ public:
         } ;
         Parameters self_collision;
         Parameters environment_collision;
+        double update_period;   // Target update period in seconds, 0 updates every cycle
+        bool first_order_hold;  // Extrapolate the torques in between updates
+        std::string distance_backend;       // Self-collision distances: "fcl" or "bullet"
+        bool cross_validation;              // Run both backends and report the bodies on which they disagree
+        double cross_validation_tolerance;  // Distance difference in [m] that is reported
+        bool analytic_distances;            // Keep fcl primitives instead of meshes and compute their distances analytically
+        bool batched_distances;             // Compute the self-collision pairs of primitives together after the broadphase
+        bool distance_caching;              // Skip pairs that can not have come within the cutoff since their last distance
+        int distance_threads;               // Worker threads for the distance queries of the bodies, 0 queries them serially
+        struct DistanceField
+        {
+            bool enabled;                   // Environment distances of the octomap from a signed distance field
+            double resolution;              // Cell size in [m]
+            double size_xy;                 // Size of the window around the robot in [m]
+            double size_z;                  // Height of the window above the base in [m]
+        } distance_field;
+        struct RegionOfInterest
+        {
+            bool enabled;                   // Query the environment distances against the world objects within reach only
+            double margin;                  // Distance in [m] by which the region exceeds the reach of the robot
+        } region_of_interest;
     } ca_param_;
 
+    /// Library that computes the self-collision distances
+    enum DistanceBackend
+    {
+        FCL,
+        BULLET
+    };
+
     //ToDo: make configure, start- and stophook. Components can be started/stopped in an actionlib kind of fashion
 
     /**
@@ -148,21 +231,16 @@ public:
 
     void apply(RobotState& robotstate);
 
+    /** Returns the number of repulsive forces, the Jacobian has spare rows such that it is not reallocated when this changes */
+    unsigned int getNrRows();
+
     void setCollisionWorld(WorldClient *world_client);
 
-    void setOctoMap(octomap::OcTreeStamped* octree);
+    /** Replaces the octomap, the tree must not be modified afterwards by others */
+    void setOctoMap(const boost::shared_ptr<OctreeType>& octree);
 
     void removeOctomapBBX(const geometry_msgs::Point& goal, const std::string& root);
 
-    /** Adds object collisionmodel to robot collisionmodel
-     * @param frame_id: frame where the object is added to */
-    void addObjectCollisionModel(const std::string& frame_id);
-
-    /** Remove object collision model
-     */
-    void removeObjectCollisionModel();
-
-
 protected:
 
     //! Sampling time
@@ -183,18 +261,21 @@ protected:
         double size_voxel;
     };
     struct Distance {
-        std::string frame_id;
+        int frame_handle;
+        const RobotState::CollisionBody* body;
         btPointCollector bt_distance;
     } ;
     struct Distance2 {
-        std::string frame_id;
+        int frame_handle;
+        const RobotState::CollisionBody* body;
 #ifdef USE_FCL
         fcl::DistanceResult result;
 #endif
     };
 
     struct RepulsiveForce {
-        std::string frame_id;
+        int frame_handle;
+        const RobotState::CollisionBody* body;
         Eigen::Vector3d pointOnA;
         Eigen::Vector3d direction;
         float amplitude;
@@ -203,20 +284,36 @@ protected:
     // provide << printing functionality
     friend std::ostream& operator << (std::ostream &o, const RepulsiveForce &r)
     {
-        o << r.frame_id << " ";
+        o << r.body->frame_id << " ";
         o << r.pointOnA[0]  << " " << r.pointOnA[1]  << " " << r.pointOnA[2]  << " ";
         o << r.direction[0] << " " << r.direction[1] << " " << r.direction[2] << " ";
         o << r.amplitude;
         return o;
     }
 
-    /** Matrix containing the combined Jacobian matrix of this objective */
-    Eigen::MatrixXd jacobian_pre_alloc_;
-    /** Vector containing all relevant wrench entries */
+    /** Number of rows of jacobian_ that are used: a row per repulsive force */
+    unsigned int num_rows_;
+    /** Vector containing all relevant wrench entries, the first num_rows_ are used */
     Eigen::VectorXd wrenches_pre_alloc_;
 
+    /** Profiling timer names, constructed once since apply() must not allocate */
+    std::string timer_name_apply_, timer_name_self_collision_, timer_name_self_collision_fast_, timer_name_environment_collision_,
+                timer_name_environment_field_, timer_name_repulsive_force_, timer_name_wrenches_, timer_name_visualize_;
+
+    /** 6xn Jacobian of the point on which a repulsive force acts (in map frame) */
+    Eigen::MatrixXd partial_jacobian_;
+
+    /** Minimum distances and repulsive forces of the current cycle
+      * Members instead of locals so that their capacity is reused every cycle */
+    std::vector<Distance> min_distances_total_;
+    std::vector<Distance2> min_distances_total_fcl_;
+    std::vector<RepulsiveForce> repulsive_forces_total_;
+
     KDL::Frame no_fix_;
 
+    /** Backend that computes the self-collision distances, parsed from ca_param_.distance_backend */
+    DistanceBackend backend_;
+
     /**
      * @brief The current WorldClient that is in use
      *
@@ -225,12 +322,53 @@ protected:
      */
     WorldClient *world_client_;
 
-    octomap::OcTreeStamped* octomap_;
+    /** Latest octomap, shared with environment_field_ which may still be reading it: replace it instead of modifying it */
+    boost::shared_ptr<OctreeType> octomap_;
+
+    /** Signed distance field of octomap_, built in the background if ca_param_.distance_field.enabled */
+    EnvironmentDistanceField environment_field_;
+
+    /** Samples of every body in the frame of fk_pose * fix_pose and the margin that is subtracted from their distance, indexed by CollisionGeometryData::id */
+    std::vector<std::vector<Eigen::Vector3d> > field_samples_;
+    std::vector<double> field_margins_;
 
 #ifdef USE_FCL
     fcl::DynamicAABBTreeCollisionManager selfCollisionManager;
+
+    /** Minimum self-collision distance of every body in the current cycle, indexed by CollisionGeometryData::id */
+    std::vector<fcl::DistanceResult> self_distances_;
+
+    /** Self-collision pairs within the cutoff found by the query of every body (parallel queries only) */
+    std::vector<std::vector<fcl::DistanceResult> > self_pair_results_;
+
+    /** Self-collision pairs of primitives whose distances are computed together (batched distances) and their objects:
+     *  one batch per body for the parallel queries, the last one for the pairwise pass */
+    std::vector<ShapeDistanceBatch> self_pair_batches_;
+    std::vector<std::vector<std::pair<fcl::CollisionObject*, fcl::CollisionObject*> > > self_pair_objects_;
+
+    /** Minimum environment distance of every body in the current cycle */
+    std::vector<fcl::DistanceResult> environment_distances_;
+
+    /** World that is queried in the current cycle */
+    fcl::BroadPhaseCollisionManager* environment_manager_;
+
+    /** Objects of the world within reach of the robot, queried instead of the whole world if ca_param_.region_of_interest.enabled */
+    WorldRegion world_region_;
 #endif
 
+    /** Collision bodies, indexed by CollisionGeometryData::id */
+    std::vector<RobotState::CollisionBody*> bodies_;
+
+    /** Queries the distances of the bodies concurrently if ca_param_.distance_threads > 0 */
+    WorkerPool distance_pool_;
+    WorkerPool::Task self_collision_task_, environment_collision_task_;
+
+    /** Self-collision pairs that are skipped */
+    AllowedCollisionMatrix allowed_collisions_;
+
+    /** Last distances of the self-collision and environment pairs, indexed by CollisionGeometryData::id */
+    DistanceCache distance_cache_;
+
     btConvexPenetrationDepthSolver*	depthSolver;
     btSimplexSolverInterface* simplexSolver;
 
@@ -245,6 +383,18 @@ protected:
     void selfCollision(std::vector<Distance> &min_distances);
     void selfCollisionFast(std::vector<Distance2> &min_distances);
 
+    /**
+     * @brief Finds the self-collision pairs of a body with the bodies of a higher id within the cutoff (task of distance_pool_)
+     * @param Input: id of the body, Output: self_pair_results_[id]
+     */
+    void selfCollisionQuery(unsigned int id);
+
+    /**
+     * @brief Compares the minimum self-collision distances of both backends and reports the largest difference
+     * @param Input: Bullet and FCL minimum distances of the same cycle
+     */
+    void crossValidate(const std::vector<Distance> &min_distances, const std::vector<Distance2> &min_distances_fcl) const;
+
     /**
      * @brief Calculate the repulsive forces as a result of environment collision avoidance
      * @param Output: Vector with the minimum distances to the environment, vector with the repulsive forces
@@ -252,14 +402,43 @@ protected:
     void environmentCollision(std::vector<Distance>  &min_distances);
 #ifdef USE_FCL
     void environmentCollisionVWM(std::vector<Distance2> &min_distances);
+
+    /**
+     * @brief Finds the minimum distance of a body to environment_manager_ (task of distance_pool_)
+     * @param Input: id of the body, Output: environment_distances_[id]
+     */
+    void environmentCollisionQuery(unsigned int id);
+
+    /**
+     * @brief Finds the minimum distance of every body to the octomap from the samples of the body in environment_field_
+     * @param Output: Vector with the minimum distances to the environment, the results have no second object
+     */
+    void environmentCollisionField(std::vector<Distance2> &min_distances);
 #endif
 
+    /**
+     * @brief Samples the collision bodies for environment_field_
+     * @param Input: The robot state, the collision bodies must have been constructed
+     */
+    void initializeDistanceField(RobotState &robotstate);
+
     /**
      * @brief Construct the collision bodies
      * @param Input: The robot state
      */
     void initializeCollisionModel(RobotState &robotstate);
 
+    /**
+     * @brief Allows the pairs in the same collision group and the excluded pairs
+     * @param Input: The robot state, the collision bodies must have been constructed
+     */
+    void initializeAllowedCollisions(RobotState &robotstate);
+
+    /**
+     * @brief Returns the dense index of a collision body
+     */
+    static unsigned int getCollisionBodyId(const RobotState::CollisionBody &collisionBody);
+
     /**
      * @brief Calculate the pose of the collision bodies
      */
@@ -357,9 +536,12 @@ protected:
     /** Tracing object */
     Tracing tracer_;
 
-    std::vector<Distance2>::const_iterator findMinimumDistance(const std::vector<Distance2> &distances, std::string link);
+    /** Link of which the minimum distance and maximum repulsive force are traced */
+    std::string traced_link_;
+
+    std::vector<Distance2>::const_iterator findMinimumDistance(const std::vector<Distance2> &distances, const std::string& link);
 
-    std::vector<CollisionAvoidance::RepulsiveForce>::const_iterator findMaxRepulsiveForce(const std::vector<RepulsiveForce> &forces, std::string link);
+    std::vector<CollisionAvoidance::RepulsiveForce>::const_iterator findMaxRepulsiveForce(const std::vector<RepulsiveForce> &forces, const std::string& link);
 
     StatsPublisher statsPublisher_;
 };
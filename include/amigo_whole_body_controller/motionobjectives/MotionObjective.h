@@ -29,16 +29,33 @@ public:
     virtual double getCost();
 
     /** Returns the torques of this motion objective */
-    virtual Eigen::VectorXd getTorques();
+    virtual const Eigen::VectorXd& getTorques();
 
     /** Returns relevant Jacobian matrix */
-    virtual Eigen::MatrixXd getJacobian();
+    virtual const Eigen::MatrixXd& getJacobian();
+
+    /** Returns the number of rows of the Jacobian that are used, the Jacobian may have spare rows
+      * such that it does not have to be reallocated when the number of rows changes */
+    virtual unsigned int getNrRows();
 
     /** Returns the priority of this motion objective
      * @return priority
      */
     unsigned int getPriority();
 
+    /** Returns the target update period in seconds, 0 if this motion objective is applied every cycle */
+    double getUpdatePeriod() const;
+
+    /** Returns whether the torques are extrapolated (first order hold) in the cycles between updates,
+      * otherwise the torques of the last update are used (zero order hold) */
+    bool useFirstOrderHold() const;
+
+    /** Sets the target update period. In the cycles in between the last Jacobian and torques are reused
+      * @param period Update period in seconds, 0 updates every cycle
+      * @param first_order_hold Extrapolate the torques using the last two updates
+      */
+    void setUpdatePeriod(double period, bool first_order_hold = false);
+
     /**
      * Type of the motion objective
      */
@@ -73,6 +90,10 @@ protected:
     /** Costs associated with this motion objective */
     double cost_;
 
+    /** Target update period in seconds (0: every cycle) and whether the torques are extrapolated in between */
+    double update_period_;
+    bool first_order_hold_;
+
 };
 
 typedef boost::shared_ptr<MotionObjective> MotionObjectivePtr;
@@ -13,6 +13,20 @@ public:
 
     virtual fcl::BroadPhaseCollisionManager* getCollisionManager() = 0;
 
+    /**
+     * Returns the version of the world, which must change whenever objects are added, removed or moved
+     * Worlds that are not versioned return 0, their distances are not cached (see DistanceCache).
+     * Worlds published by WorldClient::publishWorld get increasing versions
+     */
+    virtual unsigned long getVersion() const { return version_; }
+
+    /** Sets the version, the world must not be changed after it has been published */
+    void setVersion(unsigned long version) { version_ = version; }
+
+protected:
+
+    unsigned long version_;
+
 };
 
 typedef boost::shared_ptr<World> WorldPtr;
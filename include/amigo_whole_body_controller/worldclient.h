@@ -1,22 +1,82 @@
 #ifndef WORLDCLIENT_H
 #define WORLDCLIENT_H
 
+#include <string>
+#include <vector>
+
 #include "world.h"
 
 namespace wbc {
 
+/**
+ * Source of the world that the collision avoidance queries every cycle
+ *
+ * Implementations that update the world in their own thread can publish immutable snapshots with publishWorld,
+ * getWorld then returns the latest snapshot without ever blocking the controller (triple buffering: the world-model
+ * thread fills a slot of its own, the controller reads a slot of its own and the third slot is exchanged with a single
+ * atomic exchange, hence both sides are wait-free).
+ * Every snapshot gets a higher version, which tells the distance cache whether the world changed since the previous cycle.
+ *
+ * The controller keeps copies of the world it queried (e.g. the region of interest, until it sees the next world).
+ * Worlds that leave the buffer while such a copy exists are retired and destroyed in publishWorld once the controller
+ * released them, such that published worlds are always destroyed in the world-model thread.
+ */
 class WorldClient
 {
 public:
     WorldClient();
 
+    virtual ~WorldClient();
+
     virtual void initialize() {}
 
-    virtual WorldPtr getWorld() = 0;
+    /**
+     * Returns the latest published world, NULL if none has been published yet
+     * Must always be called from the same (controller) thread
+     */
+    virtual WorldPtr getWorld();
 
     virtual void start() = 0;
 
     virtual void setIgnoredEntities(std::vector<std::string> entities) {}
+
+    /** Returns the version of the latest published world, 0 if none has been published yet */
+    unsigned long getVersion() const;
+
+protected:
+
+    /**
+     * Publishes a snapshot of the world, sets its version
+     * The collision manager of the world must have been set up and neither may change afterwards.
+     * Must always be called from the same (world-model) thread
+     */
+    void publishWorld(const WorldPtr& world);
+
+private:
+
+    /** Slots of the triple buffer */
+    WorldPtr slots_[3];
+
+    /** Slot in the middle (lowest two bits) and whether it holds a world that the reader has not seen yet */
+    volatile unsigned int middle_;
+
+    /** Slots owned by the writer and the reader */
+    unsigned int back_, front_;
+
+    /** Number of published worlds */
+    volatile unsigned long version_;
+
+    static const unsigned int INDEX_MASK = 3;
+    static const unsigned int FRESH = 4;
+
+    /** Worlds that left the buffer but may still be in use by the controller, only accessed by the world-model thread */
+    std::vector<WorldPtr> retired_;
+
+    /** Atomically replaces the middle slot, returns the previous value */
+    unsigned int exchangeMiddle(unsigned int middle);
+
+    /** Destroys the retired worlds that are no longer in use */
+    void releaseRetired();
 };
 
 } // namespace
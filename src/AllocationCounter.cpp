@@ -0,0 +1,105 @@
+#include "AllocationCounter.h"
+
+#ifdef WBC_COUNT_ALLOCATIONS
+
+#include <cerrno>
+#include <cstddef>
+
+/// Wrap the glibc allocator: these definitions take precedence over the ones in libc
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t number, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+}
+
+namespace {
+
+volatile unsigned long allocation_count = 0;
+
+}
+
+extern "C" void* malloc(size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t number, size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_calloc(number, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_realloc(ptr, size);
+}
+
+/// Aligned allocations (Eigen, aligned operator new) do not go through malloc
+extern "C" void* memalign(size_t alignment, size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* result = __libc_memalign(alignment, size);
+    if (!result) {
+        return ENOMEM;
+    }
+    *ptr = result;
+    return 0;
+}
+
+extern "C" void* valloc(size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_valloc(size);
+}
+
+extern "C" void* pvalloc(size_t size)
+{
+    __sync_fetch_and_add(&allocation_count, 1);
+    return __libc_pvalloc(size);
+}
+
+bool AllocationCounter::enabled()
+{
+    return true;
+}
+
+unsigned long AllocationCounter::count()
+{
+    return allocation_count;
+}
+
+#else
+
+bool AllocationCounter::enabled()
+{
+    return false;
+}
+
+unsigned long AllocationCounter::count()
+{
+    return 0;
+}
+
+#endif
@@ -1,9 +1,10 @@
 #include "ComputeNullspace.h"
 
-#include <Eigen/SVD>
+#include <algorithm>
+#include <cmath>
 #include <ros/console.h>
 
-ComputeNullspace::ComputeNullspace() {
+ComputeNullspace::ComputeNullspace() : identity_weight_(true), decomposition_(LDLT), rank_tolerance_(1e-10), block_sparse_(false) {
 
 }
 
@@ -11,85 +12,384 @@ ComputeNullspace::~ComputeNullspace() {
 
 }
 
-void ComputeNullspace::initialize(const uint num_joints, const Eigen::MatrixXd& A) {
+void ComputeNullspace::initialize(const uint num_joints, const Eigen::MatrixXd& A, Decomposition decomposition, bool block_sparse) {
 
-    previous_num_active_dofs_ = 0;
-    uint num_dofs = 0;
-
-    ///Jpinv_.resize(num_joints,num_dof);
     A_.resize(num_joints,num_joints);
     A_ = A;
-    Sinv_.resize(num_dofs,num_dofs);
-    Sinv_.setZero();
+    identity_weight_ = A_.isIdentity();
+
+    decomposition_ = decomposition;
+    if (decomposition_ == COLPIV_QR && !identity_weight_) {
+        ROS_WARN("QR decomposition requires identity weighting, using LDLT");
+        decomposition_ = LDLT;
+    }
+
+    block_sparse_ = block_sparse && decomposition_ == LDLT && identity_weight_;
+    if (block_sparse && !block_sparse_) {
+        ROS_WARN("Block sparse nullspace requires LDLT and identity weighting, decomposing full levels");
+    }
+    block_solvers_.clear();
+
+    suffix_.resize(num_joints);
+    w_.resize(num_joints);
+    gathered_.resize(num_joints);
+
+    workspaces_.clear();
+    levels_.clear();
+    ranks_.clear();
+
+    ROS_INFO("Nullspace calculator initialized");
+
+}
+
+bool ComputeNullspace::getDecomposition(const std::string& name, Decomposition& decomposition) {
 
-    /*for (uint i = 0; i < num_dofs; i++) {
-        for (uint j = 0; j < num_dofs; j++) {
-            Sinv_(i,j) = 0;
+    if (name == "svd") {
+        decomposition = SVD;
+    } else if (name == "qr") {
+        decomposition = COLPIV_QR;
+    } else if (name == "ldlt") {
+        decomposition = LDLT;
+    } else {
+        return false;
+    }
+    return true;
+
+}
+
+ComputeNullspace::Workspace& ComputeNullspace::getWorkspace(unsigned int level, unsigned int num_rows) {
+
+    std::vector<Workspace>& workspaces = workspaces_[level];
+    if (workspaces.size() <= num_rows) {
+        workspaces.resize(num_rows + 1);
+    }
+
+    Workspace& ws = workspaces[num_rows];
+    if (ws.JrT.cols() != (int)num_rows) {
+        unsigned int num_joints = A_.rows();
+        ws.JrT.resize(num_joints, num_rows);
+        if (!identity_weight_) {
+            ws.AJt.resize(num_joints, num_rows);
         }
-    }*/
-
-    I_.resize(num_joints,num_joints);
-    I_.setIdentity();
-    /*for (uint i = 0; i < num_joints; i++) {
-        for (uint j = 0; j < num_joints; j++) {
-            if (i == j) I_(i,j) = 1;
-            else I_(i,j) = 0;
+        ws.WJ.resize(num_rows, num_rows);
+        switch (decomposition_) {
+        case SVD:
+            ws.WJsvd = Eigen::JacobiSVD<Eigen::MatrixXd>(num_rows, num_rows, Eigen::ComputeThinU | Eigen::ComputeFullV);
+            ws.VSinv.resize(num_rows, num_rows);
+            ws.WJinv.resize(num_rows, num_rows);
+            break;
+        case LDLT:
+            ws.WJldlt.resize(num_rows);
+            break;
+        case COLPIV_QR:
+            ws.JrTqr = Eigen::ColPivHouseholderQR<Eigen::MatrixXd>(num_joints, num_rows);
+            break;
         }
-    }*/
-    ROS_INFO("Nullspace calculator initialized");
+        ws.Dinv.resize(num_rows);
+        ws.G.resize(num_rows, num_joints);
+        ws.y.resize(num_rows);
+        if (block_sparse_) {
+            ws.block_rows.resize(num_rows);
+            ws.block_cols.resize(num_joints);
+            ws.row_begin.resize(num_rows + 1);
+            ws.col_begin.resize(num_rows + 1);
+            ws.parent.resize(num_rows);
+            ws.col_owner.resize(num_joints);
+            ws.block_index.resize(num_rows);
+            ws.B.resize(num_joints, num_rows);
+        }
+    }
+    return ws;
+}
 
+void ComputeNullspace::update(const TaskStack& task_stack, Eigen::VectorXd& tau) {
+
+    unsigned int num_levels = task_stack.getNrLevels();
+
+    // Only allocates the first time: levels_ refers into workspaces_
+    if (workspaces_.size() < num_levels) {
+        workspaces_.resize(num_levels);
+        levels_.resize(num_levels);
+        ranks_.resize(num_levels);
+    }
+
+    // Decompose the levels from the highest priority downwards, the lowest level is never projected out
+    for (unsigned int i = 0; i + 1 < num_levels; ++i) {
+        addLevel(i, task_stack.getJacobian(i), task_stack.getNrRows(i));
+    }
+
+    // tau = sum_i t_i - sum_i C_i * (t_(i+1) + ... + t_last)
+    tau.setZero();
+    suffix_ = task_stack.getTorques(num_levels-1);
+    for (int i = num_levels-2; i >= 0; --i) {
+        subtractLevelComponent(i, suffix_, tau);
+        suffix_ += task_stack.getTorques(i);
+    }
+    tau += suffix_;
+
+}
+
+unsigned int ComputeNullspace::getRank(unsigned int level) const {
+    return ranks_[level];
 }
 
-void ComputeNullspace::update(const Eigen::MatrixXd& J, Eigen::MatrixXd& N) {
+unsigned int ComputeNullspace::getNrBlocks(unsigned int level) const {
+    return levels_[level] ? levels_[level]->num_blocks : 0;
+}
 
-    // Resize matrices in case of different number of active tasks
+void ComputeNullspace::addLevel(unsigned int level, const Eigen::MatrixXd& J, unsigned int num_rows) {
 
-    // If Jacobian is empty, return identity matrix
-    if (J.rows() == 0) {
-        N.setIdentity();
+    // An empty level does not restrict the nullspace
+    if (num_rows == 0) {
+        levels_[level] = 0;
+        ranks_[level] = 0;
+        return;
     }
-    else {
 
-        if (J.rows() != (int)previous_num_active_dofs_) {
-            Sinv_.resize(J.rows(), J.rows());
-            previous_num_active_dofs_ = J.rows();
+    // All intermediate results are stored in the workspace of this number of rows to avoid allocations
+    Workspace& ws = getWorkspace(level, num_rows);
+
+    // The rank is relative to the rows before the restriction: if the higher levels remove them entirely, only
+    // rounding errors remain of Jr, which must not be inverted
+    double threshold = rank_tolerance_ * getRowScale(J, num_rows);
+
+    // Restrict the Jacobian to the nullspace of the higher priority levels: Jr^T = J^T - sum_j C_j * J^T
+    // The decompositions of these levels are reused, levels with rank 0 do not restrict anything
+    ws.JrT = J.block(0, 0, num_rows, J.cols()).transpose();
+    for (unsigned int j = 0; j < level; ++j) {
+        if (ranks_[j] > 0) {
+            for (unsigned int c = 0; c < num_rows; ++c) {
+                subtractLevelComponent(j, J.row(c).transpose(), ws.JrT.col(c));
+            }
         }
-        Sinv_.setZero();
+    }
+
+    unsigned int rank = 0;
+    ws.num_blocks = 0;
+    if (block_sparse_) {
+
+        rank = decomposeBlocks(ws, threshold);
+
+    } else if (decomposition_ == COLPIV_QR) {
+
+        // The first rank columns of Q span the range of Jr^T, hence C = Q1*Q1^T (identity weighting)
+        // The diagonal of R does not increase, its squares compare to the pivots of Jr*Jr^T
+        ws.JrTqr.compute(ws.JrT);
+        const Eigen::MatrixXd& R = ws.JrTqr.matrixQR();
+        while (rank < (unsigned int)std::min(R.rows(), R.cols()) && R(rank, rank) * R(rank, rank) > threshold) {
+            ++rank;
+        }
+
+    } else {
+
         // See Dietrich 2011
+        // W = Jr*A*Jr^T, the weighting is skipped if it is the identity
+        const Eigen::MatrixXd* AJt = &ws.JrT;
+        if (!identity_weight_) {
+            ws.AJt.noalias() = A_ * ws.JrT;
+            AJt = &ws.AJt;
+        }
+        ws.WJ.noalias() = ws.JrT.transpose() * (*AJt);
+
+        if (decomposition_ == SVD) {
 
-        Eigen::MatrixXd WJ = J*A_*J.transpose();
+            ws.WJsvd.compute(ws.WJ, Eigen::ComputeThinU | Eigen::ComputeFullV);
 
-        //Eigen::JacobiSVD<Eigen::MatrixXd> WJsvd(WJ, Eigen::ComputeThinU | Eigen::ComputeThinV);
-        Eigen::JacobiSVD<Eigen::MatrixXd> WJsvd(WJ, Eigen::ComputeThinU | Eigen::ComputeFullV);
+            // Singular directions (e.g. conflicts with higher priority levels) are not inverted
+            const Eigen::VectorXd& Svec = ws.WJsvd.singularValues();
+            for (int i = 0; i < Svec.rows(); i++) {
+                if (Svec(i) > threshold) {
+                    ws.Dinv(i) = 1.0/Svec(i);
+                    ++rank;
+                }
+                else ws.Dinv(i) = 0;
+            }
 
-        ///ROS_INFO("Computing nullspace");
+            // G = (J*A*J^T)^(-1) * (A*J^T)^T
+            ws.VSinv = ws.WJsvd.matrixV() * ws.Dinv.asDiagonal();
+            ws.WJinv.noalias() = ws.VSinv * ws.WJsvd.matrixU().transpose();
+            ws.G.noalias() = ws.WJinv * AJt->transpose();
+
+        } else {
+
+            // P*W*P^T = L*D*L^T, G = P^T * L^-T * D^-1 * L^-1 * P * (A*J^T)^T where zero pivots are not inverted
+            rank = ws.WJldlt.compute(ws.WJ, threshold);
+            ws.G = AJt->transpose();
+            ws.WJldlt.solveInPlace(ws.G);
 
-        // ToDO: Choose eps wisely
-        double eps=0.00001;
-        Eigen::VectorXd Svec = WJsvd.singularValues();
-        for (int i = 0; i < WJsvd.singularValues().rows(); i++) {
-            if (Svec(i) > eps) Sinv_(i,i) = 1.0/Svec(i);
-            else Sinv_(i,i) = 0;
         }
-        /*
-        ROS_INFO("Sigma inverse computed");
+    }
+
+    levels_[level] = &ws;
+    ranks_[level] = rank;
+
+}
 
-        ROS_INFO("Dimensions of A:  %i, %i", A_.rows(), A_.cols());
-        ROS_INFO("Dimensions of Jt: %i, %i", J.cols(), J.rows());
-        ROS_INFO("Dimensions of V:  %i, %i", WJsvd.matrixV().rows(), WJsvd.matrixV().cols());
-        ROS_INFO("Dimensions of Si: %i, %i", Sinv_.rows(), Sinv_.cols());
-        ROS_INFO("Dimensions of Ut: %i, %i", WJsvd.matrixU().cols(), WJsvd.matrixV().rows());
-        */
+double ComputeNullspace::getRowScale(const Eigen::MatrixXd& J, unsigned int num_rows) {
 
-        // Jpinv = A*J^T * (J*A*J^T)^(-1)
-        Eigen::MatrixXd Jpinv = A_ * J.transpose() * WJsvd.matrixV() * Sinv_ * WJsvd.matrixU().transpose();
+    double scale = 0.0;
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        if (identity_weight_) {
+            scale = std::max(scale, J.row(i).squaredNorm());
+        } else {
+            w_.noalias() = A_ * J.row(i).transpose();
+            scale = std::max(scale, J.row(i).dot(w_));
+        }
+    }
+    return scale;
+
+}
 
-        ///ROS_INFO("Jpinv computed");
+/** Root of a row in the union-find of the rows, halves the paths on the way */
+static int findRoot(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
 
-        N = I_ - J.transpose() * Jpinv.transpose();
+unsigned int ComputeNullspace::decomposeBlocks(Workspace& ws, double threshold) {
 
-        ///ROS_INFO("N computed");
+    unsigned int num_joints = ws.JrT.rows();
+    unsigned int num_rows = ws.JrT.cols();
 
+    /// Rows that have a nonzero in the same column belong to the same block
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        ws.parent[i] = i;
+    }
+    std::fill(ws.col_owner.begin(), ws.col_owner.end(), -1);
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        for (unsigned int c = 0; c < num_joints; ++c) {
+            if (ws.JrT(c, i) != 0.0) {
+                if (ws.col_owner[c] < 0) {
+                    ws.col_owner[c] = i;
+                } else {
+                    int a = findRoot(ws.parent, ws.col_owner[c]);
+                    int b = findRoot(ws.parent, i);
+                    if (a != b) ws.parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+    }
+
+    /// Number the blocks in the order of their first row, the root of a block is its first row
+    unsigned int num_blocks = 0;
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        ws.parent[i] = findRoot(ws.parent, i);
+        if (ws.parent[i] == (int)i) ws.block_index[i] = num_blocks++;
+    }
+    for (unsigned int c = 0; c < num_joints; ++c) {
+        if (ws.col_owner[c] >= 0) ws.col_owner[c] = ws.block_index[ws.parent[ws.col_owner[c]]];
+    }
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        ws.parent[i] = ws.block_index[ws.parent[i]];
+    }
+
+    /// Sort the rows and the used columns by block (counting sort), block_index becomes the insertion position
+    std::fill(ws.row_begin.begin(), ws.row_begin.begin() + num_blocks + 1, 0);
+    std::fill(ws.col_begin.begin(), ws.col_begin.begin() + num_blocks + 1, 0);
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        ++ws.row_begin[ws.parent[i] + 1];
+    }
+    for (unsigned int c = 0; c < num_joints; ++c) {
+        if (ws.col_owner[c] >= 0) ++ws.col_begin[ws.col_owner[c] + 1];
+    }
+    for (unsigned int b = 0; b < num_blocks; ++b) {
+        ws.row_begin[b + 1] += ws.row_begin[b];
+        ws.col_begin[b + 1] += ws.col_begin[b];
+    }
+    for (unsigned int b = 0; b < num_blocks; ++b) {
+        ws.block_index[b] = ws.row_begin[b];
+    }
+    for (unsigned int i = 0; i < num_rows; ++i) {
+        ws.block_rows[ws.block_index[ws.parent[i]]++] = i;
+    }
+    for (unsigned int b = 0; b < num_blocks; ++b) {
+        ws.block_index[b] = ws.col_begin[b];
+    }
+    for (unsigned int c = 0; c < num_joints; ++c) {
+        if (ws.col_owner[c] >= 0) ws.block_cols[ws.block_index[ws.col_owner[c]]++] = c;
+    }
+    ws.num_blocks = num_blocks;
+
+    /// Decompose every block: Wb = Jb*Jb^T, Gb = Wb^(-1) * Jb, zero pivots are not inverted
+    unsigned int rank = 0;
+    for (unsigned int b = 0; b < num_blocks; ++b) {
+        unsigned int r0 = ws.row_begin[b], nr = ws.row_begin[b+1] - r0;
+        unsigned int c0 = ws.col_begin[b], nc = ws.col_begin[b+1] - c0;
+        // Rows without nonzeros do not restrict anything
+        if (nc == 0) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < nr; ++i) {
+            for (unsigned int c = 0; c < nc; ++c) {
+                ws.B(c0 + c, r0 + i) = ws.JrT(ws.block_cols[c0 + c], ws.block_rows[r0 + i]);
+            }
+        }
+        Eigen::Block<Eigen::MatrixXd> Jb = ws.B.block(c0, r0, nc, nr);
+        Eigen::Block<Eigen::MatrixXd> Gb = ws.G.block(r0, c0, nr, nc);
+
+        if (block_solvers_.size() <= nr) {
+            block_solvers_.resize(nr + 1);
+        }
+        BlockSolver& solver = block_solvers_[nr];
+        if (solver.W.rows() != (int)nr) {
+            solver.W.resize(nr, nr);
+            solver.ldlt.resize(nr);
+        }
+
+        solver.W.noalias() = Jb.transpose() * Jb;
+        rank += solver.ldlt.compute(solver.W, threshold);
+        Gb = Jb.transpose();
+        solver.ldlt.solveInPlace(Gb);
+    }
+
+    return rank;
+
+}
+
+template<typename In, typename Out>
+void ComputeNullspace::subtractLevelComponent(unsigned int level, const Eigen::MatrixBase<In>& x, const Eigen::MatrixBase<Out>& v_) {
+
+    // Writable view on the output, see "Writing Functions Taking Eigen Types as Parameters"
+    Eigen::MatrixBase<Out>& v = const_cast<Eigen::MatrixBase<Out>&>(v_);
+    unsigned int rank = ranks_[level];
+    if (rank == 0) {
+        return;
+    }
+
+    Workspace& ws = *levels_[level];
+
+    if (decomposition_ == COLPIV_QR) {
+        // C*x = Q1*Q1^T*x: transform, keep the first rank coefficients and transform back
+        w_ = x;
+        w_.applyOnTheLeft(ws.JrTqr.householderQ().setLength(rank).adjoint());
+        w_.tail(w_.rows() - rank).setZero();
+        w_.applyOnTheLeft(ws.JrTqr.householderQ().setLength(rank));
+        v -= w_;
+    } else if (ws.num_blocks > 0) {
+        // C*x = sum_b Jb^T * Gb*xb, with xb the entries of x in the columns of block b
+        for (unsigned int b = 0; b < ws.num_blocks; ++b) {
+            unsigned int r0 = ws.row_begin[b], nr = ws.row_begin[b+1] - r0;
+            unsigned int c0 = ws.col_begin[b], nc = ws.col_begin[b+1] - c0;
+            if (nc == 0) {
+                continue;
+            }
+            for (unsigned int c = 0; c < nc; ++c) {
+                gathered_(c) = x.coeff(ws.block_cols[c0 + c]);
+            }
+            ws.y.segment(r0, nr).noalias() = ws.G.block(r0, c0, nr, nc) * gathered_.head(nc);
+            w_.head(nc).noalias() = ws.B.block(c0, r0, nc, nr) * ws.y.segment(r0, nr);
+            for (unsigned int c = 0; c < nc; ++c) {
+                v.coeffRef(ws.block_cols[c0 + c]) -= w_(c);
+            }
+        }
+    } else {
+        // C*x = Jr^T * G*x
+        ws.y.noalias() = ws.G * x;
+        v.noalias() -= ws.JrT * ws.y;
     }
 
 }
@@ -0,0 +1,187 @@
+#include "DistanceCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+DistanceCache::DistanceCache() : world_slots_(0), world_(NULL), world_version_(0), world_generation_(0), num_skipped_(0), num_computed_(0) {
+
+}
+
+DistanceCache::~DistanceCache() {
+
+}
+
+void DistanceCache::initialize(const std::vector<double>& radii, unsigned int world_slots) {
+
+    unsigned int num_bodies = radii.size();
+    bodies_.resize(num_bodies);
+    for (unsigned int i = 0; i < num_bodies; ++i) {
+        bodies_[i].radius = radii[i];
+        bodies_[i].has_pose = false;
+        bodies_[i].odometer = 0.0;
+        bodies_[i].relative_odometer = 0.0;
+    }
+
+    Entry empty;
+    empty.distance = -std::numeric_limits<double>::infinity();
+    empty.odometer = 0.0;
+    self_pairs_.assign(num_bodies * num_bodies, empty);
+
+    world_slots_ = 1;
+    while (world_slots_ < world_slots) {
+        world_slots_ *= 2;
+    }
+    WorldEntry empty_world;
+    empty_world.object = NULL;
+    empty_world.generation = 0;
+    empty_world.entry = empty;
+    world_pairs_.assign(num_bodies * world_slots_, empty_world);
+    world_ = NULL;
+    world_version_ = 0;
+    world_generation_ = 1;
+    num_skipped_ = 0;
+    num_computed_ = 0;
+
+}
+
+void DistanceCache::updatePose(unsigned int body, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& position,
+                               const Eigen::Matrix3d& root_rotation, const Eigen::Vector3d& root_position) {
+
+    Body& b = bodies_[body];
+
+    /// Pose relative to the root of the robot
+    Eigen::Matrix3d relative_rotation;
+    Eigen::Vector3d relative_position;
+    relative_rotation.noalias() = root_rotation.transpose() * rotation;
+    relative_position.noalias() = root_rotation.transpose() * (position - root_position);
+
+    if (b.has_pose) {
+        b.odometer += getDisplacement(b.rotation, b.position, rotation, position, b.radius);
+        b.relative_odometer += getDisplacement(b.relative_rotation, b.relative_position, relative_rotation, relative_position, b.radius);
+    }
+
+    b.rotation = rotation;
+    b.position = position;
+    b.relative_rotation = relative_rotation;
+    b.relative_position = relative_position;
+    b.has_pose = true;
+
+}
+
+void DistanceCache::setWorld(const void* world, unsigned long version) {
+
+    if (world == world_ && version == world_version_) {
+        return;
+    }
+
+    /// Entries of older generations are empty, no need to touch them
+    ++world_generation_;
+    world_ = world;
+    world_version_ = version;
+
+}
+
+bool DistanceCache::isSelfPairBeyond(unsigned int a, unsigned int b, double min_distance) {
+
+    if (a > b) {
+        std::swap(a, b);
+    }
+    const Entry& entry = self_pairs_[a * bodies_.size() + b];
+    double approach = bodies_[a].relative_odometer + bodies_[b].relative_odometer - entry.odometer;
+
+    if (entry.distance - approach > min_distance) {
+        __sync_fetch_and_add(&num_skipped_, 1);
+        return true;
+    }
+    return false;
+
+}
+
+void DistanceCache::setSelfPair(unsigned int a, unsigned int b, double distance) {
+
+    if (a > b) {
+        std::swap(a, b);
+    }
+    Entry& entry = self_pairs_[a * bodies_.size() + b];
+    entry.distance = distance;
+    entry.odometer = bodies_[a].relative_odometer + bodies_[b].relative_odometer;
+    __sync_fetch_and_add(&num_computed_, 1);
+
+}
+
+bool DistanceCache::isWorldPairBeyond(unsigned int body, const void* object, double min_distance) {
+
+    if (world_version_ == 0) {
+        return false;
+    }
+
+    const WorldEntry* slot = findWorldPair(body, object, false);
+    if (!slot) {
+        return false;
+    }
+
+    if (slot->entry.distance - (bodies_[body].odometer - slot->entry.odometer) > min_distance) {
+        __sync_fetch_and_add(&num_skipped_, 1);
+        return true;
+    }
+    return false;
+
+}
+
+void DistanceCache::setWorldPair(unsigned int body, const void* object, double distance) {
+
+    __sync_fetch_and_add(&num_computed_, 1);
+    if (world_version_ == 0) {
+        return;
+    }
+
+    WorldEntry* slot = findWorldPair(body, object, true);
+    slot->object = object;
+    slot->generation = world_generation_;
+    slot->entry.distance = distance;
+    slot->entry.odometer = bodies_[body].odometer;
+
+}
+
+void DistanceCache::getStatistics(unsigned int& num_skipped, unsigned int& num_computed) {
+
+    num_skipped = num_skipped_;
+    num_computed = num_computed_;
+    num_skipped_ = 0;
+    num_computed_ = 0;
+
+}
+
+DistanceCache::WorldEntry* DistanceCache::findWorldPair(unsigned int body, const void* object, bool insert) {
+
+    /// Linear probing from the hash of the address, objects are at least 16 byte aligned
+    static const std::size_t max_probes = 8;
+    std::size_t key = reinterpret_cast<std::size_t>(object) >> 4;
+    std::size_t hash = key ^ (key >> 7) ^ (key >> 15);
+    WorldEntry* slots = &world_pairs_[body * world_slots_];
+
+    for (std::size_t i = 0; i < max_probes && i < world_slots_; ++i) {
+        WorldEntry& slot = slots[(hash + i) & (world_slots_ - 1)];
+        if (slot.generation != world_generation_) {
+            /// Pairs are never removed within a generation, hence the object is not stored further on
+            return insert ? &slot : NULL;
+        }
+        if (slot.object == object) {
+            return &slot;
+        }
+    }
+
+    return insert ? &slots[hash & (world_slots_ - 1)] : NULL;
+
+}
+
+double DistanceCache::getDisplacement(const Eigen::Matrix3d& rotation_old, const Eigen::Vector3d& position_old,
+                                      const Eigen::Matrix3d& rotation_new, const Eigen::Vector3d& position_new, double radius) {
+
+    /// A point p within radius moves (R_new - R_old) * p + (t_new - t_old). The spectral norm of R_new - R_old
+    /// is 2 * sin(theta/2) = sqrt(3 - trace(R_new^T * R_old)), with theta the angle of the relative rotation
+    double trace = rotation_new.cwiseProduct(rotation_old).sum();
+    return (position_new - position_old).norm() + radius * std::sqrt(std::max(0.0, 3.0 - trace));
+
+}
@@ -0,0 +1,491 @@
+#include "EnvironmentDistanceField.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+
+#include <ros/console.h>
+
+namespace {
+
+/** Squared distance of cells that have no feature in the region, larger than any squared distance in a window */
+const double FAR = 1e10;
+
+/** Adds a ring (or the center point if the radius is 0) in the plane z = height of a shape to points */
+void addRing(const ConvexShape& shape, double radius, double height, double spacing, std::vector<Eigen::Vector3d>& points)
+{
+    unsigned int num_points = 1;
+    if (radius > 0.0) {
+        num_points = std::max(4, (int)std::ceil(2.0 * M_PI * radius / spacing));
+    }
+    for (unsigned int i = 0; i < num_points; ++i) {
+        double angle = 2.0 * M_PI * i / num_points;
+        Eigen::Vector3d local(radius * std::cos(angle), radius * std::sin(angle), height);
+        points.push_back(shape.rotation * local + shape.position);
+    }
+}
+
+/** Adds a filled disc in the plane z = height of a shape to points */
+void addDisc(const ConvexShape& shape, double radius, double height, double spacing, std::vector<Eigen::Vector3d>& points)
+{
+    int num_rings = std::max(1, (int)std::ceil(radius / spacing));
+    for (int i = 0; i <= num_rings; ++i) {
+        addRing(shape, radius * i / num_rings, height, spacing, points);
+    }
+}
+
+/** Number of intervals of at most spacing on a length */
+int getNrIntervals(double length, double spacing)
+{
+    return std::max(1, (int)std::ceil(length / spacing));
+}
+
+}
+
+double EnvironmentDistanceField::Grid::getDistance(const Eigen::Vector3d& point, Eigen::Vector3d& gradient) const
+{
+    /// Cell of which the center is the lower corner of the interpolation cube
+    Eigen::Vector3d u = (point - origin) / resolution;
+    int c[3];
+    double f[3];
+    for (unsigned int i = 0; i < 3; ++i) {
+        double lower = std::floor(u(i));
+        c[i] = (int)lower;
+        f[i] = u(i) - lower;
+        if (c[i] < 0 || c[i] + 1 >= size[i]) {
+            gradient.setZero();
+            return max_distance;
+        }
+    }
+
+    int i000 = getIndex(c[0], c[1], c[2]);
+    int dx = 1, dy = size[0], dz = size[0] * size[1];
+    double d000 = distance[i000],           d100 = distance[i000 + dx];
+    double d010 = distance[i000 + dy],      d110 = distance[i000 + dx + dy];
+    double d001 = distance[i000 + dz],      d101 = distance[i000 + dx + dz];
+    double d011 = distance[i000 + dy + dz], d111 = distance[i000 + dx + dy + dz];
+
+    /// Interpolate along x, then y, then z
+    double d00 = d000 + f[0] * (d100 - d000), d10 = d010 + f[0] * (d110 - d010);
+    double d01 = d001 + f[0] * (d101 - d001), d11 = d011 + f[0] * (d111 - d011);
+    double d0 = d00 + f[1] * (d10 - d00), d1 = d01 + f[1] * (d11 - d01);
+
+    double gx00 = d100 - d000, gx10 = d110 - d010, gx01 = d101 - d001, gx11 = d111 - d011;
+    double gx0 = gx00 + f[1] * (gx10 - gx00), gx1 = gx01 + f[1] * (gx11 - gx01);
+    gradient(0) = (gx0 + f[2] * (gx1 - gx0)) / resolution;
+    gradient(1) = ((d10 - d00) + f[2] * ((d11 - d01) - (d10 - d00))) / resolution;
+    gradient(2) = (d1 - d0) / resolution;
+
+    return d0 + f[2] * (d1 - d0);
+}
+
+EnvironmentDistanceField::EnvironmentDistanceField() : resolution_(0.0), max_distance_(0.0),
+    robot_position_(Eigen::Vector3d::Zero()), recenter_(false), stopping_(false), version_(0) {
+
+}
+
+EnvironmentDistanceField::~EnvironmentDistanceField() {
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_.notify_one();
+    thread_.join();
+
+}
+
+void EnvironmentDistanceField::initialize(double resolution, const Eigen::Vector3d& size, double max_distance) {
+
+    if (thread_.joinable()) {
+        ROS_WARN("Environment distance field has already been initialized");
+        return;
+    }
+
+    resolution_ = resolution;
+    size_ = size;
+    max_distance_ = max_distance;
+    thread_ = boost::thread(boost::bind(&EnvironmentDistanceField::work, this));
+
+}
+
+void EnvironmentDistanceField::setOctoMap(const boost::shared_ptr<const OctreeType>& tree) {
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        pending_tree_ = tree;
+    }
+    work_.notify_one();
+
+}
+
+void EnvironmentDistanceField::setRobotPosition(const Eigen::Vector3d& position) {
+
+    bool notify = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        robot_position_ = position;
+        if (grid_ && !recenter_ && !isCentered(grid_->origin, position)) {
+            recenter_ = true;
+            notify = true;
+        }
+    }
+    if (notify) {
+        work_.notify_one();
+    }
+
+}
+
+boost::shared_ptr<const EnvironmentDistanceField::Grid> EnvironmentDistanceField::getGrid() const {
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return grid_;
+
+}
+
+double EnvironmentDistanceField::sampleShape(const ConvexShape& shape, double spacing, std::vector<Eigen::Vector3d>& points) {
+
+    points.clear();
+    const Eigen::Vector3d& dim = shape.dimensions;
+
+    switch (shape.type) {
+    case ConvexShape::SPHERE:
+        points.push_back(shape.position);
+        return dim.x();
+
+    case ConvexShape::CAPSULE:
+    {
+        int n = getNrIntervals(2.0 * dim.z(), spacing);
+        for (int i = 0; i <= n; ++i) {
+            Eigen::Vector3d local(0.0, 0.0, -dim.z() + 2.0 * dim.z() * i / n);
+            points.push_back(shape.rotation * local + shape.position);
+        }
+        return dim.x();
+    }
+
+    case ConvexShape::BOX:
+    {
+        /// Lattice points on the faces
+        int n[3];
+        for (unsigned int i = 0; i < 3; ++i) {
+            n[i] = getNrIntervals(2.0 * dim(i), spacing);
+        }
+        for (int x = 0; x <= n[0]; ++x) {
+            for (int y = 0; y <= n[1]; ++y) {
+                for (int z = 0; z <= n[2]; ++z) {
+                    if (x != 0 && x != n[0] && y != 0 && y != n[1] && z != 0 && z != n[2]) {
+                        continue;
+                    }
+                    Eigen::Vector3d local(-dim.x() + 2.0 * dim.x() * x / n[0],
+                                          -dim.y() + 2.0 * dim.y() * y / n[1],
+                                          -dim.z() + 2.0 * dim.z() * z / n[2]);
+                    points.push_back(shape.rotation * local + shape.position);
+                }
+            }
+        }
+        return 0.0;
+    }
+
+    case ConvexShape::CYLINDER:
+    {
+        int n = getNrIntervals(2.0 * dim.z(), spacing);
+        for (int i = 1; i < n; ++i) {
+            addRing(shape, dim.x(), -dim.z() + 2.0 * dim.z() * i / n, spacing, points);
+        }
+        addDisc(shape, dim.x(), -dim.z(), spacing, points);
+        addDisc(shape, dim.x(), dim.z(), spacing, points);
+        return 0.0;
+    }
+
+    case ConvexShape::CONE:
+    {
+        /// Shrinking rings from the base up to the apex
+        int n = getNrIntervals(std::sqrt(4.0 * dim.z() * dim.z() + dim.x() * dim.x()), spacing);
+        for (int i = 1; i <= n; ++i) {
+            addRing(shape, dim.x() * (n - i) / n, -dim.z() + 2.0 * dim.z() * i / n, spacing, points);
+        }
+        addDisc(shape, dim.x(), -dim.z(), spacing, points);
+        return 0.0;
+    }
+    }
+
+    return 0.0;
+
+}
+
+void EnvironmentDistanceField::work() {
+
+    boost::shared_ptr<const OctreeType> tree;
+    while (true) {
+        boost::shared_ptr<Grid> previous;
+        Eigen::Vector3d position;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (!stopping_ && !pending_tree_ && !(recenter_ && tree)) {
+                work_.wait(lock);
+            }
+            if (stopping_) {
+                return;
+            }
+            if (pending_tree_) {
+                tree = pending_tree_;
+                pending_tree_.reset();
+            }
+            recenter_ = false;
+            position = robot_position_;
+            previous = grid_;
+        }
+
+        /// Keep the window unless the robot left its center
+        Eigen::Vector3d origin = getOrigin(position);
+        if (previous && isCentered(previous->origin, position)) {
+            origin = previous->origin;
+        }
+
+        /// Reuse the grid before the previous one if the control loop released it
+        boost::shared_ptr<Grid> grid = spare_;
+        if (!grid || !grid.unique()) {
+            grid.reset(new Grid);
+        }
+        spare_.reset();
+
+        build(*tree, origin, previous.get(), *grid);
+        grid->version = ++version_;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            grid_ = grid;
+        }
+        spare_ = previous;
+    }
+
+}
+
+void EnvironmentDistanceField::build(const OctreeType& tree, const Eigen::Vector3d& origin, const Grid* previous, Grid& grid) {
+
+    grid.resolution = resolution_;
+    grid.origin = origin;
+    grid.max_distance = max_distance_;
+    for (unsigned int i = 0; i < 3; ++i) {
+        grid.size[i] = getNrIntervals(size_(i), resolution_);
+    }
+    unsigned int num_cells = grid.size[0] * grid.size[1] * grid.size[2];
+    grid.distance.resize(num_cells);
+
+    rasterize(tree, grid);
+
+    int lo[3] = {0, 0, 0};
+    int hi[3] = {grid.size[0], grid.size[1], grid.size[2]};
+
+    if (previous && previous->origin == grid.origin && previous->distance.size() == num_cells &&
+            previous->resolution == grid.resolution && previous->max_distance == grid.max_distance) {
+
+        /// Bounding box of the cells of which the occupancy changed
+        int changed_lo[3] = {grid.size[0], grid.size[1], grid.size[2]};
+        int changed_hi[3] = {0, 0, 0};
+        for (int z = 0; z < grid.size[2]; ++z) {
+            for (int y = 0; y < grid.size[1]; ++y) {
+                int index = grid.getIndex(0, y, z);
+                for (int x = 0; x < grid.size[0]; ++x, ++index) {
+                    if (grid.occupied[index] != previous->occupied[index]) {
+                        changed_lo[0] = std::min(changed_lo[0], x); changed_hi[0] = std::max(changed_hi[0], x + 1);
+                        changed_lo[1] = std::min(changed_lo[1], y); changed_hi[1] = std::max(changed_hi[1], y + 1);
+                        changed_lo[2] = std::min(changed_lo[2], z); changed_hi[2] = std::max(changed_hi[2], z + 1);
+                    }
+                }
+            }
+        }
+
+        std::copy(previous->distance.begin(), previous->distance.end(), grid.distance.begin());
+        if (changed_lo[0] >= changed_hi[0]) {
+            return;
+        }
+
+        /// Distances change within max_distance of the changed cells only
+        int r = getRadius();
+        for (unsigned int i = 0; i < 3; ++i) {
+            lo[i] = std::max(0, changed_lo[i] - r);
+            hi[i] = std::min(grid.size[i], changed_hi[i] + r);
+        }
+        ROS_DEBUG("Environment distance field: updating %d x %d x %d of %d x %d x %d cells",
+                  hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], grid.size[0], grid.size[1], grid.size[2]);
+    }
+
+    computeDistances(lo, hi, grid);
+
+}
+
+void EnvironmentDistanceField::rasterize(const OctreeType& tree, Grid& grid) const {
+
+    grid.occupied.assign(grid.size[0] * grid.size[1] * grid.size[2], 0);
+
+    double res = grid.resolution;
+    Eigen::Vector3d min = grid.origin - Eigen::Vector3d::Constant(res / 2.0);
+    Eigen::Vector3d max = min + res * Eigen::Vector3d(grid.size[0], grid.size[1], grid.size[2]);
+    octomap::point3d bbx_min(min.x(), min.y(), min.z());
+    octomap::point3d bbx_max(max.x(), max.y(), max.z());
+
+    for (OctreeType::leaf_bbx_iterator it = tree.begin_leafs_bbx(bbx_min, bbx_max), end = tree.end_leafs_bbx(); it != end; ++it) {
+        if (!tree.isNodeOccupied(*it)) {
+            continue;
+        }
+
+        /// Cells of which the center lies within the leaf, or the cell of the center of a leaf that is smaller than a cell
+        octomap::point3d center = it.getCoordinate();
+        double half_size = it.getSize() / 2.0;
+        int lo[3], hi[3];
+        for (unsigned int i = 0; i < 3; ++i) {
+            double c = (center(i) - grid.origin(i)) / res;
+            lo[i] = (int)std::ceil(c - half_size / res - 1e-6);
+            hi[i] = (int)std::ceil(c + half_size / res - 1e-6);
+            if (hi[i] <= lo[i]) {
+                lo[i] = (int)std::floor(c + 0.5);
+                hi[i] = lo[i] + 1;
+            }
+            lo[i] = std::max(lo[i], 0);
+            hi[i] = std::min(hi[i], grid.size[i]);
+        }
+
+        for (int z = lo[2]; z < hi[2]; ++z) {
+            for (int y = lo[1]; y < hi[1]; ++y) {
+                for (int x = lo[0]; x < hi[0]; ++x) {
+                    grid.occupied[grid.getIndex(x, y, z)] = 1;
+                }
+            }
+        }
+    }
+
+}
+
+void EnvironmentDistanceField::computeDistances(const int* lo, const int* hi, Grid& grid) const {
+
+    /// Region of which the occupancy is used: cells further than max_distance away are clamped anyway
+    int r = getRadius();
+    int p_lo[3], n[3];
+    for (unsigned int i = 0; i < 3; ++i) {
+        p_lo[i] = std::max(0, lo[i] - r);
+        n[i] = std::min(grid.size[i], hi[i] + r) - p_lo[i];
+    }
+    int num_cells = n[0] * n[1] * n[2];
+    int max_n = std::max(n[0], std::max(n[1], n[2]));
+
+    std::vector<double> to_occupied(num_cells), to_free(num_cells);
+    std::vector<double> f(max_n), d(max_n), z(max_n + 1);
+    std::vector<int> v(max_n);
+
+    /// Squared distance (in cells) to the nearest occupied and the nearest free cell, separably along x, y and z
+    for (unsigned int target = 0; target < 2; ++target) {
+        std::vector<double>& sq = (target == 0) ? to_occupied : to_free;
+        unsigned char feature = (target == 0) ? 1 : 0;
+
+        for (int k = 0; k < n[2]; ++k) {
+            for (int j = 0; j < n[1]; ++j) {
+                int index = grid.getIndex(p_lo[0], p_lo[1] + j, p_lo[2] + k);
+                for (int i = 0; i < n[0]; ++i) {
+                    f[i] = (grid.occupied[index + i] == feature) ? 0.0 : FAR;
+                }
+                distanceTransform(&f[0], n[0], &d[0], &v[0], &z[0]);
+                std::copy(d.begin(), d.begin() + n[0], sq.begin() + n[0] * (j + n[1] * k));
+            }
+        }
+
+        for (int k = 0; k < n[2]; ++k) {
+            for (int i = 0; i < n[0]; ++i) {
+                for (int j = 0; j < n[1]; ++j) {
+                    f[j] = sq[i + n[0] * (j + n[1] * k)];
+                }
+                distanceTransform(&f[0], n[1], &d[0], &v[0], &z[0]);
+                for (int j = 0; j < n[1]; ++j) {
+                    sq[i + n[0] * (j + n[1] * k)] = d[j];
+                }
+            }
+        }
+
+        for (int j = 0; j < n[1]; ++j) {
+            for (int i = 0; i < n[0]; ++i) {
+                for (int k = 0; k < n[2]; ++k) {
+                    f[k] = sq[i + n[0] * (j + n[1] * k)];
+                }
+                distanceTransform(&f[0], n[2], &d[0], &v[0], &z[0]);
+                for (int k = 0; k < n[2]; ++k) {
+                    sq[i + n[0] * (j + n[1] * k)] = d[k];
+                }
+            }
+        }
+    }
+
+    /// Signed distance of the cells in [lo, hi), from the cell center to the face of the nearest cell of the other kind
+    double res = grid.resolution;
+    for (int z = lo[2]; z < hi[2]; ++z) {
+        for (int y = lo[1]; y < hi[1]; ++y) {
+            for (int x = lo[0]; x < hi[0]; ++x) {
+                int index = grid.getIndex(x, y, z);
+                int local = (x - p_lo[0]) + n[0] * ((y - p_lo[1]) + n[1] * (z - p_lo[2]));
+                double distance;
+                if (grid.occupied[index]) {
+                    distance = -std::min(std::sqrt(to_free[local]) * res - res / 2.0, max_distance_);
+                } else {
+                    distance = std::min(std::sqrt(to_occupied[local]) * res - res / 2.0, max_distance_);
+                }
+                grid.distance[index] = (float)distance;
+            }
+        }
+    }
+
+}
+
+Eigen::Vector3d EnvironmentDistanceField::getOrigin(const Eigen::Vector3d& position) const {
+
+    /// Centered in x and y, starting at the base in z, with the cell centers on the octomap voxel centers
+    Eigen::Vector3d corner(position.x() - size_.x() / 2.0, position.y() - size_.y() / 2.0, position.z());
+    Eigen::Vector3d origin;
+    for (unsigned int i = 0; i < 3; ++i) {
+        origin(i) = (std::floor(corner(i) / resolution_) + 0.5) * resolution_;
+    }
+    return origin;
+
+}
+
+bool EnvironmentDistanceField::isCentered(const Eigen::Vector3d& origin, const Eigen::Vector3d& position) const {
+
+    Eigen::Vector3d offset = (getOrigin(position) - origin).cwiseAbs();
+    return offset.x() <= size_.x() / 4.0 && offset.y() <= size_.y() / 4.0 && offset.z() <= size_.z() / 4.0;
+
+}
+
+int EnvironmentDistanceField::getRadius() const {
+
+    /// A cell further than r cells from any occupied cell has a distance of at least (r - 1/2) * resolution > max_distance
+    return (int)std::ceil(max_distance_ / resolution_ + 0.5) + 1;
+
+}
+
+void EnvironmentDistanceField::distanceTransform(const double* f, int n, double* d, int* v, double* z) {
+
+    /// Lower envelope of the parabolas (q - x)^2 + f(q), Felzenszwalb and Huttenlocher (2012)
+    int k = 0;
+    v[0] = 0;
+    z[0] = -FAR;
+    z[1] = FAR;
+    for (int q = 1; q < n; ++q) {
+        double s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * (q - v[k]));
+        while (s <= z[k]) {
+            --k;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * (q - v[k]));
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = FAR;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) {
+            ++k;
+        }
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+
+}
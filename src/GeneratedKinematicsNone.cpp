@@ -0,0 +1,7 @@
+#include "GeneratedKinematics.h"
+
+/// Used if no robot model has been given at build time: Tree falls back to KDL
+GeneratedKinematics* createGeneratedKinematics()
+{
+    return 0;
+}
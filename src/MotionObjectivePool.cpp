@@ -0,0 +1,45 @@
+#include "MotionObjectivePool.h"
+
+#include <boost/bind.hpp>
+
+#include <ros/console.h>
+
+MotionObjectivePool::MotionObjectivePool() : motionobjectives_(0), robot_state_(0) {
+    apply_task_ = boost::bind(&MotionObjectivePool::applyMotionObjective, this, _1);
+}
+
+MotionObjectivePool::~MotionObjectivePool() {
+
+}
+
+void MotionObjectivePool::initialize(unsigned int num_threads) {
+
+    if (pool_.getNrThreads() > 0) {
+        ROS_WARN("Motion objective pool has already been initialized with %u worker threads", pool_.getNrThreads());
+        return;
+    }
+
+    pool_.initialize(num_threads);
+
+    if (num_threads > 0) {
+        ROS_INFO("Applying motion objectives with %u worker threads", num_threads);
+    }
+
+}
+
+unsigned int MotionObjectivePool::getNrThreads() const {
+    return pool_.getNrThreads();
+}
+
+void MotionObjectivePool::apply(const std::vector<MotionObjective*>& motionobjectives, RobotState& robotstate) {
+
+    /// The workers only read these while run() is busy
+    motionobjectives_ = &motionobjectives;
+    robot_state_ = &robotstate;
+    pool_.run(motionobjectives.size(), apply_task_);
+
+}
+
+void MotionObjectivePool::applyMotionObjective(unsigned int i) {
+    (*motionobjectives_)[i]->apply(*robot_state_);
+}
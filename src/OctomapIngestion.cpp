@@ -0,0 +1,114 @@
+#include "OctomapIngestion.h"
+
+#include <boost/bind.hpp>
+
+#include <octomap_msgs/conversions.h>
+#include <ros/console.h>
+#include <ros/time.h>
+
+OctomapIngestion::OctomapIngestion() : num_published_(0), num_taken_(0), stopping_(false) {
+
+    thread_ = boost::thread(boost::bind(&OctomapIngestion::work, this));
+
+}
+
+OctomapIngestion::~OctomapIngestion() {
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_.notify_one();
+    thread_.join();
+
+}
+
+void OctomapIngestion::setMessage(const octomap_msgs::Octomap::ConstPtr& msg) {
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (pending_) {
+            ROS_DEBUG("Octomap ingestion: dropping an octomap that has not been converted yet");
+        }
+        pending_ = msg;
+    }
+    work_.notify_one();
+
+}
+
+bool OctomapIngestion::getOctoMap(boost::shared_ptr<OctreeType>& tree) {
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (num_taken_ == num_published_) {
+        return false;
+    }
+    tree = published_;
+    num_taken_ = num_published_;
+    return true;
+
+}
+
+void OctomapIngestion::work() {
+
+    while (true) {
+        octomap_msgs::Octomap::ConstPtr msg;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            /// Wake up once in a while to release the retired trees
+            if (!stopping_ && !pending_) {
+                work_.timed_wait(lock, boost::posix_time::seconds(1));
+            }
+            if (stopping_) {
+                return;
+            }
+            msg.swap(pending_);
+        }
+
+        releaseRetired();
+        if (!msg) {
+            continue;
+        }
+
+        ros::WallTime start = ros::WallTime::now();
+
+        /// Deserialize
+        octomap::AbstractOcTree* abstract_tree = octomap_msgs::msgToMap(*msg);
+        msg.reset();
+        if (!abstract_tree) {
+            ROS_ERROR("Octomap conversion error");
+            continue;
+        }
+        OctreeType* tree = dynamic_cast<OctreeType*>(abstract_tree);
+        if (!tree) {
+            ROS_ERROR("No Octomap created: expected an OcTreeStamped, received a %s", abstract_tree->getTreeType().c_str());
+            delete abstract_tree;
+            continue;
+        }
+
+        /// Publish
+        boost::shared_ptr<OctreeType> snapshot(tree);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            snapshot.swap(published_);
+            ++num_published_;
+        }
+        if (snapshot) {
+            retired_.push_back(snapshot);
+        }
+
+        ROS_DEBUG("Octomap ingestion: converted an octomap of %lu nodes in %.1f ms", (unsigned long)tree->size(), (ros::WallTime::now() - start).toSec() * 1000.0);
+    }
+
+}
+
+void OctomapIngestion::releaseRetired() {
+
+    for (std::vector<boost::shared_ptr<OctreeType> >::iterator it = retired_.begin(); it != retired_.end(); ) {
+        if (it->unique()) {
+            it = retired_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+}
@@ -0,0 +1,67 @@
+#include "PivotedLDLT.h"
+
+#include <algorithm>
+
+PivotedLDLT::PivotedLDLT() : rank_(0) {
+
+}
+
+void PivotedLDLT::resize(unsigned int size) {
+
+    LD_.resize(size, size);
+    transpositions_.resize(size);
+    rank_ = 0;
+
+}
+
+unsigned int PivotedLDLT::compute(const Eigen::MatrixXd& W, double threshold) {
+
+    unsigned int size = W.rows();
+    LD_.triangularView<Eigen::Lower>() = W;
+
+    rank_ = 0;
+    for (unsigned int k = 0; k < size; ++k) {
+
+        /// Pivot on the largest diagonal entry of the Schur complement, stop if it is zero
+        unsigned int p = k;
+        for (unsigned int i = k + 1; i < size; ++i) {
+            if (LD_(i, i) > LD_(p, p)) p = i;
+        }
+        if (LD_(p, p) <= threshold) {
+            break;
+        }
+
+        /// Swap rows and columns k and p of the lower triangle, including the rows of L computed so far
+        transpositions_[k] = p;
+        if (p != k) {
+            std::swap(LD_(k, k), LD_(p, p));
+            for (unsigned int j = 0; j < k; ++j) {
+                std::swap(LD_(k, j), LD_(p, j));
+            }
+            for (unsigned int i = k + 1; i < p; ++i) {
+                std::swap(LD_(i, k), LD_(p, i));
+            }
+            for (unsigned int i = p + 1; i < size; ++i) {
+                std::swap(LD_(i, k), LD_(i, p));
+            }
+        }
+
+        /// Column k of L and the Schur complement S -= l*d*l^T (lower triangle)
+        double d = LD_(k, k);
+        for (unsigned int j = k + 1; j < size; ++j) {
+            double l = LD_(j, k) / d;
+            for (unsigned int i = j; i < size; ++i) {
+                LD_(i, j) -= LD_(i, k) * l;
+            }
+            LD_(j, k) = l;
+        }
+        ++rank_;
+    }
+
+    return rank_;
+
+}
+
+unsigned int PivotedLDLT::getRank() const {
+    return rank_;
+}
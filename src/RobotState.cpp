@@ -1,36 +1,121 @@
 #include "RobotState.h"
 
-RobotState::RobotState() {
+#include <ros/console.h>
+#include <Eigen/Geometry>
+
+RobotState::RobotState() : base_link_alias_handle_(-1) {
 
 }
 
 RobotState::~RobotState() {
-    delete fk_solver_;
 }
 
-void RobotState::collectFKSolutions()
+bool RobotState::initialize()
 {
+    tree_.initializeSegments();
+
+    unsigned int number_segments = tree_.getNrSegments();
+    fk_frames_.resize(number_segments);
+    fk_updated_.assign(number_segments, true);
+
+    /// Create all keys of the compatibility map once
     fk_poses_.clear();
-    fk_poses_["base_link"] = amcl_pose_;
+    fk_poses_view_.clear();
+    for (unsigned int i = 0; i < number_segments; ++i)
+    {
+        fk_poses_view_.push_back(fk_poses_.insert(std::make_pair(tree_.getSegmentName(i), KDL::Frame::Identity())).first);
+    }
+
+    /// base_link is always available, also if it is not part of the tree
+    if (tree_.getSegmentIndex("base_link") < 0)
+    {
+        base_link_alias_handle_ = fk_frames_.size();
+        fk_frames_.push_back(KDL::Frame::Identity());
+        fk_poses_view_.push_back(fk_poses_.insert(std::make_pair(std::string("base_link"), KDL::Frame::Identity())).first);
+    }
+
+    /// Allocate the Jacobian cache, none of the Jacobians is valid yet
+    jacobians_.assign(fk_frames_.size(), Eigen::MatrixXd::Zero(6, getNrJoints()));
+    jacobian_valid_.assign(fk_frames_.size(), false);
+
+    /// Resolve the frames of the collision bodies
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator it = robot_.groups.begin(); it != robot_.groups.end(); ++it)
+    {
+        std::vector<RobotState::CollisionBody> &group = *it;
+
+        for (std::vector<RobotState::CollisionBody>::iterator it = group.begin(); it != group.end(); ++it)
+        {
+            RobotState::CollisionBody &collisionBody = *it;
+            collisionBody.frame_handle = getFrameHandle(collisionBody.frame_id);
+            if (collisionBody.frame_handle < 0)
+            {
+                ROS_ERROR("Frame '%s' of collision body '%s' is not part of the tree", collisionBody.frame_id.c_str(), collisionBody.name_collision_body.c_str());
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
 
-    /// Fill in the vector with FK poses (why do we actually need to do this? We can 'find' the respective link in the tree and compute FK right away...)
-    /// Iterate over tree
-    KDL::SegmentMap treemap = tree_.kdl_tree_.getSegments();
-    for (KDL::SegmentMap::iterator itrTree = treemap.begin(); itrTree != treemap.end(); ++itrTree)
+void RobotState::collectFKSolutions()
+{
+    /// The root of the tree is located at the amcl pose, hence all poses are in map frame
+    /// Only the subtrees of which a joint or the root moved are recomputed
+    tree_.calcFK(amcl_pose_, fk_frames_, fk_updated_);
+    if (base_link_alias_handle_ >= 0)
     {
-        /// Compute FK with respect to root frame of the tree
-        KDL::Frame fk_pose_in_root;
-        fk_solver_->JntToCart(tree_.q_tree_, fk_pose_in_root, itrTree->first);
+        fk_frames_[base_link_alias_handle_] = amcl_pose_;
+        fk_updated_[base_link_alias_handle_] = fk_updated_[0];
+    }
 
-        /// Convert to map frame
-        KDL::Frame fk_pose_in_map;
-        fk_pose_in_map = amcl_pose_ * fk_pose_in_root;
+    /// Refresh the compatibility map and invalidate the cached Jacobians of the frames that moved
+    for (unsigned int i = 0; i < fk_frames_.size(); ++i)
+    {
+        if (fk_updated_[i])
+        {
+            fk_poses_view_[i]->second = fk_frames_[i];
+            jacobian_valid_[i] = false;
+        }
+    }
+}
 
-        /// Put in map
-        fk_poses_[itrTree->first] = fk_pose_in_map;
+KDL::Frame RobotState::calcFK(int frame_handle) const
+{
+    /// base_link is located at the root of the tree
+    if (frame_handle == base_link_alias_handle_)
+    {
+        return amcl_pose_;
+    }
+    return tree_.calcSegmentFK(frame_handle, amcl_pose_);
+}
 
+const Eigen::MatrixXd& RobotState::getJacobian(int frame_handle)
+{
+    /// A cached Jacobian is not changed anymore until the next collectFKSolutions
+    boost::lock_guard<boost::mutex> lock(jacobian_mutex_);
+    if (!jacobian_valid_[frame_handle])
+    {
+        /// base_link is located at the root of the tree
+        unsigned int segment_index = (frame_handle == base_link_alias_handle_) ? 0 : frame_handle;
+        tree_.calcJacobian(segment_index, fk_frames_, jacobians_[frame_handle]);
+        jacobian_valid_[frame_handle] = true;
     }
+    return jacobians_[frame_handle];
+}
+
+void RobotState::getPointJacobian(int frame_handle, const KDL::Vector& point_in_map, Eigen::MatrixXd& jacobian)
+{
+    const Eigen::MatrixXd& frame_jacobian = getJacobian(frame_handle);
 
+    /// Change the reference point from the frame origin to the point: v_point = v_frame + omega x r
+    KDL::Vector r = point_in_map - fk_frames_[frame_handle].p;
+    Eigen::Vector3d ref_point(r.x(), r.y(), r.z());
+    for (int i = 0; i < frame_jacobian.cols(); ++i)
+    {
+        jacobian.block<3,1>(0,i) = frame_jacobian.block<3,1>(0,i) + frame_jacobian.block<3,1>(3,i).cross(ref_point);
+        jacobian.block<3,1>(3,i) = frame_jacobian.block<3,1>(3,i);
+    }
 }
 
 void RobotState::updateCollisionBodyPoses() {
@@ -42,8 +127,7 @@ void RobotState::updateCollisionBodyPoses() {
         for (std::vector<RobotState::CollisionBody>::iterator it = group.begin(); it != group.end(); ++it)
         {
             RobotState::CollisionBody &collisionBody = *it;
-            std::map<std::string, KDL::Frame>::iterator itr = fk_poses_.find(collisionBody.frame_id);
-            collisionBody.fk_pose = itr->second;
+            collisionBody.fk_pose = fk_frames_[collisionBody.frame_handle];
         }
     }
 }
@@ -82,11 +166,25 @@ int RobotState::getNrOfSegment(KDL::Chain kdl_chain_, const std::string& segment
 
 KDL::Frame RobotState::getFK(const std::string& tip_frame){
 
-    /// Get the current FK pose as a geometry msgs
-    std::map<std::string, KDL::Frame>::iterator itrFK = fk_poses_.find(tip_frame);
-    KDL::Frame end_effector_pose = itrFK->second;
+    /// Get the current FK pose
+    int frame_handle = getFrameHandle(tip_frame);
+    if (frame_handle < 0)
+    {
+        ROS_ERROR("Frame '%s' is not part of the tree", tip_frame.c_str());
+        return KDL::Frame::Identity();
+    }
+
+    return fk_frames_[frame_handle];
+}
 
-    return end_effector_pose;
+int RobotState::getFrameHandle(const std::string& frame_name) const
+{
+    int frame_handle = tree_.getSegmentIndex(frame_name);
+    if (frame_handle < 0 && frame_name == "base_link")
+    {
+        frame_handle = base_link_alias_handle_;
+    }
+    return frame_handle;
 }
 
 void RobotState::setAmclPose(KDL::Frame& amcl_pose)
@@ -0,0 +1,555 @@
+#include "ShapeDistance.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Relative tolerance of the GJK termination (squared distance) and absolute tolerance on the squared distances
+static const double GJK_RELATIVE_EPS = 1e-10;
+static const double SQUARED_EPS = 1e-20;
+
+double ShapeDistance::compute(const ConvexShape& a, const ConvexShape& b, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b) {
+
+    double margin_a = getMargin(a);
+    double margin_b = getMargin(b);
+
+    /// Closest points of the cores
+    Eigen::Vector3d core_a, core_b;
+    bool separated;
+    if (hasSegmentCore(a) && hasSegmentCore(b)) {
+        Eigen::Vector3d a0, a1, b0, b1;
+        getSegment(a, a0, a1);
+        getSegment(b, b0, b1);
+        separated = closestSegmentSegment(a0, a1, b0, b1, core_a, core_b) > SQUARED_EPS;
+    } else {
+        separated = gjk(a, b, core_a, core_b) && (core_b - core_a).squaredNorm() > SQUARED_EPS;
+    }
+
+    if (!separated) {
+        point_a = a.position;
+        point_b = b.position;
+        return -(margin_a + margin_b);
+    }
+
+    /// Subtract the margins along the line between the cores
+    double core_distance = (core_b - core_a).norm();
+    Eigen::Vector3d normal = (core_b - core_a) / core_distance;
+    double distance = core_distance - margin_a - margin_b;
+    point_a = core_a + margin_a * normal;
+    point_b = point_a + std::abs(distance) * normal;
+    return distance;
+
+}
+
+double ShapeDistance::getMargin(const ConvexShape& shape) {
+    return hasSegmentCore(shape) ? shape.dimensions.x() : 0.0;
+}
+
+bool ShapeDistance::hasSegmentCore(const ConvexShape& shape) {
+    return shape.type == ConvexShape::SPHERE || shape.type == ConvexShape::CAPSULE;
+}
+
+void ShapeDistance::getSegment(const ConvexShape& shape, Eigen::Vector3d& p0, Eigen::Vector3d& p1) {
+
+    if (shape.type == ConvexShape::CAPSULE) {
+        p0.noalias() = shape.position + shape.dimensions.z() * shape.rotation.col(2);
+        p1.noalias() = shape.position - shape.dimensions.z() * shape.rotation.col(2);
+    } else {
+        p0 = shape.position;
+        p1 = shape.position;
+    }
+
+}
+
+Eigen::Vector3d ShapeDistance::support(const ConvexShape& shape, const Eigen::Vector3d& d) {
+
+    Eigen::Vector3d dl = shape.rotation.transpose() * d;
+    const Eigen::Vector3d& dim = shape.dimensions;
+    Eigen::Vector3d local(0.0, 0.0, 0.0);
+
+    switch (shape.type) {
+    case ConvexShape::SPHERE:
+        break;
+    case ConvexShape::CAPSULE:
+        local.z() = (dl.z() >= 0.0) ? dim.z() : -dim.z();
+        break;
+    case ConvexShape::BOX:
+        local.x() = (dl.x() >= 0.0) ? dim.x() : -dim.x();
+        local.y() = (dl.y() >= 0.0) ? dim.y() : -dim.y();
+        local.z() = (dl.z() >= 0.0) ? dim.z() : -dim.z();
+        break;
+    case ConvexShape::CYLINDER: {
+        double radial = std::sqrt(dl.x() * dl.x() + dl.y() * dl.y());
+        if (radial > 0.0) {
+            local.x() = dim.x() * dl.x() / radial;
+            local.y() = dim.x() * dl.y() / radial;
+        }
+        local.z() = (dl.z() >= 0.0) ? dim.z() : -dim.z();
+        break;
+    }
+    case ConvexShape::CONE: {
+        // Either the apex or a point on the rim of the base
+        double radial = std::sqrt(dl.x() * dl.x() + dl.y() * dl.y());
+        local.z() = -dim.z();
+        if (radial > 0.0) {
+            local.x() = dim.x() * dl.x() / radial;
+            local.y() = dim.x() * dl.y() / radial;
+        }
+        if (dim.z() * dl.z() > local.dot(dl)) {
+            local << 0.0, 0.0, dim.z();
+        }
+        break;
+    }
+    }
+
+    return shape.position + shape.rotation * local;
+
+}
+
+double ShapeDistance::closestSegmentSegment(const Eigen::Vector3d& p0, const Eigen::Vector3d& p1, const Eigen::Vector3d& q0, const Eigen::Vector3d& q1,
+                                            Eigen::Vector3d& point_p, Eigen::Vector3d& point_q) {
+
+    // Ericson, Real-Time Collision Detection, 5.1.9
+    Eigen::Vector3d d1 = p1 - p0;
+    Eigen::Vector3d d2 = q1 - q0;
+    Eigen::Vector3d r = p0 - q0;
+    double a = d1.squaredNorm();
+    double e = d2.squaredNorm();
+    double f = d2.dot(r);
+    double s = 0.0, t = 0.0;
+
+    if (a <= SQUARED_EPS && e <= SQUARED_EPS) {
+        // Two points
+    } else if (a <= SQUARED_EPS) {
+        t = std::min(std::max(f / e, 0.0), 1.0);
+    } else {
+        double c = d1.dot(r);
+        if (e <= SQUARED_EPS) {
+            s = std::min(std::max(-c / a, 0.0), 1.0);
+        } else {
+            double b = d1.dot(d2);
+            double denom = a * e - b * b;
+            // Parallel segments: pick any s
+            if (denom > 0.0) {
+                s = std::min(std::max((b * f - c * e) / denom, 0.0), 1.0);
+            }
+            t = (b * s + f) / e;
+            if (t < 0.0) {
+                t = 0.0;
+                s = std::min(std::max(-c / a, 0.0), 1.0);
+            } else if (t > 1.0) {
+                t = 1.0;
+                s = std::min(std::max((b - c) / a, 0.0), 1.0);
+            }
+        }
+    }
+
+    point_p.noalias() = p0 + s * d1;
+    point_q.noalias() = q0 + t * d2;
+    return (point_p - point_q).squaredNorm();
+
+}
+
+bool ShapeDistance::gjk(const ConvexShape& a, const ConvexShape& b, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b) {
+
+    /// Simplex of the Minkowski difference a - b and the corresponding support points of a and b
+    Eigen::Vector3d w[4], sa[4], sb[4];
+    double lambda[4];
+    unsigned int size = 1;
+
+    Eigen::Vector3d v = a.position - b.position;
+    if (v.squaredNorm() <= SQUARED_EPS) {
+        v = Eigen::Vector3d::UnitX();
+    }
+    sa[0] = support(a, -v);
+    sb[0] = support(b, v);
+    w[0] = sa[0] - sb[0];
+    lambda[0] = 1.0;
+    v = w[0];
+
+    for (unsigned int iteration = 0; iteration < MAX_ITERATIONS; ++iteration) {
+
+        double vv = v.squaredNorm();
+        if (vv <= SQUARED_EPS) {
+            return false;
+        }
+
+        /// New support point in the direction of the origin, stop if it does not get closer
+        Eigen::Vector3d new_a = support(a, -v);
+        Eigen::Vector3d new_b = support(b, v);
+        Eigen::Vector3d new_w = new_a - new_b;
+        if (vv - v.dot(new_w) <= GJK_RELATIVE_EPS * vv) {
+            break;
+        }
+        bool duplicate = false;
+        for (unsigned int i = 0; i < size; ++i) {
+            if ((w[i] - new_w).squaredNorm() <= SQUARED_EPS) duplicate = true;
+        }
+        if (duplicate) {
+            break;
+        }
+
+        w[size] = new_w;
+        sa[size] = new_a;
+        sb[size] = new_b;
+        ++size;
+
+        if (!reduceSimplex(w, sa, sb, size, lambda)) {
+            return false;
+        }
+
+        v.setZero();
+        for (unsigned int i = 0; i < size; ++i) {
+            v += lambda[i] * w[i];
+        }
+    }
+
+    point_a.setZero();
+    point_b.setZero();
+    for (unsigned int i = 0; i < size; ++i) {
+        point_a += lambda[i] * sa[i];
+        point_b += lambda[i] * sb[i];
+    }
+    return true;
+
+}
+
+bool ShapeDistance::reduceSimplex(Eigen::Vector3d* w, Eigen::Vector3d* sa, Eigen::Vector3d* sb, unsigned int& size, double* lambda) {
+
+    unsigned int index[3];
+    unsigned int num_kept = 0;
+
+    if (size == 2) {
+
+        Eigen::Vector3d ab = w[1] - w[0];
+        double ab2 = ab.squaredNorm();
+        double t = (ab2 > SQUARED_EPS) ? -w[0].dot(ab) / ab2 : 1.0;
+        if (t <= 0.0) {
+            index[0] = 0; lambda[0] = 1.0; num_kept = 1;
+        } else if (t >= 1.0) {
+            index[0] = 1; lambda[0] = 1.0; num_kept = 1;
+        } else {
+            index[0] = 0; index[1] = 1;
+            lambda[0] = 1.0 - t; lambda[1] = t;
+            num_kept = 2;
+        }
+
+    } else if (size == 3) {
+
+        num_kept = closestTriangle(w[0], w[1], w[2], index, lambda);
+
+    } else {
+
+        /// Tetrahedron: check the faces of which the origin lies on the outer side
+        static const unsigned int faces[4][4] = {{0, 1, 2, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {1, 3, 2, 0}};
+        double best = -1.0;
+        for (unsigned int f = 0; f < 4; ++f) {
+            const Eigen::Vector3d& p0 = w[faces[f][0]];
+            const Eigen::Vector3d& p1 = w[faces[f][1]];
+            const Eigen::Vector3d& p2 = w[faces[f][2]];
+            Eigen::Vector3d normal = (p1 - p0).cross(p2 - p0);
+            double side_origin = -normal.dot(p0);
+            double side_opposite = normal.dot(w[faces[f][3]] - p0);
+            // A (nearly) flat tetrahedron has no inside: check every face
+            bool outside = side_origin * side_opposite < 0.0 || std::abs(side_opposite) <= SQUARED_EPS;
+            if (!outside) {
+                continue;
+            }
+
+            unsigned int face_index[3];
+            double face_lambda[3];
+            unsigned int face_kept = closestTriangle(p0, p1, p2, face_index, face_lambda);
+            Eigen::Vector3d closest(0.0, 0.0, 0.0);
+            for (unsigned int i = 0; i < face_kept; ++i) {
+                closest += face_lambda[i] * w[faces[f][face_index[i]]];
+            }
+            double distance = closest.squaredNorm();
+            if (best < 0.0 || distance < best) {
+                best = distance;
+                num_kept = face_kept;
+                for (unsigned int i = 0; i < face_kept; ++i) {
+                    index[i] = faces[f][face_index[i]];
+                    lambda[i] = face_lambda[i];
+                }
+            }
+        }
+        if (best < 0.0) {
+            return false;
+        }
+
+    }
+
+    /// Keep the vertices of the closest feature, in their original order
+    if (num_kept < size) {
+        if (num_kept > 1 && index[0] > index[1]) {
+            std::swap(index[0], index[1]);
+            std::swap(lambda[0], lambda[1]);
+        }
+        if (num_kept > 2 && index[1] > index[2]) {
+            std::swap(index[1], index[2]);
+            std::swap(lambda[1], lambda[2]);
+            if (index[0] > index[1]) {
+                std::swap(index[0], index[1]);
+                std::swap(lambda[0], lambda[1]);
+            }
+        }
+        for (unsigned int i = 0; i < num_kept; ++i) {
+            w[i] = w[index[i]];
+            sa[i] = sa[index[i]];
+            sb[i] = sb[index[i]];
+        }
+    }
+    size = num_kept;
+    return true;
+
+}
+
+unsigned int ShapeDistance::closestTriangle(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+                                            unsigned int* index, double* lambda) {
+
+    Eigen::Vector3d ab = b - a;
+    Eigen::Vector3d ac = c - a;
+
+    double d1 = -ab.dot(a);
+    double d2 = -ac.dot(a);
+    if (d1 <= 0.0 && d2 <= 0.0) {
+        index[0] = 0; lambda[0] = 1.0;
+        return 1;
+    }
+
+    double d3 = -ab.dot(b);
+    double d4 = -ac.dot(b);
+    if (d3 >= 0.0 && d4 <= d3) {
+        index[0] = 1; lambda[0] = 1.0;
+        return 1;
+    }
+
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+        double v = d1 / (d1 - d3);
+        index[0] = 0; index[1] = 1;
+        lambda[0] = 1.0 - v; lambda[1] = v;
+        return 2;
+    }
+
+    double d5 = -ab.dot(c);
+    double d6 = -ac.dot(c);
+    if (d6 >= 0.0 && d5 <= d6) {
+        index[0] = 2; lambda[0] = 1.0;
+        return 1;
+    }
+
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+        double v = d2 / (d2 - d6);
+        index[0] = 0; index[1] = 2;
+        lambda[0] = 1.0 - v; lambda[1] = v;
+        return 2;
+    }
+
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+        double v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        index[0] = 1; index[1] = 2;
+        lambda[0] = 1.0 - v; lambda[1] = v;
+        return 2;
+    }
+
+    double denom = 1.0 / (va + vb + vc);
+    double v = vb * denom;
+    double u = vc * denom;
+    index[0] = 0; index[1] = 1; index[2] = 2;
+    lambda[0] = 1.0 - v - u; lambda[1] = v; lambda[2] = u;
+    return 3;
+
+}
+
+ShapeDistanceBatch::ShapeDistanceBatch() : num_spheres_(0) {
+
+}
+
+void ShapeDistanceBatch::reserve(unsigned int capacity) {
+
+    is_sphere_.reserve(capacity);
+    slot_.reserve(capacity);
+    if (capacity > (unsigned int)radius_a_.size()) {
+        resizeSpheres(capacity);
+    }
+    general_a_.reserve(capacity);
+    general_b_.reserve(capacity);
+    general_distance_.reserve(capacity);
+    general_point_a_.reserve(capacity);
+    general_point_b_.reserve(capacity);
+
+}
+
+void ShapeDistanceBatch::clear() {
+
+    is_sphere_.clear();
+    slot_.clear();
+    num_spheres_ = 0;
+    general_a_.clear();
+    general_b_.clear();
+
+}
+
+unsigned int ShapeDistanceBatch::add(const ConvexShape& a, const ConvexShape& b) {
+
+    if (a.type == ConvexShape::SPHERE && b.type == ConvexShape::SPHERE) {
+        if (num_spheres_ == (unsigned int)radius_a_.size()) {
+            resizeSpheres(std::max(2 * num_spheres_, 8u));
+        }
+
+        for (unsigned int k = 0; k < 3; ++k) {
+            center_a_[k](num_spheres_) = a.position(k);
+            center_b_[k](num_spheres_) = b.position(k);
+        }
+        radius_a_(num_spheres_) = a.dimensions.x();
+        radius_b_(num_spheres_) = b.dimensions.x();
+
+        is_sphere_.push_back(true);
+        slot_.push_back(num_spheres_++);
+    } else {
+        general_a_.push_back(a);
+        general_b_.push_back(b);
+
+        is_sphere_.push_back(false);
+        slot_.push_back(general_a_.size() - 1);
+    }
+
+    return is_sphere_.size() - 1;
+
+}
+
+unsigned int ShapeDistanceBatch::size() const {
+    return is_sphere_.size();
+}
+
+void ShapeDistanceBatch::compute() {
+
+    computeSpheres();
+
+    general_distance_.resize(general_a_.size());
+    general_point_a_.resize(general_a_.size());
+    general_point_b_.resize(general_a_.size());
+    for (unsigned int i = 0; i < general_a_.size(); ++i) {
+        general_distance_[i] = ShapeDistance::compute(general_a_[i], general_b_[i], general_point_a_[i], general_point_b_[i]);
+    }
+
+}
+
+double ShapeDistanceBatch::getDistance(unsigned int i, Eigen::Vector3d& point_a, Eigen::Vector3d& point_b) const {
+
+    unsigned int j = slot_[i];
+    if (!is_sphere_[i]) {
+        point_a = general_point_a_[j];
+        point_b = general_point_b_[j];
+        return general_distance_[j];
+    }
+
+    point_a << point_a_[0](j), point_a_[1](j), point_a_[2](j);
+    point_b << point_b_[0](j), point_b_[1](j), point_b_[2](j);
+    return distance_(j);
+
+}
+
+void ShapeDistanceBatch::resizeSpheres(unsigned int capacity) {
+
+    for (unsigned int k = 0; k < 3; ++k) {
+        center_a_[k].conservativeResize(capacity);
+        center_b_[k].conservativeResize(capacity);
+        point_a_[k].resize(capacity);
+        point_b_[k].resize(capacity);
+    }
+    radius_a_.conservativeResize(capacity);
+    radius_b_.conservativeResize(capacity);
+    distance_.resize(capacity);
+
+}
+
+#ifdef __SSE2__
+namespace {
+
+//! Per lane: a where the mask is set, b elsewhere
+inline __m128d select(__m128d mask, __m128d a, __m128d b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+}
+#endif
+
+void ShapeDistanceBatch::computeSpheres() {
+
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    // ShapeDistance::compute on two pairs at a time, the coordinates of both pairs are adjacent in the arrays
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d eps = _mm_set1_pd(SQUARED_EPS);
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    for (; i + 2 <= num_spheres_; i += 2) {
+        __m128d center_a[3], center_b[3], n[3];
+        for (unsigned int k = 0; k < 3; ++k) {
+            center_a[k] = _mm_loadu_pd(center_a_[k].data() + i);
+            center_b[k] = _mm_loadu_pd(center_b_[k].data() + i);
+            n[k] = _mm_sub_pd(center_b[k], center_a[k]);
+        }
+        __m128d squared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(n[0], n[0]), _mm_mul_pd(n[1], n[1])), _mm_mul_pd(n[2], n[2]));
+
+        /// Subtract the radii along the line between the centers, concentric spheres return the centers
+        __m128d separated = _mm_cmpgt_pd(squared, eps);
+        __m128d safe_squared = select(separated, squared, one);
+        __m128d inverse_distance = _mm_div_pd(one, _mm_sqrt_pd(safe_squared));
+        __m128d radius_a = _mm_loadu_pd(radius_a_.data() + i);
+        __m128d radii = _mm_add_pd(radius_a, _mm_loadu_pd(radius_b_.data() + i));
+        __m128d distance = _mm_sub_pd(_mm_and_pd(separated, _mm_mul_pd(safe_squared, inverse_distance)), radii);
+        __m128d abs_distance = _mm_andnot_pd(sign, distance);
+        _mm_storeu_pd(distance_.data() + i, distance);
+
+        for (unsigned int k = 0; k < 3; ++k) {
+            __m128d normal = _mm_mul_pd(n[k], inverse_distance);
+            __m128d point_a = _mm_add_pd(center_a[k], _mm_mul_pd(radius_a, normal));
+            __m128d point_b = _mm_add_pd(point_a, _mm_mul_pd(abs_distance, normal));
+            _mm_storeu_pd(point_a_[k].data() + i, select(separated, point_a, center_a[k]));
+            _mm_storeu_pd(point_b_[k].data() + i, select(separated, point_b, center_b[k]));
+        }
+    }
+#endif
+
+    /// The remaining pair (or all pairs without SSE2)
+    for (; i < num_spheres_; ++i) {
+        computeSphere(i);
+    }
+
+}
+
+void ShapeDistanceBatch::computeSphere(unsigned int i) {
+
+    Eigen::Vector3d center_a(center_a_[0](i), center_a_[1](i), center_a_[2](i));
+    Eigen::Vector3d center_b(center_b_[0](i), center_b_[1](i), center_b_[2](i));
+    Eigen::Vector3d point_a = center_a, point_b = center_b;
+    double radii = radius_a_(i) + radius_b_(i);
+
+    /// As ShapeDistance::compute
+    if ((center_b - center_a).squaredNorm() > SQUARED_EPS) {
+        double center_distance = (center_b - center_a).norm();
+        Eigen::Vector3d normal = (center_b - center_a) / center_distance;
+        distance_(i) = center_distance - radii;
+        point_a = center_a + radius_a_(i) * normal;
+        point_b = point_a + std::abs(distance_(i)) * normal;
+    } else {
+        distance_(i) = -radii;
+    }
+
+    for (unsigned int k = 0; k < 3; ++k) {
+        point_a_[k](i) = point_a(k);
+        point_b_[k](i) = point_b(k);
+    }
+
+}
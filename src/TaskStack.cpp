@@ -0,0 +1,101 @@
+#include "TaskStack.h"
+
+#include <algorithm>
+
+TaskStack::TaskStack() : num_growths_(0) {
+
+}
+
+TaskStack::~TaskStack() {
+
+}
+
+void TaskStack::initialize(unsigned int num_levels, unsigned int num_joints, unsigned int initial_rows) {
+
+    jacobians_.resize(num_levels);
+    torques_.resize(num_levels);
+    for (unsigned int i = 0; i < num_levels; i++) {
+        jacobians_[i].setZero(initial_rows, num_joints);
+        torques_[i].setZero(num_joints);
+    }
+    rows_.assign(num_levels, 0);
+    max_rows_.assign(num_levels, 0);
+    num_growths_ = 0;
+
+}
+
+void TaskStack::reserve(unsigned int level, unsigned int rows) {
+
+    unsigned int old_rows = jacobians_[level].rows();
+    if (rows > old_rows) {
+        jacobians_[level].conservativeResize(rows, Eigen::NoChange);
+        jacobians_[level].bottomRows(rows - old_rows).setZero();
+    }
+
+}
+
+void TaskStack::clear() {
+
+    for (unsigned int i = 0; i < jacobians_.size(); i++) {
+        jacobians_[i].topRows(rows_[i]).setZero();
+        rows_[i] = 0;
+        torques_[i].setZero();
+    }
+
+}
+
+void TaskStack::addTask(unsigned int level, const Eigen::MatrixXd& jacobian, const Eigen::VectorXd& torques) {
+
+    addTask(level, jacobian, jacobian.rows(), torques);
+
+}
+
+void TaskStack::addTask(unsigned int level, const Eigen::MatrixXd& jacobian, unsigned int number_rows, const Eigen::VectorXd& torques) {
+
+    torques_[level] += torques;
+
+    unsigned int required_rows = rows_[level] + number_rows;
+
+    /// Only if more rows were added than reserved: grow the capacity, the new rows are zero
+    if (required_rows > (unsigned int)jacobians_[level].rows()) {
+        reserve(level, std::max(2 * (unsigned int)jacobians_[level].rows(), required_rows));
+        ++num_growths_;
+    }
+
+    jacobians_[level].block(rows_[level], 0, number_rows, jacobian.cols()) = jacobian.topRows(number_rows);
+    rows_[level] = required_rows;
+    max_rows_[level] = std::max(max_rows_[level], required_rows);
+
+}
+
+unsigned int TaskStack::getNrLevels() const {
+    return jacobians_.size();
+}
+
+const Eigen::MatrixXd& TaskStack::getJacobian(unsigned int level) const {
+    return jacobians_[level];
+}
+
+unsigned int TaskStack::getNrRows(unsigned int level) const {
+    return rows_[level];
+}
+
+Eigen::VectorXd& TaskStack::getTorques(unsigned int level) {
+    return torques_[level];
+}
+
+const Eigen::VectorXd& TaskStack::getTorques(unsigned int level) const {
+    return torques_[level];
+}
+
+unsigned int TaskStack::getCapacity(unsigned int level) const {
+    return jacobians_[level].rows();
+}
+
+unsigned int TaskStack::getMaxRows(unsigned int level) const {
+    return max_rows_[level];
+}
+
+unsigned int TaskStack::getNrGrowths() const {
+    return num_growths_;
+}
@@ -1,30 +1,39 @@
 #include "Tree.h"
 
-Tree::Tree() : jac_solver_(0) {
-}
+#include <algorithm>
+#include <cmath>
 
-Tree::~Tree() {
-    delete jac_solver_;
-}
+#include <ros/console.h>
 
-void Tree::calcPartialJacobian(const std::string& link_name,
-                               Eigen::MatrixXd& jacobian)
-{
-    KDL::Jacobian kdl_jacobian;
-    kdl_jacobian.resize(kdl_tree_.getNrOfJoints());
+namespace {
 
-    jac_solver_->JntToJac(q_tree_,kdl_jacobian,link_name);
+bool segmentNameLess(const KDL::SegmentMap::const_iterator& a, const KDL::SegmentMap::const_iterator& b)
+{
+    return a->first < b->first;
+}
 
-    for(unsigned int i = 0; i < kdl_jacobian.rows(); ++i)
+/** Whether two frames are exactly the same (KDL::Equal with an epsilon of 0 never holds) */
+bool isSameFrame(const KDL::Frame& a, const KDL::Frame& b)
+{
+    for (unsigned int i = 0; i < 3; ++i)
     {
-        for(unsigned int j = 0; j < kdl_jacobian.columns(); ++j)
-        {
-            if (tree_joint_index_[j] >= 0)
-            {
-                jacobian(i,tree_joint_index_[j]) = kdl_jacobian(i,j);
-            }
-        }
+        if (a.p(i) != b.p(i))
+            return false;
     }
+    for (unsigned int i = 0; i < 9; ++i)
+    {
+        if (a.M.data[i] != b.M.data[i])
+            return false;
+    }
+    return true;
+}
+
+}
+
+Tree::Tree() : use_generated_kinematics_(false) {
+}
+
+Tree::~Tree() {
 }
 
 void Tree::getJointNames(std::map<std::string, unsigned int> &jnt_name_to_index_in,std::map<std::string, unsigned int> &jnt_name_to_index_out)
@@ -83,11 +92,266 @@ void Tree::rearrangeJntArrayToTree(KDL::JntArray& q_in)
         else if (index >= 0 )
         {
             q_tree_.data[i] = q_in.data[index];
+            q_joints_.data[index] = q_in.data[index];
         }
     }
+
+    /// All segments must be recomputed
+    segment_dirty_.assign(segment_dirty_.size(), true);
+}
+
+void Tree::setJointPosition(unsigned int index, double pos)
+{
+    int q_nr = joint_tree_index_[index];
+    if (q_nr >= 0 && q_tree_(q_nr) != pos)
+    {
+        q_tree_(q_nr) = pos;
+        q_joints_(index) = pos;
+        segment_dirty_[joint_segment_index_[index]] = true;
+    }
 }
 
 unsigned int Tree::getNrJoints()
 {
     return number_of_joints_;
 }
+
+void Tree::initializeSegments()
+{
+    segments_.clear();
+    segment_parent_index_.clear();
+    segment_name_to_index_.clear();
+
+    /// Breadth first walk from the root: every parent is added before its children
+    /// Siblings are sorted by name, scripts/generate_kinematics uses the same order
+    segments_.push_back(kdl_tree_.getRootSegment());
+    segment_parent_index_.push_back(-1);
+    for (unsigned int i = 0; i < segments_.size(); ++i)
+    {
+        segment_name_to_index_[segments_[i]->first] = i;
+
+        std::vector<KDL::SegmentMap::const_iterator> children = segments_[i]->second.children;
+        std::sort(children.begin(), children.end(), segmentNameLess);
+        for (std::vector<KDL::SegmentMap::const_iterator>::const_iterator it = children.begin(); it != children.end(); ++it)
+        {
+            segments_.push_back(*it);
+            segment_parent_index_.push_back(i);
+        }
+    }
+
+    /// Relate the whole body joints to the tree
+    joint_tree_index_.assign(number_of_joints_, -1);
+    joint_segment_index_.assign(number_of_joints_, -1);
+    for (unsigned int i = 0; i < segments_.size(); ++i)
+    {
+        const KDL::TreeElement& element = segments_[i]->second;
+        if (element.segment.getJoint().getType() != KDL::Joint::None && tree_joint_index_[element.q_nr] >= 0)
+        {
+            joint_tree_index_[tree_joint_index_[element.q_nr]] = element.q_nr;
+            joint_segment_index_[tree_joint_index_[element.q_nr]] = i;
+        }
+    }
+
+    /// Nothing has been computed yet
+    q_tree_.resize(kdl_tree_.getNrOfJoints());
+    KDL::SetToZero(q_tree_);
+    q_joints_.resize(number_of_joints_);
+    KDL::SetToZero(q_joints_);
+    segment_dirty_.assign(segments_.size(), true);
+
+    /// Use the generated kinematics if these have been generated from this robot model
+    generated_kinematics_.reset(createGeneratedKinematics());
+    use_generated_kinematics_ = false;
+    if (generated_kinematics_)
+    {
+        if (matchesGeneratedKinematics())
+        {
+            ROS_INFO("Using generated kinematics");
+            use_generated_kinematics_ = true;
+        }
+        else
+        {
+            ROS_WARN("Generated kinematics do not match the robot model, using KDL");
+            generated_kinematics_.reset();
+        }
+    }
+}
+
+bool Tree::matchesGeneratedKinematics()
+{
+    /// Structure
+    if (generated_kinematics_->getNrSegments() != segments_.size() || generated_kinematics_->getNrJoints() != (unsigned int)number_of_joints_)
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < segments_.size(); ++i)
+    {
+        if (segments_[i]->first != generated_kinematics_->getSegmentName(i) || segment_parent_index_[i] != generated_kinematics_->getParentIndex(i))
+        {
+            return false;
+        }
+    }
+    for (unsigned int i = 0; i < (unsigned int)number_of_joints_; ++i)
+    {
+        std::map<std::string, unsigned int>::const_iterator it = joint_name_to_index_.find(generated_kinematics_->getJointName(i));
+        if (it == joint_name_to_index_.end() || it->second != i)
+        {
+            return false;
+        }
+    }
+
+    /// Results for a test configuration (all other fixed transforms, axes and joint types)
+    for (unsigned int i = 0; i < (unsigned int)number_of_joints_; ++i)
+    {
+        q_joints_(i) = 0.3 + 0.1 * i;
+        if (joint_tree_index_[i] >= 0)
+        {
+            q_tree_(joint_tree_index_[i]) = q_joints_(i);
+        }
+    }
+
+    std::vector<KDL::Frame> poses_kdl(segments_.size()), poses_generated(segments_.size());
+    std::vector<bool> dirty(segments_.size(), true), updated(segments_.size(), true);
+    calcFKKDL(poses_kdl, updated);
+    generated_kinematics_->calcFK(q_joints_, dirty, poses_generated, updated);
+
+    Eigen::MatrixXd jacobian_kdl(6, number_of_joints_), jacobian_generated(6, number_of_joints_);
+    bool match = true;
+    for (unsigned int i = 0; i < segments_.size() && match; ++i)
+    {
+        calcJacobianKDL(i, poses_kdl, jacobian_kdl);
+        generated_kinematics_->calcJacobian(i, poses_kdl, jacobian_generated);
+        match = KDL::Equal(poses_kdl[i], poses_generated[i], 1e-9) && jacobian_kdl.isApprox(jacobian_generated, 1e-9);
+    }
+
+    KDL::SetToZero(q_tree_);
+    KDL::SetToZero(q_joints_);
+    return match;
+}
+
+unsigned int Tree::getNrSegments() const
+{
+    return segments_.size();
+}
+
+int Tree::getSegmentIndex(const std::string& segment_name) const
+{
+    std::map<std::string, unsigned int>::const_iterator it = segment_name_to_index_.find(segment_name);
+    if (it == segment_name_to_index_.end())
+    {
+        return -1;
+    }
+    return it->second;
+}
+
+const std::string& Tree::getSegmentName(unsigned int index) const
+{
+    return segments_[index]->first;
+}
+
+void Tree::calcFK(const KDL::Frame& root_pose, std::vector<KDL::Frame>& poses, std::vector<bool>& updated)
+{
+    /// The complete tree moves with the root
+    if (!isSameFrame(root_pose, poses[0]))
+    {
+        segment_dirty_[0] = true;
+    }
+    if (segment_dirty_[0])
+    {
+        poses[0] = root_pose;
+    }
+    updated[0] = segment_dirty_[0];
+
+    if (use_generated_kinematics_)
+    {
+        generated_kinematics_->calcFK(q_joints_, segment_dirty_, poses, updated);
+    }
+    else
+    {
+        calcFKKDL(poses, updated);
+    }
+
+    segment_dirty_.assign(segments_.size(), false);
+}
+
+void Tree::calcFKKDL(std::vector<KDL::Frame>& poses, std::vector<bool>& updated) const
+{
+    /// Parents come before their children, so a dirty segment marks its complete subtree as updated
+    for (unsigned int i = 1; i < segments_.size(); ++i)
+    {
+        updated[i] = segment_dirty_[i] || updated[segment_parent_index_[i]];
+        if (updated[i])
+        {
+            const KDL::TreeElement& element = segments_[i]->second;
+            poses[i] = poses[segment_parent_index_[i]] * element.segment.pose(q_tree_(element.q_nr));
+        }
+    }
+}
+
+KDL::Frame Tree::calcSegmentFK(unsigned int segment_index, const KDL::Frame& root_pose) const
+{
+    /// Walk from the segment to the root
+    KDL::Frame pose = KDL::Frame::Identity();
+    for (int i = segment_index; i > 0; i = segment_parent_index_[i])
+    {
+        const KDL::TreeElement& element = segments_[i]->second;
+        pose = element.segment.pose(q_tree_(element.q_nr)) * pose;
+    }
+    return root_pose * pose;
+}
+
+void Tree::calcJacobian(unsigned int segment_index, const std::vector<KDL::Frame>& poses, Eigen::MatrixXd& jacobian) const
+{
+    if (use_generated_kinematics_)
+    {
+        generated_kinematics_->calcJacobian(segment_index, poses, jacobian);
+    }
+    else
+    {
+        calcJacobianKDL(segment_index, poses, jacobian);
+    }
+}
+
+bool Tree::hasGeneratedKinematics() const
+{
+    return generated_kinematics_.get() != 0;
+}
+
+void Tree::useGeneratedKinematics(bool use)
+{
+    use_generated_kinematics_ = use && generated_kinematics_.get() != 0;
+}
+
+void Tree::calcJacobianKDL(unsigned int segment_index, const std::vector<KDL::Frame>& poses, Eigen::MatrixXd& jacobian) const
+{
+    jacobian.setZero();
+
+    const KDL::Vector& end_point = poses[segment_index].p;
+
+    /// Walk from the segment to the root, every movable joint on the way adds one column
+    for (int i = segment_index; i > 0; i = segment_parent_index_[i])
+    {
+        const KDL::TreeElement& element = segments_[i]->second;
+        if (element.segment.getJoint().getType() == KDL::Joint::None)
+        {
+            continue;
+        }
+
+        int column = tree_joint_index_[element.q_nr];
+        if (column < 0)
+        {
+            continue; // Joint is not controlled
+        }
+
+        /// Twist of the segment tip for a unit joint velocity, expressed in the frame of the poses
+        /// with the reference point moved from the segment tip to the end point
+        KDL::Twist twist = poses[segment_parent_index_[i]].M * element.segment.twist(q_tree_(element.q_nr), 1.0);
+        twist = twist.RefPoint(end_point - poses[i].p);
+
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            jacobian(j, column)   = twist.vel(j);
+            jacobian(j+3, column) = twist.rot(j);
+        }
+    }
+}
@@ -1,10 +1,16 @@
 #include "WholeBodyController.h"
 
 #include "ChainParser.h"
+#include "AllocationCounter.h"
 #include <ros/node_handle.h>
 #include <assert.h>
+#include <sstream>
+#include <algorithm>
 
-WholeBodyController::WholeBodyController(const double Ts)
+/// Number of updates after which update() must not allocate anymore
+static const unsigned int ALLOCATION_CHECK_WARMUP = 100;
+
+WholeBodyController::WholeBodyController(const double Ts) : num_priority_levels_(0), number_of_updates_(0), number_of_cycles_(0), allocations_(0)
 {
     initialize(Ts);
 }
@@ -17,6 +23,7 @@ WholeBodyController::~WholeBodyController() {
 
 bool WholeBodyController::initialize(const double Ts)
 {
+    Ts_ = Ts;
     ros::NodeHandle n("~");
     std::string ns = n.getNamespace();
     //ROS_INFO("Nodehandle %s",n.getNamespace().c_str());
@@ -57,9 +64,10 @@ bool WholeBodyController::initialize(const double Ts)
 
     loadParameterFiles();
 
-    // Construct the FK and Jacobian solvers
-    robot_state_.fk_solver_ = new KDL::TreeFkSolverPos_recursive(robot_state_.tree_.kdl_tree_);
-    robot_state_.tree_.jac_solver_ = new KDL::TreeJntToJacSolver(robot_state_.tree_.kdl_tree_);
+    // Construct the FK storage and Jacobian cache
+    if (!robot_state_.initialize()) {
+        return false;
+    }
 
     // Initialize admittance controller
     AdmitCont_.initialize(Ts,q_min, q_max, admittance_mass, admittance_damping);
@@ -69,7 +77,16 @@ bool WholeBodyController::initialize(const double Ts)
     Eigen::MatrixXd A;
     A.setIdentity(num_joints_,num_joints_);
 
-    ComputeNullspace_.initialize(num_joints_, A);
+    std::string decomposition_name;
+    n.param<std::string> ("nullspace_decomposition", decomposition_name, "ldlt");
+    ComputeNullspace::Decomposition decomposition;
+    if (!ComputeNullspace::getDecomposition(decomposition_name, decomposition)) {
+        ROS_ERROR("Unknown nullspace decomposition '%s', choose svd, qr or ldlt", decomposition_name.c_str());
+        return false;
+    }
+    bool block_sparse;
+    n.param<bool> ("nullspace_block_sparse", block_sparse, true);
+    ComputeNullspace_.initialize(num_joints_, A, decomposition, block_sparse);
 
     // Initialize Joint Limit Avoidance
     //for (uint i = 0; i < num_joints_; i++) ROS_INFO("JLA gain of joint %i is %f",i,JLA_gain[i]);
@@ -84,14 +101,33 @@ bool WholeBodyController::initialize(const double Ts)
     qdot_reference_.resize(num_joints_);
     q_reference_.resize(num_joints_);
     tau_.resize(num_joints_);
-    Jacobians_.resize(4);
-    Ns_.resize(4);
-    taus_.resize(4);
-    for (unsigned int i = 0; i < 4; i++) {
-        Jacobians_[i].resize(100, num_joints_);
-        Ns_[i].resize(num_joints_, num_joints_);
-        taus_[i].resize(num_joints_);
+
+    /// Priority levels: motion objectives have priority 1 (highest) to num_priority_levels_,
+    /// joint limit avoidance and posture control are in the lowest level
+    int num_priority_levels;
+    n.param<int> ("number_of_priority_levels", num_priority_levels, 4);
+    if (num_priority_levels < 1) {
+        ROS_ERROR("Number of priority levels must be at least 1 (is %d)", num_priority_levels);
+        return false;
     }
+    num_priority_levels_ = num_priority_levels;
+    ROS_INFO("Number of priority levels: %u", num_priority_levels_);
+
+    /// The capacity of a level grows if more rows are needed
+    task_stack_.initialize(num_priority_levels_, num_joints_, 12);
+    task_stack_pub_ = n.advertise<amigo_whole_body_controller::TaskStackStatistics>("task_stack_statistics", 1);
+    task_stack_statistics_.rows.resize(num_priority_levels_);
+    task_stack_statistics_.max_rows.resize(num_priority_levels_);
+    task_stack_statistics_.capacity.resize(num_priority_levels_);
+    task_stack_statistics_period_ = std::max(1, (int)(1.0 / Ts));
+    q0s_.reserve(num_joints_);
+    timer_name_update_ = "WholeBodyController::update";
+    timer_name_motionobjectives_ = "WholeBodyController::motionobjectives";
+
+    /// Worker threads for the motion objectives
+    int motion_objective_threads;
+    n.param<int> ("motion_objective_threads", motion_objective_threads, 0);
+    motionobjective_pool_.initialize(std::max(0, motion_objective_threads));
 
     /// Initialize tracer
     std::vector<std::string> column_names = index_to_joint_name_;
@@ -120,17 +156,59 @@ bool WholeBodyController::initialize(const double Ts)
 
 bool WholeBodyController::addMotionObjective(MotionObjective* motionobjective)
 {
+    if (motionobjective->getPriority() < 1 || motionobjective->getPriority() > num_priority_levels_) {
+        ROS_ERROR("Priority of %s motion objective (%u) must be between 1 and %u", motionobjective->type_.c_str(), motionobjective->getPriority(), num_priority_levels_);
+        return false;
+    }
     if (!motionobjective->initialize(robot_state_))
     {
         return false;
     }
     motionobjectives_.push_back(motionobjective);
+    motionobjective_timer_names_.push_back("WholeBodyController::motionobjective::" + motionobjective->type_);
+    motionobjective_allocations_.push_back(0);
+
+    /// The motion objective is applied in the first cycle
+    MotionObjectiveSchedule schedule;
+    schedule.period = std::max(1, (int)(motionobjective->getUpdatePeriod() / Ts_ + 0.5));
+    schedule.cycles_since_update = schedule.period;
+    schedule.due = false;
+    schedule.num_updates = 0;
+    schedule.tau_previous.setZero(num_joints_);
+    schedule.tau_hold.setZero(num_joints_);
+    motionobjective_schedules_.push_back(schedule);
+    due_motionobjectives_.reserve(motionobjectives_.size());
+
+    /// Reserve the rows of all motion objectives of this priority in the task stack, such that update() does not grow it
+    unsigned int level = motionobjective->getPriority() - 1;
+    unsigned int level_rows = 0;
+    for (unsigned int i = 0; i < motionobjectives_.size(); ++i) {
+        if (motionobjectives_[i]->getPriority() - 1 == level) {
+            level_rows += motionobjectives_[i]->getJacobian().rows();
+        }
+    }
+    task_stack_.reserve(level, level_rows);
+    if (schedule.period > 1) {
+        ROS_INFO("%s motion objective is applied every %u cycles", motionobjective->type_.c_str(), schedule.period);
+    }
+
+    number_of_updates_ = 0;
     return true;
 }
 
 bool WholeBodyController::removeMotionObjective(MotionObjective* motionobjective) {
 
-    motionobjectives_.erase(std::remove(motionobjectives_.begin(), motionobjectives_.end(), motionobjective), motionobjectives_.end());
+    for (unsigned int i = 0; i < motionobjectives_.size(); ) {
+        if (motionobjectives_[i] == motionobjective) {
+            motionobjectives_.erase(motionobjectives_.begin() + i);
+            motionobjective_timer_names_.erase(motionobjective_timer_names_.begin() + i);
+            motionobjective_allocations_.erase(motionobjective_allocations_.begin() + i);
+            motionobjective_schedules_.erase(motionobjective_schedules_.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    number_of_updates_ = 0;
 
     return true;
 
@@ -146,8 +224,8 @@ void WholeBodyController::setMeasuredJointPosition(const std::string& joint_name
 
         //std::cout << joint_name <<"\t"<<q_current_(index) <<"\t"<<index<< std::endl;
 
-        robot_state_.tree_.rearrangeJntArrayToTree(q_current_);
-        //robot_state_.collectFKSolutions();
+        /// Only marks the subtree of this joint dirty, the FK is updated in update()
+        robot_state_.tree_.setJointPosition(index, pos);
     }
     else
     {
@@ -175,67 +253,90 @@ bool WholeBodyController::setDesiredJointPosition(const std::string& joint_name,
 
 bool WholeBodyController::update(Eigen::VectorXd &q_reference, Eigen::VectorXd& qdot_reference)
 {
-    statsPublisher_.startTimer("WholeBodyController::update");
+    unsigned long allocations_start = AllocationCounter::count();
+
+    statsPublisher_.startTimer(timer_name_update_);
 
     /// Set some variables to zero
     tau_.setZero();
-    for (unsigned int i = 0; i < 4; i++) {
-        Jacobians_[i].setZero();
-        Ns_[i].setZero();
-        taus_[i].setZero();
-    }
+    task_stack_.clear();
 
-    /// Update the kinematic tree and FK
-    robot_state_.tree_.rearrangeJntArrayToTree(q_current_);
+    /// Update the FK of the subtrees of which joint measurements have changed
     robot_state_.collectFKSolutions();
     robot_state_.updateCollisionBodyPoses();
 
-    /// Update motion objectives
-    unsigned int row_index = 0;
-    std::vector<unsigned int> row_indexes(4,0);
-    Eigen::MatrixXd jacobian_tree(100, num_joints_);//ToDo: make nice (or member)
-    jacobian_tree.setZero();
-    for(std::vector<MotionObjective*>::iterator it_motionobjective = motionobjectives_.begin(); it_motionobjective != motionobjectives_.end(); ++it_motionobjective)
+    /// Select the motion objectives of which the update period has elapsed, the others reuse their last results
+    due_motionobjectives_.clear();
+    for (unsigned int i = 0; i < motionobjectives_.size(); ++i)
     {
-        MotionObjective* motionobjective = *it_motionobjective;
-        //ROS_INFO("Motion Objective: %p", motionobjective);
+        MotionObjectiveSchedule& schedule = motionobjective_schedules_[i];
+        schedule.due = (schedule.cycles_since_update >= schedule.period);
+        if (schedule.due) {
+            /// Keep the torques of the last update for the first order hold
+            if (schedule.num_updates > 0 && motionobjectives_[i]->useFirstOrderHold()) {
+                schedule.tau_previous = motionobjectives_[i]->getTorques();
+            }
+            schedule.cycles_since_update = 0;
+            ++schedule.num_updates;
+            due_motionobjectives_.push_back(motionobjectives_[i]);
+        }
+        motionobjective_allocations_[i] = 0;
+    }
 
-        statsPublisher_.startTimer("WholeBodyController::motionobjective::" + motionobjective->type_);
+    /// Update motion objectives
+    if (motionobjective_pool_.getNrThreads() == 0) {
+        for (unsigned int i = 0; i < motionobjectives_.size(); ++i)
+        {
+            if (!motionobjective_schedules_[i].due) {
+                continue;
+            }
+            MotionObjective* motionobjective = motionobjectives_[i];
+            //ROS_INFO("Motion Objective: %p", motionobjective);
 
-        motionobjective->apply(robot_state_);
+            statsPublisher_.startTimer(motionobjective_timer_names_[i]);
+            unsigned long allocations_objective = AllocationCounter::count();
 
-        unsigned int priority = motionobjective->getPriority();
-        taus_[priority-1] += motionobjective->getTorques();
-        Eigen::MatrixXd partial_jacobian = motionobjective->getJacobian();
-        int number_rows = partial_jacobian.rows();
-        if ( (row_indexes[priority-1]+number_rows) < Jacobians_[priority-1].rows()) {
-            Jacobians_[priority-1].block(row_index, 0, number_rows, num_joints_) = partial_jacobian;
-            row_indexes[priority-1] += number_rows;
-        } else {
-            ROS_WARN("Number of rows of the Jacobian is getting too large, omitting Jacobian!!!");
+            motionobjective->apply(robot_state_);
+
+            motionobjective_allocations_[i] = AllocationCounter::count() - allocations_objective;
+
+            statsPublisher_.stopTimer(motionobjective_timer_names_[i]);
+        }
+    } else {
+        /// Concurrently: the timing and allocations can not be attributed to a single motion objective
+        statsPublisher_.startTimer(timer_name_motionobjectives_);
+        motionobjective_pool_.apply(due_motionobjectives_, robot_state_);
+        statsPublisher_.stopTimer(timer_name_motionobjectives_);
+    }
+
+    /// Combine the results in a fixed order, hence the torques do not depend on the scheduling of the motion objectives
+    for (unsigned int i = 0; i < motionobjectives_.size(); ++i)
+    {
+        MotionObjective* motionobjective = motionobjectives_[i];
+        MotionObjectiveSchedule& schedule = motionobjective_schedules_[i];
+
+        /// In between updates, the torques are extrapolated from the last two updates if requested
+        const Eigen::VectorXd* torques = &motionobjective->getTorques();
+        if (schedule.cycles_since_update > 0 && schedule.num_updates > 1 && motionobjective->useFirstOrderHold()) {
+            double alpha = (double)schedule.cycles_since_update / schedule.period;
+            schedule.tau_hold = (1.0 + alpha) * (*torques) - alpha * schedule.tau_previous;
+            torques = &schedule.tau_hold;
         }
+        ++schedule.cycles_since_update;
 
-        statsPublisher_.stopTimer("WholeBodyController::motionobjective::" + motionobjective->type_);
+        /// Priorities start at 1
+        task_stack_.addTask(motionobjective->getPriority()-1, motionobjective->getJacobian(), motionobjective->getNrRows(), *torques);
     }
 
     /// Update other motion objectives
-    // Joint limit avoidance currently has priority 4, hence:
-    JointLimitAvoidance_.update(q_current_, taus_[3]);
+    // Joint limit avoidance has the lowest priority, hence:
+    JointLimitAvoidance_.update(q_current_, task_stack_.getTorques(num_priority_levels_-1));
 
     // Posture control: similar
-    PostureControl_.update(q_current_, taus_[3]);
-
-    /// Project torques of lower priority into nullspace of higher order Jacobians
-    //Eigen::VectorXd tautemp = taus_[0];
-    //Eigen::VectorXd tautemp2;
-    for (int i = 2; i >= 0; i--) {
-        ComputeNullspace_.update(Jacobians_[i].block(0,0,row_indexes[i],num_joints_), Ns_[i]);
-        taus_[i] += Ns_[i] * taus_[i+1];
-        //if (i == 0) tautemp2 = taus_[0];
-    }
-    tau_ = taus_[0]; // ToDo: do we need this???
-    //std::cout << "Row indexes: " << row_indexes[0] << ", " << row_indexes[1] << ", " << row_indexes[2] << ", " << row_indexes[3] << std::endl;
-    //for (unsigned int i = 0; i < num_joints_; i++) std::cout << "Joint " << i << ", before: " << tautemp[i] << ", after: " << tautemp2[i] << std::endl;
+    PostureControl_.update(q_current_, task_stack_.getTorques(num_priority_levels_-1));
+
+    /// Project torques of every level into the nullspace of all higher priority levels
+    ComputeNullspace_.update(task_stack_, tau_);
 
     /// Update the admittance controller
     AdmitCont_.update(tau_, qdot_reference_, q_current_, q_reference_);
@@ -261,19 +362,18 @@ bool WholeBodyController::update(Eigen::VectorXd &q_reference, Eigen::VectorXd&
     }
     if (do_trace) {
 
-        std::vector<double> q0s;
-        q0s.reserve(num_joints_);
+        q0s_.clear();
         for (std::vector<std::string>::iterator it = index_to_joint_name_.begin(); it != index_to_joint_name_.end(); ++it) {
-            q0s.push_back(PostureControl_.getJointTarget(*it));
+            q0s_.push_back(PostureControl_.getJointTarget(*it));
         }
-        assert(q0s.size() == num_joints_);
+        assert(q0s_.size() == num_joints_);
 
         tracer_.newLine();
         tracer_.collectTracing(1, q_current_.data);
         /////tracer_.collectTracing(num_joints_+1, tau_cart);
         /////tracer_.collectTracing(2*num_joints_+1, tau_null);
         tracer_.collectTracing(3*num_joints_+1, tau_);
-        tracer_.collectTracing(4*num_joints_+1, q0s);
+        tracer_.collectTracing(4*num_joints_+1, q0s_);
         tracer_.collectTracing(5*num_joints_+1, ci_cost);
         tracer_.collectTracing(5*num_joints_+2, ca_cost);
         tracer_.collectTracing(5*num_joints_+3, JointLimitAvoidance_.getCost());
@@ -281,14 +381,56 @@ bool WholeBodyController::update(Eigen::VectorXd &q_reference, Eigen::VectorXd&
 
     }
 
-    statsPublisher_.stopTimer("WholeBodyController::update");
+    statsPublisher_.stopTimer(timer_name_update_);
+
+    /// Publishing the statistics is not part of the allocation free cycle
+    checkAllocations(AllocationCounter::count() - allocations_start);
 
     statsPublisher_.publish();
+    publishTaskStackStatistics();
 
     return true;
 
 }
 
+void WholeBodyController::publishTaskStackStatistics()
+{
+    if (++number_of_cycles_ % task_stack_statistics_period_ != 0 || task_stack_pub_.getNumSubscribers() == 0) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < task_stack_.getNrLevels(); ++i) {
+        task_stack_statistics_.rows[i] = task_stack_.getNrRows(i);
+        task_stack_statistics_.max_rows[i] = task_stack_.getMaxRows(i);
+        task_stack_statistics_.capacity[i] = task_stack_.getCapacity(i);
+    }
+    task_stack_statistics_.growths = task_stack_.getNrGrowths();
+    task_stack_pub_.publish(task_stack_statistics_);
+}
+
+void WholeBodyController::checkAllocations(unsigned long allocations)
+{
+    allocations_ = allocations;
+    if (!AllocationCounter::enabled() || ++number_of_updates_ <= ALLOCATION_CHECK_WARMUP || allocations == 0) {
+        return;
+    }
+
+    /// Tell which motion objectives allocated
+    std::stringstream objectives;
+    for (unsigned int i = 0; i < motionobjectives_.size(); ++i) {
+        if (motionobjective_allocations_[i] > 0) {
+            objectives << " " << motionobjectives_[i]->type_ << " (" << motionobjective_allocations_[i] << ")";
+        }
+    }
+    ROS_ERROR_THROTTLE(1.0, "WholeBodyController::update allocated memory %lu times after the warm-up, motion objectives:%s",
+                       allocations, objectives.str().c_str());
+}
+
+unsigned long WholeBodyController::getNrAllocations() const
+{
+    return allocations_;
+}
+
 const Eigen::VectorXd& WholeBodyController::getJointReferences() const
 {
     return q_reference_;
@@ -0,0 +1,109 @@
+#include "WorkerPool.h"
+
+#include <boost/bind.hpp>
+
+#include <ros/console.h>
+
+WorkerPool::WorkerPool() : num_threads_(0), generation_(0), num_busy_(0), stopping_(false),
+    task_(0), num_tasks_(0), next_index_(0) {
+
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::initialize(unsigned int num_threads) {
+
+    if (num_threads_ > 0) {
+        ROS_WARN("Worker pool has already been initialized with %u worker threads", num_threads_);
+        return;
+    }
+
+    num_threads_ = num_threads;
+    for (unsigned int i = 0; i < num_threads_; ++i) {
+        threads_.create_thread(boost::bind(&WorkerPool::work, this));
+    }
+
+}
+
+unsigned int WorkerPool::getNrThreads() const {
+    return num_threads_;
+}
+
+void WorkerPool::run(unsigned int num_tasks, const Task& task) {
+
+    /// Nothing to share
+    if (num_threads_ == 0 || num_tasks < 2) {
+        for (unsigned int i = 0; i < num_tasks; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        task_ = &task;
+        num_tasks_ = num_tasks;
+        next_index_ = 0;
+        num_busy_ = num_threads_;
+        ++generation_;
+    }
+    start_.notify_all();
+
+    runRemaining();
+
+    /// Wait for the tasks that are still being run by the workers
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (num_busy_ > 0) {
+        done_.wait(lock);
+    }
+
+}
+
+void WorkerPool::work() {
+
+    unsigned int generation = 0;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (!stopping_ && generation == generation_) {
+                start_.wait(lock);
+            }
+            if (stopping_) {
+                return;
+            }
+            generation = generation_;
+        }
+
+        runRemaining();
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if (--num_busy_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+}
+
+void WorkerPool::runRemaining() {
+
+    const Task& task = *task_;
+    for (unsigned int i = __sync_fetch_and_add(&next_index_, 1); i < num_tasks_; i = __sync_fetch_and_add(&next_index_, 1)) {
+        task(i);
+    }
+
+}
+
+void WorkerPool::stop() {
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_.notify_all();
+    threads_.join_all();
+
+}
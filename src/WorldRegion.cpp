@@ -0,0 +1,141 @@
+#include "WorldRegion.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+//! Query of the objects that overlap the region
+struct RegionQuery
+{
+    const fcl::CollisionObject* region;
+    std::vector<fcl::CollisionObject*>* objects;
+};
+
+//! Collects the other object if its bounding box overlaps the region, the narrow phase is skipped
+bool regionCollisionFunction(fcl::CollisionObject* o1, fcl::CollisionObject* o2, void* data_)
+{
+    RegionQuery* data = static_cast<RegionQuery*>(data_);
+    fcl::CollisionObject* object = (o1 == data->region) ? o2 : o1;
+
+    // Not every manager prunes by bounding box before the callback
+    if (object->getAABB().overlap(data->region->getAABB())) {
+        data->objects->push_back(object);
+    }
+    return false;
+}
+
+}
+
+WorldRegion::WorldRegion() : world_version_(0), margin_(0.0), has_region_(false), num_added_(0), num_removed_(0) {
+
+    region_box_.reset(new fcl::Box(1.0, 1.0, 1.0));
+    region_object_.reset(new fcl::CollisionObject(region_box_));
+
+}
+
+WorldRegion::~WorldRegion() {
+
+}
+
+void WorldRegion::initialize(double margin) {
+
+    margin_ = margin;
+    world_.reset();
+    world_version_ = 0;
+    has_region_ = false;
+    objects_.clear();
+    manager_.clear();
+    num_added_ = 0;
+    num_removed_ = 0;
+
+}
+
+fcl::BroadPhaseCollisionManager* WorldRegion::update(const wbc::WorldPtr& world, const fcl::AABB& envelope) {
+
+    /// Unversioned worlds can not be tracked, release the objects of a previous world
+    unsigned long version = world->getVersion();
+    if (version == 0) {
+        if (world_) {
+            initialize(margin_);
+        }
+        return world->getCollisionManager();
+    }
+
+    bool new_world = (world != world_ || version != world_version_);
+    bool inside = has_region_ && region_.contain(envelope.min_) && region_.contain(envelope.max_);
+    if (!new_world && inside) {
+        return &manager_;
+    }
+
+    /// Move the region to the envelope and select the objects in it
+    fcl::Vec3f margin(margin_, margin_, margin_);
+    region_ = fcl::AABB(envelope.min_ - margin, envelope.max_ + margin);
+    has_region_ = true;
+    selectObjects(world->getCollisionManager());
+
+    if (new_world) {
+        /// Replace all objects, the objects of the previous world are released after they have been unregistered
+        manager_.clear();
+        if (!candidates_.empty()) {
+            manager_.registerObjects(candidates_);
+        }
+        manager_.setup();
+        num_removed_ += objects_.size();
+        num_added_ += candidates_.size();
+        world_ = world;
+        world_version_ = version;
+    } else {
+        /// Remove the objects that left the region, add those that entered it
+        changes_.clear();
+        std::set_difference(objects_.begin(), objects_.end(), candidates_.begin(), candidates_.end(), std::back_inserter(changes_));
+        for (std::vector<fcl::CollisionObject*>::iterator it = changes_.begin(); it != changes_.end(); ++it) {
+            manager_.unregisterObject(*it);
+        }
+        num_removed_ += changes_.size();
+
+        changes_.clear();
+        std::set_difference(candidates_.begin(), candidates_.end(), objects_.begin(), objects_.end(), std::back_inserter(changes_));
+        for (std::vector<fcl::CollisionObject*>::iterator it = changes_.begin(); it != changes_.end(); ++it) {
+            manager_.registerObject(*it);
+        }
+        num_added_ += changes_.size();
+    }
+    objects_.swap(candidates_);
+
+    return &manager_;
+
+}
+
+unsigned int WorldRegion::getNrObjects() const {
+
+    return objects_.size();
+
+}
+
+void WorldRegion::getStatistics(unsigned int& num_added, unsigned int& num_removed) {
+
+    num_added = num_added_;
+    num_removed = num_removed_;
+    num_added_ = 0;
+    num_removed_ = 0;
+
+}
+
+void WorldRegion::selectObjects(fcl::BroadPhaseCollisionManager* manager) {
+
+    region_box_->side = region_.max_ - region_.min_;
+    region_box_->computeLocalAABB();
+    region_object_->setTransform(fcl::Transform3f((region_.min_ + region_.max_) * 0.5));
+    region_object_->computeAABB();
+
+    RegionQuery data;
+    data.region = region_object_.get();
+    data.objects = &candidates_;
+
+    candidates_.clear();
+    manager->collide(region_object_.get(), &data, regionCollisionFunction);
+    std::sort(candidates_.begin(), candidates_.end());
+    candidates_.erase(std::unique(candidates_.begin(), candidates_.end()), candidates_.end());
+
+}
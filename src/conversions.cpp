@@ -1,6 +1,8 @@
 #include "amigo_whole_body_controller/conversions.h"
 
 #include <fcl/BVH/BVH_model.h>
+#include <fcl/shape/geometric_shapes.h>
+#include <fcl/shape/geometric_shape_to_BVH_model.h>
 
 namespace wbc {
 
@@ -74,6 +76,38 @@ void getFclShape(const fcl::CollisionGeometry *cg, std::vector<fcl::Vec3f> &vert
         }
         break;
     }
+    case fcl::OT_GEOM: {
+        // primitives are tessellated for visualization only
+        fcl::BVHModel<fcl::OBBRSS> model;
+        switch (nodeType)
+        {
+        case fcl::GEOM_BOX:
+            fcl::generateBVHModel(model, *static_cast<const fcl::Box*>(cg), fcl::Transform3f());
+            break;
+        case fcl::GEOM_SPHERE:
+            fcl::generateBVHModel(model, *static_cast<const fcl::Sphere*>(cg), fcl::Transform3f(), 16, 16);
+            break;
+        case fcl::GEOM_CYLINDER:
+            fcl::generateBVHModel(model, *static_cast<const fcl::Cylinder*>(cg), fcl::Transform3f(), 16, 4);
+            break;
+        case fcl::GEOM_CONE:
+            fcl::generateBVHModel(model, *static_cast<const fcl::Cone*>(cg), fcl::Transform3f(), 16, 4);
+            break;
+        case fcl::GEOM_CAPSULE: {
+            // shown as a cylinder that includes the caps
+            const fcl::Capsule* capsule = static_cast<const fcl::Capsule*>(cg);
+            fcl::generateBVHModel(model, fcl::Cylinder(capsule->radius, capsule->lz + 2*capsule->radius), fcl::Transform3f(), 16, 4);
+            break;
+        }
+        default: {
+            ROS_WARN_ONCE("error converting unknown fcl node type: %i", nodeType);
+            return;
+        }
+        }
+        vertices  = std::vector<fcl::Vec3f>(   model.vertices,    model.vertices    + model.num_vertices);
+        triangles = std::vector<fcl::Triangle>(model.tri_indices, model.tri_indices + model.num_tris);
+        break;
+    }
     default:
     {
         ROS_WARN_ONCE("error converting unknown fcl object type: %i", objType);
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include "amigo_whole_body_controller/fileworldclient.h"
+#include "amigo_whole_body_controller/motionobjectives/CollisionAvoidance.h"
+
+/**
+  * Measures the latency of the environment collision query (CollisionAvoidance::environmentCollisionVWM) for scenes
+  * loaded by FileWorldClient, at random base poses of a robot of primitives, with and without distance caching and
+  * the region of interest
+  * Usage: environment_collision_benchmark <mesh> [poses] [iterations] [scene files]
+  * Without scene files, scenes of 10, 100, 1000 and 10000 boxes, cylinders and meshes (the mesh, e.g. data/cone.dae)
+  * are generated in /tmp, at a constant density such that the robot has the same surroundings in every scene.
+  * Needs a running roscore, the collision avoidance advertises its marker topics
+  */
+
+/** Exposes the environment collision query of the collision avoidance */
+class EnvironmentCollisionBenchmark : public wbc::CollisionAvoidance
+{
+public:
+    EnvironmentCollisionBenchmark(collisionAvoidanceParameters &parameters) : CollisionAvoidance(parameters, 0.02) {}
+
+    /** Runs a query, returns its duration in [s] and the number of bodies within the cutoff */
+    double query(unsigned int& num_distances)
+    {
+        calculateTransform();
+        min_distances_total_fcl_.clear();
+
+        ros::WallTime t_start = ros::WallTime::now();
+        environmentCollisionVWM(min_distances_total_fcl_);
+        double time = (ros::WallTime::now() - t_start).toSec();
+
+        num_distances = min_distances_total_fcl_.size();
+        return time;
+    }
+};
+
+/** Adds a collision body with a pose relative to the base */
+void addBody(std::vector<RobotState::CollisionBody>& group, const std::string& name, const std::string& type,
+             double x, double y, double z, const KDL::Frame& fix_pose)
+{
+    RobotState::CollisionBody body;
+    body.name_collision_body = name;
+    body.frame_id = name;
+    body.frame_handle = -1;
+    body.collision_shape.shape_type = type;
+    body.collision_shape.dimensions.x = x;
+    body.collision_shape.dimensions.y = y;
+    body.collision_shape.dimensions.z = z;
+    body.fix_pose = fix_pose;
+    group.push_back(body);
+}
+
+/** Robot of primitives resembling AMIGO: a base with a torso and head and two arms stretched forward */
+void createRobot(RobotState& robot_state)
+{
+    std::vector<RobotState::CollisionBody> torso, left_arm, right_arm;
+    addBody(torso, "base", "Box", 0.35, 0.35, 0.15, KDL::Frame(KDL::Vector(0.0, 0.0, 0.15)));
+    addBody(torso, "torso", "Box", 0.15, 0.2, 0.3, KDL::Frame(KDL::Vector(0.0, 0.0, 0.7)));
+    addBody(torso, "head", "Sphere", 0.12, 0.12, 0.12, KDL::Frame(KDL::Vector(0.05, 0.0, 1.35)));
+
+    KDL::Rotation along_x = KDL::Rotation::RotY(M_PI_2);
+    for (int side = -1; side <= 1; side += 2)
+    {
+        std::vector<RobotState::CollisionBody>& arm = (side > 0) ? left_arm : right_arm;
+        std::string prefix = (side > 0) ? "left_" : "right_";
+        double y = side * 0.25;
+        addBody(arm, prefix + "upper_arm", "CylinderZ", 0.06, 0.06, 0.15, KDL::Frame(along_x, KDL::Vector(0.2, y, 1.0)));
+        addBody(arm, prefix + "forearm", "Capsule", 0.05, 0.05, 0.12, KDL::Frame(along_x, KDL::Vector(0.5, y, 1.0)));
+        addBody(arm, prefix + "wrist", "Sphere", 0.05, 0.05, 0.05, KDL::Frame(KDL::Vector(0.68, y, 1.0)));
+        addBody(arm, prefix + "gripper", "Box", 0.08, 0.04, 0.06, KDL::Frame(KDL::Vector(0.8, y, 1.0)));
+    }
+
+    robot_state.robot_.groups.push_back(torso);
+    robot_state.robot_.groups.push_back(left_arm);
+    robot_state.robot_.groups.push_back(right_arm);
+}
+
+/** Sets the base pose of the robot, all bodies move along */
+void setBasePose(RobotState& robot_state, const KDL::Frame& base_pose)
+{
+    robot_state.amcl_pose_ = base_pose;
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robot_state.robot_.groups.begin(); itrGroups != robot_state.robot_.groups.end(); ++itrGroups)
+    {
+        for (std::vector<RobotState::CollisionBody>::iterator itrBodies = itrGroups->begin(); itrBodies != itrGroups->end(); ++itrBodies)
+        {
+            itrBodies->fk_pose = base_pose;
+        }
+    }
+}
+
+/** Side of the square in which the objects of a scene are placed: 4 m^2 per object */
+double getSceneSize(unsigned int num_objects)
+{
+    return 2.0 * std::sqrt((double)num_objects);
+}
+
+/** Writes a scene of random boxes, cylinders and meshes on the floor */
+std::string generateScene(unsigned int num_objects, const std::string& mesh)
+{
+    std::stringstream filename;
+    filename << "/tmp/environment_collision_benchmark_" << num_objects << ".scene";
+    std::ofstream file(filename.str().c_str());
+
+    double size = getSceneSize(num_objects);
+    file << "# " << num_objects << " objects in " << size << " x " << size << " m" << std::endl;
+    for (unsigned int i = 0; i < num_objects; ++i)
+    {
+        double x = size * (std::rand() / (double)RAND_MAX - 0.5);
+        double y = size * (std::rand() / (double)RAND_MAX - 0.5);
+        double yaw = 2.0 * M_PI * std::rand() / (double)RAND_MAX;
+        double a = 0.1 + 0.9 * std::rand() / (double)RAND_MAX;
+        double b = 0.1 + 0.9 * std::rand() / (double)RAND_MAX;
+        double h = 0.1 + 1.9 * std::rand() / (double)RAND_MAX;
+        switch (i % 5)
+        {
+        case 0:
+        case 1:
+            file << "box " << a << " " << b << " " << h << " " << x << " " << y << " " << h / 2 << " 0 0 " << yaw << std::endl;
+            break;
+        case 2:
+        case 3:
+            file << "cylinder " << a / 2 << " " << h << " " << x << " " << y << " " << h / 2 << std::endl;
+            break;
+        default:
+            // the mesh spans [-0.5, 0.5] in every direction
+            file << "mesh " << mesh << " " << a << " " << x << " " << y << " " << a / 2 << " 0 0 " << yaw << std::endl;
+            break;
+        }
+    }
+    return filename.str();
+}
+
+/** Prints the mean and percentiles of durations in [s] */
+void printLatencies(const std::string& name, std::vector<double>& times, unsigned int num_distances)
+{
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (unsigned int i = 0; i < times.size(); ++i)
+    {
+        sum += times[i];
+    }
+    unsigned int n = times.size();
+    std::cout << "  " << name << ": mean " << 1e6 * sum / n << " us"
+              << ", p50 " << 1e6 * times[n / 2] << " us"
+              << ", p90 " << 1e6 * times[(n * 9) / 10] << " us"
+              << ", p99 " << 1e6 * times[(n * 99) / 100] << " us"
+              << ", max " << 1e6 * times[n - 1] << " us"
+              << ", " << (double)num_distances / n << " bodies within the cutoff per query" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: environment_collision_benchmark <mesh> [poses] [iterations] [scene files]" << std::endl;
+        return 1;
+    }
+    std::string mesh = argv[1];
+    unsigned int num_poses = (argc > 2) ? atoi(argv[2]) : 100;
+    unsigned int iterations = (argc > 3) ? atoi(argv[3]) : 10;
+
+    ros::init(argc, argv, "environment_collision_benchmark", ros::init_options::AnonymousName);
+    ros::NodeHandle nh;
+
+    std::vector<std::string> scenes;
+    std::vector<double> scene_sizes;
+    std::srand(0);
+    if (argc > 4)
+    {
+        for (int i = 4; i < argc; ++i)
+        {
+            scenes.push_back(argv[i]);
+            scene_sizes.push_back(0.0);
+        }
+    }
+    else
+    {
+        for (unsigned int num_objects = 10; num_objects <= 10000; num_objects *= 10)
+        {
+            scenes.push_back(generateScene(num_objects, mesh));
+            scene_sizes.push_back(getSceneSize(num_objects));
+        }
+    }
+
+    wbc::CollisionAvoidance::collisionAvoidanceParameters ca_param;
+    ca_param.self_collision.f_max = 18.0;
+    ca_param.self_collision.f_min_percent = 5.0;
+    ca_param.self_collision.d_threshold = 0.066;
+    ca_param.self_collision.order = 2;
+    ca_param.self_collision.octomap_resolution = 0.05;
+    ca_param.self_collision.visualization_force_factor = 5.0;
+    ca_param.environment_collision = ca_param.self_collision;
+    ca_param.update_period = 0.0;
+    ca_param.first_order_hold = false;
+    ca_param.distance_backend = "fcl";
+    ca_param.cross_validation = false;
+    ca_param.cross_validation_tolerance = 0.01;
+    ca_param.analytic_distances = true;
+    ca_param.batched_distances = false;
+    ca_param.distance_threads = 0;
+    ca_param.distance_field.enabled = false;
+    ca_param.distance_field.resolution = 0.05;
+    ca_param.distance_field.size_xy = 4.0;
+    ca_param.distance_field.size_z = 2.0;
+    ca_param.region_of_interest.margin = 0.5;
+
+    for (unsigned int s = 0; s < scenes.size(); ++s)
+    {
+        wbc::FileWorldClient world_client(scenes[s]);
+        world_client.initialize();
+        if (!world_client.isLoaded())
+        {
+            return 1;
+        }
+        world_client.start();
+
+        /// Base poses within the scene, or around the origin for scene files
+        double size = (scene_sizes[s] > 0.0) ? scene_sizes[s] : 10.0;
+        std::vector<KDL::Frame> poses;
+        for (unsigned int i = 0; i < num_poses; ++i)
+        {
+            poses.push_back(KDL::Frame(KDL::Rotation::RotZ(2.0 * M_PI * std::rand() / (double)RAND_MAX),
+                                       KDL::Vector(size * (std::rand() / (double)RAND_MAX - 0.5), size * (std::rand() / (double)RAND_MAX - 0.5), 0.0)));
+        }
+
+        std::cout << scenes[s] << ": " << world_client.getNrObjects() << " objects, " << num_poses << " poses x " << iterations << " iterations" << std::endl;
+
+        for (unsigned int config = 0; config < 4; ++config)
+        {
+            ca_param.distance_caching = config % 2;
+            ca_param.region_of_interest.enabled = config / 2;
+
+            RobotState robot_state;
+            createRobot(robot_state);
+            EnvironmentCollisionBenchmark collision_avoidance(ca_param);
+            collision_avoidance.initialize(robot_state);
+            collision_avoidance.setCollisionWorld(&world_client);
+
+            /// Every pose is queried repeatedly, as a robot that stands still would be
+            std::vector<double> times;
+            unsigned int num_distances = 0;
+            for (unsigned int i = 0; i < num_poses; ++i)
+            {
+                setBasePose(robot_state, poses[i]);
+                for (unsigned int k = 0; k < iterations; ++k)
+                {
+                    unsigned int n;
+                    times.push_back(collision_avoidance.query(n));
+                    num_distances += n;
+                }
+            }
+
+            std::string name = std::string(ca_param.region_of_interest.enabled ? "region of interest" : "whole world")
+                             + (ca_param.distance_caching ? ", caching" : ", no caching");
+            printLatencies(name, times, num_distances);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include "amigo_whole_body_controller/fileworldclient.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <fcl/BVH/BVH_model.h>
+#include <fcl/shape/geometric_shapes.h>
+
+#include <kdl/frames.hpp>
+#include <ros/console.h>
+
+namespace {
+
+/** Returns the element that starts at or after pos (up to and including its >), empty if there is none */
+std::string findElement(const std::string& text, const std::string& name, std::string::size_type& pos)
+{
+    pos = text.find("<" + name, pos);
+    if (pos == std::string::npos)
+        return std::string();
+    std::string::size_type end = text.find('>', pos);
+    if (end == std::string::npos) {
+        pos = std::string::npos;
+        return std::string();
+    }
+    return text.substr(pos, end + 1 - pos);
+}
+
+/** Returns the value of an attribute of an element, empty if it does not have the attribute */
+std::string getAttribute(const std::string& element, const std::string& name)
+{
+    std::string::size_type pos = element.find(" " + name + "=\"");
+    if (pos == std::string::npos)
+        return std::string();
+    pos += name.size() + 3;
+    return element.substr(pos, element.find('"', pos) - pos);
+}
+
+/** Returns the text in between the element that starts at pos and its closing tag */
+std::string getContent(const std::string& text, const std::string& name, std::string::size_type pos)
+{
+    std::string::size_type begin = text.find('>', pos) + 1;
+    std::string::size_type end = text.find("</" + name, begin);
+    if (end == std::string::npos)
+        return std::string();
+    return text.substr(begin, end - begin);
+}
+
+/** Pose from a position and roll, pitch and yaw */
+fcl::Transform3f getTransform(double x, double y, double z, double roll, double pitch, double yaw)
+{
+    double qx, qy, qz, qw;
+    KDL::Rotation::RPY(roll, pitch, yaw).GetQuaternion(qx, qy, qz, qw);
+    return fcl::Transform3f(fcl::Quaternion3f(qw, qx, qy, qz), fcl::Vec3f(x, y, z));
+}
+
+}
+
+namespace wbc {
+
+StaticWorld::StaticWorld()
+{
+}
+
+void StaticWorld::addObject(const boost::shared_ptr<fcl::CollisionObject>& object)
+{
+    objects_.push_back(object);
+}
+
+void StaticWorld::setup()
+{
+    std::vector<fcl::CollisionObject*> objects;
+    for (std::vector< boost::shared_ptr<fcl::CollisionObject> >::iterator it = objects_.begin(); it != objects_.end(); ++it)
+    {
+        objects.push_back(it->get());
+    }
+    manager_.registerObjects(objects);
+    manager_.setup();
+}
+
+fcl::BroadPhaseCollisionManager* StaticWorld::getCollisionManager()
+{
+    return &manager_;
+}
+
+unsigned int StaticWorld::getNrObjects() const
+{
+    return objects_.size();
+}
+
+FileWorldClient::FileWorldClient(const std::string& filename) : filename_(filename)
+{
+}
+
+void FileWorldClient::initialize()
+{
+    world_.reset();
+
+    std::ifstream file(filename_.c_str());
+    if (!file.is_open()) {
+        ROS_ERROR("Could not open scene file %s", filename_.c_str());
+        return;
+    }
+
+    std::string directory;
+    std::string::size_type slash = filename_.rfind('/');
+    if (slash != std::string::npos) {
+        directory = filename_.substr(0, slash + 1);
+    }
+
+    boost::shared_ptr<StaticWorld> world(new StaticWorld);
+    world_ = world;
+
+    std::string line;
+    unsigned int line_number = 0;
+    while (std::getline(file, line))
+    {
+        ++line_number;
+        std::string::size_type begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#')
+            continue;
+
+        if (!parseObject(line, directory)) {
+            ROS_ERROR("Scene file %s, line %u: could not parse '%s'", filename_.c_str(), line_number, line.c_str());
+            world_.reset();
+            return;
+        }
+    }
+
+    world_->setup();
+    ROS_INFO("Loaded %u objects from scene file %s", world_->getNrObjects(), filename_.c_str());
+}
+
+void FileWorldClient::start()
+{
+    if (!world_) {
+        ROS_ERROR("No world loaded from %s, environment collisions are not available", filename_.c_str());
+        return;
+    }
+    publishWorld(world_);
+}
+
+bool FileWorldClient::isLoaded() const
+{
+    return world_.get() != NULL;
+}
+
+unsigned int FileWorldClient::getNrObjects() const
+{
+    return world_ ? world_->getNrObjects() : 0;
+}
+
+bool FileWorldClient::parseObject(const std::string& line, const std::string& directory)
+{
+    std::istringstream stream(line);
+    std::string type;
+    stream >> type;
+
+    boost::shared_ptr<fcl::CollisionGeometry> geometry;
+    if (type == "box") {
+        double x, y, z;
+        if (!(stream >> x >> y >> z))
+            return false;
+        geometry.reset(new fcl::Box(x, y, z));
+    } else if (type == "cylinder") {
+        double radius, length;
+        if (!(stream >> radius >> length))
+            return false;
+        geometry.reset(new fcl::Cylinder(radius, length));
+    } else if (type == "sphere") {
+        double radius;
+        if (!(stream >> radius))
+            return false;
+        geometry.reset(new fcl::Sphere(radius));
+    } else if (type == "mesh") {
+        std::string filename;
+        double scale;
+        if (!(stream >> filename >> scale))
+            return false;
+        if (filename[0] != '/')
+            filename = directory + filename;
+        geometry = getMesh(filename, scale);
+        if (!geometry)
+            return false;
+    } else {
+        ROS_ERROR("Unknown object type '%s'", type.c_str());
+        return false;
+    }
+
+    double x, y, z;
+    if (!(stream >> x >> y >> z))
+        return false;
+    double roll = 0.0, pitch = 0.0, yaw = 0.0;
+    if (stream >> roll) {
+        if (!(stream >> pitch >> yaw))
+            return false;
+    }
+
+    world_->addObject(boost::shared_ptr<fcl::CollisionObject>(new fcl::CollisionObject(geometry, getTransform(x, y, z, roll, pitch, yaw))));
+    return true;
+}
+
+boost::shared_ptr<fcl::CollisionGeometry> FileWorldClient::getMesh(const std::string& filename, double scale)
+{
+    std::pair<std::string, double> key(filename, scale);
+    std::map<std::pair<std::string, double>, boost::shared_ptr<fcl::CollisionGeometry> >::iterator it = meshes_.find(key);
+    if (it != meshes_.end())
+        return it->second;
+
+    std::vector<fcl::Vec3f> vertices;
+    std::vector<fcl::Triangle> triangles;
+    if (!loadMesh(filename, scale, vertices, triangles))
+        return boost::shared_ptr<fcl::CollisionGeometry>();
+
+    fcl::BVHModel<fcl::OBBRSS>* model = new fcl::BVHModel<fcl::OBBRSS>();
+    model->beginModel();
+    model->addSubModel(vertices, triangles);
+    model->endModel();
+    model->computeLocalAABB();
+
+    boost::shared_ptr<fcl::CollisionGeometry> mesh(model);
+    meshes_[key] = mesh;
+    return mesh;
+}
+
+bool FileWorldClient::loadMesh(const std::string& filename, double scale, std::vector<fcl::Vec3f>& vertices, std::vector<fcl::Triangle>& triangles)
+{
+    vertices.clear();
+    triangles.clear();
+
+    std::ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        ROS_ERROR("Could not open mesh %s", filename.c_str());
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+
+    bool y_up = text.find("<up_axis>Y_UP</up_axis>") != std::string::npos;
+
+    /// Every mesh has its own positions, its triangles index them
+    std::string::size_type mesh_pos = 0;
+    while (!findElement(text, "mesh", mesh_pos).empty())
+    {
+        std::string::size_type mesh_end = text.find("</mesh>", mesh_pos);
+        std::string mesh = text.substr(mesh_pos, mesh_end - mesh_pos);
+        mesh_pos = mesh_end;
+
+        /// Positions: the source of the POSITION input of the vertices
+        std::string::size_type pos = 0;
+        if (findElement(mesh, "vertices", pos).empty())
+            continue;
+        std::string position_source;
+        for (std::string input = findElement(mesh, "input", pos); !input.empty() && position_source.empty(); input = findElement(mesh, "input", ++pos))
+        {
+            if (getAttribute(input, "semantic") == "POSITION")
+                position_source = getAttribute(input, "source").substr(1);
+        }
+
+        std::vector<double> positions;
+        pos = 0;
+        for (std::string source = findElement(mesh, "source", pos); !source.empty(); source = findElement(mesh, "source", ++pos))
+        {
+            if (getAttribute(source, "id") == position_source) {
+                findElement(mesh, "float_array", pos);
+                std::istringstream values(getContent(mesh, "float_array", pos));
+                double value;
+                while (values >> value)
+                    positions.push_back(value);
+                break;
+            }
+        }
+
+        unsigned int offset = vertices.size();
+        for (unsigned int i = 0; i + 2 < positions.size(); i += 3)
+        {
+            if (y_up)
+                vertices.push_back(fcl::Vec3f(scale * positions[i], -scale * positions[i+2], scale * positions[i+1]));
+            else
+                vertices.push_back(fcl::Vec3f(scale * positions[i], scale * positions[i+1], scale * positions[i+2]));
+        }
+
+        /// Triangles: the indices of all inputs are interleaved in <p>, the VERTEX input refers to the positions
+        pos = 0;
+        for (std::string element = findElement(mesh, "triangles", pos); !element.empty(); element = findElement(mesh, "triangles", ++pos))
+        {
+            std::string::size_type triangles_end = mesh.find("</triangles>", pos);
+            std::string::size_type input_pos = pos;
+            unsigned int stride = 1, vertex_offset = 0;
+            for (std::string input = findElement(mesh, "input", input_pos); !input.empty() && input_pos < triangles_end; input = findElement(mesh, "input", ++input_pos))
+            {
+                unsigned int input_offset = std::atoi(getAttribute(input, "offset").c_str());
+                stride = std::max(stride, input_offset + 1);
+                if (getAttribute(input, "semantic") == "VERTEX")
+                    vertex_offset = input_offset;
+            }
+
+            std::string::size_type p_pos = mesh.find("<p>", pos);
+            if (p_pos == std::string::npos || p_pos > triangles_end)
+                continue;
+            std::istringstream indices(getContent(mesh, "p", p_pos));
+            std::vector<unsigned int> corners;
+            unsigned int index, k = 0;
+            while (indices >> index)
+            {
+                if (k++ % stride == vertex_offset)
+                    corners.push_back(offset + index);
+            }
+            for (unsigned int i = 0; i + 2 < corners.size(); i += 3)
+            {
+                if (corners[i] >= vertices.size() || corners[i+1] >= vertices.size() || corners[i+2] >= vertices.size()) {
+                    ROS_ERROR("Mesh %s has a triangle with an invalid vertex index", filename.c_str());
+                    return false;
+                }
+                triangles.push_back(fcl::Triangle(corners[i], corners[i+1], corners[i+2]));
+            }
+        }
+    }
+
+    if (triangles.empty()) {
+        ROS_ERROR("Mesh %s has no triangles (only <triangles> are supported)", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <cstdlib>
+
+#include <ros/time.h>
+#include <kdl_parser/kdl_parser.hpp>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "Tree.h"
+
+/**
+  * Compares the FK and Jacobian computation time of the generated kinematics with the KDL implementation
+  * Usage: kinematics_benchmark <urdf> [iterations]
+  * The URDF must be the one the kinematics have been generated from (WBC_KINEMATICS_URDF)
+  */
+
+void benchmark(Tree& tree, bool use_generated_kinematics, unsigned int iterations)
+{
+    tree.useGeneratedKinematics(use_generated_kinematics);
+
+    std::vector<KDL::Frame> poses(tree.getNrSegments());
+    std::vector<bool> updated(tree.getNrSegments());
+    Eigen::MatrixXd jacobian(6, tree.getNrJoints());
+    KDL::Frame root_pose = KDL::Frame::Identity();
+
+    double fk_time = 0, jacobian_time = 0;
+    for (unsigned int k = 0; k < iterations; ++k)
+    {
+        /// Move all joints, hence the complete tree is recomputed
+        for (unsigned int i = 0; i < tree.getNrJoints(); ++i)
+        {
+            tree.setJointPosition(i, 0.001 * (k % 1000) + 0.01 * i);
+        }
+
+        ros::WallTime t_start = ros::WallTime::now();
+        tree.calcFK(root_pose, poses, updated);
+        ros::WallTime t_fk = ros::WallTime::now();
+        for (unsigned int i = 0; i < tree.getNrSegments(); ++i)
+        {
+            tree.calcJacobian(i, poses, jacobian);
+        }
+        ros::WallTime t_jacobian = ros::WallTime::now();
+
+        fk_time += (t_fk - t_start).toSec();
+        jacobian_time += (t_jacobian - t_fk).toSec();
+    }
+
+    std::cout << (use_generated_kinematics ? "Generated" : "KDL      ")
+              << ": FK " << 1e6 * fk_time / iterations << " us"
+              << ", all " << tree.getNrSegments() << " Jacobians " << 1e6 * jacobian_time / iterations << " us" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: kinematics_benchmark <urdf> [iterations]" << std::endl;
+        return 1;
+    }
+    unsigned int iterations = (argc > 2) ? atoi(argv[2]) : 10000;
+
+    boost::scoped_ptr<GeneratedKinematics> kinematics(createGeneratedKinematics());
+    if (!kinematics)
+    {
+        std::cout << "No kinematics have been generated, configure with -DWBC_KINEMATICS_URDF=<urdf>" << std::endl;
+        return 1;
+    }
+
+    Tree tree;
+    if (!kdl_parser::treeFromFile(argv[1], tree.kdl_tree_))
+    {
+        std::cout << "Could not parse " << argv[1] << std::endl;
+        return 1;
+    }
+
+    /// Use the joint order of the generated kinematics, this is the order ChainParser would create
+    std::map<std::string, unsigned int> joint_name_to_index, joint_name_to_index_tree;
+    for (unsigned int i = 0; i < kinematics->getNrJoints(); ++i)
+    {
+        joint_name_to_index[kinematics->getJointName(i)] = i;
+    }
+    tree.getJointNames(joint_name_to_index, joint_name_to_index_tree);
+    tree.getTreeJointIndex(tree.kdl_tree_, tree.tree_joint_index_);
+    tree.initializeSegments();
+
+    if (!tree.hasGeneratedKinematics())
+    {
+        std::cout << "The generated kinematics do not match " << argv[1] << std::endl;
+        return 1;
+    }
+
+    benchmark(tree, false, iterations);
+    benchmark(tree, true, iterations);
+
+    return 0;
+}
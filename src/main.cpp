@@ -1,4 +1,5 @@
 #include <amigo_whole_body_controller/wbc_node.h>
+#include <amigo_whole_body_controller/fileworldclient.h>
 
 int main(int argc, char **argv) {
 
@@ -8,6 +9,12 @@ int main(int argc, char **argv) {
     ros::Rate loop_rate(50);
     wbc::WholeBodyControllerNode wbc_node(loop_rate);
 
+    // Static world from a scene file instead of a world model, e.g. for offline testing
+    std::string world_file;
+    if (ros::NodeHandle("~").getParam("world_file", world_file)) {
+        wbc_node.setCollisionWorld(new wbc::FileWorldClient(world_file));
+    }
+
     StatsPublisher sp;
     sp.initialize();
 
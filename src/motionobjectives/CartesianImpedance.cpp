@@ -4,7 +4,7 @@
 #include <ros/node_handle.h>
 
 CartesianImpedance::CartesianImpedance(const std::string& tip_frame, const double Ts, tf::TransformListener *listener)
-    : listener_(listener)
+    : listener_(listener), tip_frame_handle_(-1), root_frame_handle_(-1)
 {
 
     type_      = "CartesianImpedance";
@@ -38,6 +38,41 @@ CartesianImpedance::CartesianImpedance(const std::string& tip_frame, const doubl
 
     vis_pub = n.advertise<visualization_msgs::Marker>("cartesian_impedance", 0);
 
+    /// Construct the markers once, apply only updates the poses
+    marker_.header.frame_id = "map";
+    marker_.ns = tip_frame_;
+    marker_.id = 0;
+    marker_.lifetime = ros::Duration(0.1);
+    marker_.action = visualization_msgs::Marker::ADD;
+    marker_.type = visualization_msgs::Marker::SPHERE;
+
+    marker_.color.a = 1.0;
+    if (tip_frame_ == "grippoint_right") {
+        marker_.color.r = 1.0;
+        marker_.color.g = 0.0;
+        marker_.color.b = 0.0;
+    } else if (tip_frame_ == "grippoint_left") {
+        marker_.color.r = 0.0;
+        marker_.color.g = 0.0;
+        marker_.color.b = 1.0;
+    } else {
+        marker_.color.r = 0.0;
+        marker_.color.g = 1.0;
+        marker_.color.b = 0.0;
+    }
+
+    marker_arrow_.header.frame_id = "map";
+    marker_arrow_.ns = tip_frame_ + "_arrow";
+    marker_arrow_.id = 0;
+    marker_arrow_.lifetime = ros::Duration(0.1);
+    marker_arrow_.action = visualization_msgs::Marker::ADD;
+    marker_arrow_.type = visualization_msgs::Marker::ARROW;
+    marker_arrow_.color = marker_.color;
+    marker_arrow_.color.a = 0.7;
+    marker_arrow_.scale.x = 0.02;
+    marker_arrow_.scale.y = 0.05;
+    marker_arrow_.points.resize(2);
+
     /// Initialize tracer
     std::vector<std::string> column_names;
     column_names.push_back("rx");
@@ -79,19 +114,22 @@ CartesianImpedance::CartesianImpedance(const std::string& tip_frame, const doubl
 
 void CartesianImpedance::setVelocity(RobotState &robotstate){
 
-    /// Find the pose of the goal frame
-    robotstate.collectFKSolutions();
+    /// The root frame may have changed with the new goal
+    if (!resolveFrames(robotstate)) {
+        return;
+    }
 
-    /// Get end effector pose (is in map frame)
-    KDL::Frame frame_map_tip;
-    assert(lookupTransform(robotstate, tip_frame_, frame_map_tip));
+    /// Get end effector pose (is in map frame), only the chain to the tip is computed
+    KDL::Frame frame_map_tip = robotstate.calcFK(tip_frame_handle_);
 
     /// Include tip offset
     frame_map_tip =  frame_map_tip * frame_tip_offset;
 
     /// Get the pose of the root frame (of the goal) in map
     KDL::Frame frame_map_root;
-    assert(lookupTransform(robotstate, root_frame_, frame_map_root));
+    if (!lookupCurrentTransform(robotstate, root_frame_handle_, root_frame_, frame_map_root)) {
+        return;
+    }
 
     /// Convert end-effector pose to root
     KDL::Frame frame_root_tip = frame_map_root.Inverse() * frame_map_tip;
@@ -115,23 +153,21 @@ void CartesianImpedance::setVelocity(RobotState &robotstate){
 
 bool CartesianImpedance::initialize(RobotState &robotstate) {
 
-    /// Find the pose of the goal frame
-    robotstate.collectFKSolutions();
-
-    /// Get end effector pose (is in map frame)
-    KDL::Frame frame_map_tip;
-    if (!lookupTransform(robotstate, tip_frame_, frame_map_tip)) {
-        ROS_ERROR("rejecting CartesianImpedance because the tip_frame_ '%s' can not be found", tip_frame_.c_str());
+    /// Resolve the frames once, unknown frames are rejected here
+    if (!resolveFrames(robotstate)) {
         return false;
     }
 
+    /// Get end effector pose (is in map frame), only the chain to the tip is computed
+    KDL::Frame frame_map_tip = robotstate.calcFK(tip_frame_handle_);
+
     /// Include tip offset
     frame_map_tip =  frame_map_tip * frame_tip_offset;
     frame_map_ee_previous_ = frame_map_tip;
 
     /// Get the pose of the root frame (of the goal) in map
     KDL::Frame frame_map_root;
-    if (!lookupTransform(robotstate, root_frame_, frame_map_root)) {
+    if (!lookupCurrentTransform(robotstate, root_frame_handle_, root_frame_, frame_map_root)) {
         ROS_ERROR("rejecting CartesianImpedance because the root_frame_ '%s' can not be found", root_frame_.c_str());
         return false;
     }
@@ -157,8 +193,12 @@ bool CartesianImpedance::initialize(RobotState &robotstate) {
     jacobian_.setZero();
     jacobian_pre_alloc_.resize(6,number_joints);
     jacobian_pre_alloc_.setZero();
+    partial_jacobian_.resize(6,number_joints);
+    partial_jacobian_.setZero();
     wrenches_pre_alloc_.resize(6);
     wrenches_pre_alloc_.setZero();
+    F_task_.resize(6);
+    F_task_.setZero();
     torques_.resize(number_joints);
     torques_.setZero();
 
@@ -273,8 +313,7 @@ void CartesianImpedance::apply(RobotState &robotstate) {
     torques_.setZero();
 
     /// Get end effector pose (this is in map frame)
-    KDL::Frame frame_map_tip;
-    assert(lookupTransform(robotstate, tip_frame_, frame_map_tip));
+    const KDL::Frame& frame_map_tip = robotstate.getFK(tip_frame_handle_);
     //std::cout << "Frame tip in map: x = " << frame_map_tip.p.x() << ", y = " << frame_map_tip.p.y() << ", z = " << frame_map_tip.p.z() << std::endl;
 
     /// Include tip offset
@@ -283,7 +322,7 @@ void CartesianImpedance::apply(RobotState &robotstate) {
 
     /// Get the pose of the root frame (of the goal) in map
     KDL::Frame frame_map_root;
-    assert(lookupTransform(robotstate, root_frame_, frame_map_root));
+    lookupTransform(robotstate, root_frame_handle_, root_frame_, frame_map_root);
     //double r, p, y;frame_map_root.M.GetRPY(r,p,y);
     //std::cout << "Frame root in map: x = " << frame_map_root.p.x() << ", y = " << frame_map_root.p.y() << ", z = " << frame_map_root.p.z() <<
     //             ", roll = " << r << ", pitch = " << p << ", yaw = " << y << std::endl;
@@ -321,34 +360,18 @@ void CartesianImpedance::apply(RobotState &robotstate) {
     /// Compute the corresponding forces
     // ToDo: is this correct??? K_ is typically represented in a different frame!
     // Should K_ be in map, root, end-effector frame or should we switch back to a 1 DoF force representation?
-    Eigen::VectorXd F_task(6);
-    F_task(0) = K_(0,0) * ref_map_error.vel.x() - D_(0,0) * ee_vel_map.vel.x();
-    F_task(1) = K_(1,1) * ref_map_error.vel.y() - D_(1,1) * ee_vel_map.vel.y();
-    F_task(2) = K_(2,2) * ref_map_error.vel.z() - D_(2,2) * ee_vel_map.vel.z();
-    F_task(3) = K_(3,3) * ref_map_error.rot.x() - D_(3,3) * ee_vel_map.rot.x();
-    F_task(4) = K_(4,4) * ref_map_error.rot.y() - D_(4,4) * ee_vel_map.rot.x();
-    F_task(5) = K_(5,5) * ref_map_error.rot.z() - D_(5,5) * ee_vel_map.rot.x();
-    //std::cout << "F in map frame: x = " << F_task(0) << ", y = " << F_task(1) << ", z = " << F_task(2) << std::endl;
-
-    /// Compute 6xn Jacobian (this is w.r.t.root frame of the kinematic tree, so in this case: base_link)
-    Eigen::MatrixXd temp_jacobian(6,robotstate.getNrJoints());// ToDo: get rid of this
-    KDL::Jacobian partial_jacobian(robotstate.getNrJoints());
-    robotstate.tree_.calcPartialJacobian(tip_frame_, temp_jacobian);
-    //ROS_INFO("Tip frame = %s", tip_frame_.c_str());
-    partial_jacobian.data = temp_jacobian;
-    //for (unsigned int i = 0; i < robotstate.getNrJoints(); i++) std::cout << "Jacobian (1," << i+1 << ") = " << temp_jacobian(0,i) << std::endl;
-
-    /// Change reference point: the force does not always act at the end of a certain link
-    KDL::Twist tip_offset_map = KDL::diff(frame_map_tip, frame_map_ee);
-    partial_jacobian.changeRefPoint(KDL::Vector(tip_offset_map.vel.x(), tip_offset_map.vel.y(), tip_offset_map.vel.z()));
-    //for (unsigned int i = 0; i < robotstate.getNrJoints(); i++) std::cout << "Jacobian (1," << i+1 << ") = " << partial_jacobian.data(0,i) << std::endl;
-
-    /// Change base: the Jacobian is computed w.r.t. base_link instead of map, while the force is expressed in map
-    KDL::Frame BaseFrame_in_map;
-    assert(lookupTransform(robotstate, "base_link", BaseFrame_in_map)); //ToDo: don't hardcode???
-
-    partial_jacobian.changeBase(BaseFrame_in_map.M);
-    //for (unsigned int i = 0; i < robotstate.getNrJoints(); i++) std::cout << "Jacobian (3," << i+1 << ") = " << partial_jacobian.data(2,i) << std::endl;
+    F_task_(0) = K_(0,0) * ref_map_error.vel.x() - D_(0,0) * ee_vel_map.vel.x();
+    F_task_(1) = K_(1,1) * ref_map_error.vel.y() - D_(1,1) * ee_vel_map.vel.y();
+    F_task_(2) = K_(2,2) * ref_map_error.vel.z() - D_(2,2) * ee_vel_map.vel.z();
+    F_task_(3) = K_(3,3) * ref_map_error.rot.x() - D_(3,3) * ee_vel_map.rot.x();
+    F_task_(4) = K_(4,4) * ref_map_error.rot.y() - D_(4,4) * ee_vel_map.rot.x();
+    F_task_(5) = K_(5,5) * ref_map_error.rot.z() - D_(5,5) * ee_vel_map.rot.x();
+    //std::cout << "F in map frame: x = " << F_task_(0) << ", y = " << F_task_(1) << ", z = " << F_task_(2) << std::endl;
+
+    /// Compute 6xn Jacobian in map frame
+    /// The reference point is the end-effector: the force does not always act at the end of a certain link
+    robotstate.getPointJacobian(tip_frame_handle_, frame_map_ee.p, partial_jacobian_);
+    //for (unsigned int i = 0; i < robotstate.getNrJoints(); i++) std::cout << "Jacobian (1," << i+1 << ") = " << partial_jacobian_(0,i) << std::endl;
 
     /// Copy the desired rows in one matrix
     unsigned int row_index = 0;
@@ -359,26 +382,26 @@ void CartesianImpedance::apply(RobotState &robotstate) {
     /// 1: Translations and rotations
     for (unsigned int i = 0; i < 6; i++) {
         if (K_(i,i) > 0.0) {
-            jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = partial_jacobian.data.block(i, 0, 1, robotstate.getNrJoints());
-            wrenches_pre_alloc_(row_index) = F_task(i);
+            jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = partial_jacobian_.block(i, 0, 1, robotstate.getNrJoints());
+            wrenches_pre_alloc_(row_index) = F_task_(i);
             ++row_index;
         }
     }
 /*
     /// 2: In case of translations: only one DoF needs to be constrained
     if (K_(0,0) > 0.0 || K_(1,1) > 0.0 || K_(2,2) > 0.0) {
-        double amplitude = sqrt( F_task(0)*F_task(0) + F_task(1)*F_task(1) + F_task(2)*F_task(2) );
-        Eigen::Vector3d force_direction(F_task(0)/amplitude, F_task(1)/amplitude, F_task(2)/amplitude);
-        jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian.data.block(0, 0, 3, robotstate.getNrJoints());
+        double amplitude = sqrt( F_task_(0)*F_task_(0) + F_task_(1)*F_task_(1) + F_task_(2)*F_task_(2) );
+        Eigen::Vector3d force_direction(F_task_(0)/amplitude, F_task_(1)/amplitude, F_task_(2)/amplitude);
+        jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian_.block(0, 0, 3, robotstate.getNrJoints());
         wrenches_pre_alloc_(row_index) = amplitude;
         //std::cout << "Jacobian force row = " << jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) << std::endl;
         ++row_index;
     }
     /// Rotations
     if (K_(3,3) > 0.0 || K_(4,4) > 0.0 || K_(5,5) > 0.0) {
-        double amplitude = sqrt( F_task(3)*F_task(3) + F_task(4)*F_task(4) + F_task(5)*F_task(5) );
-        Eigen::Vector3d force_direction(F_task(3)/amplitude, F_task(4)/amplitude, F_task(5)/amplitude);
-        jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian.data.block(3, 0, 3, robotstate.getNrJoints());
+        double amplitude = sqrt( F_task_(3)*F_task_(3) + F_task_(4)*F_task_(4) + F_task_(5)*F_task_(5) );
+        Eigen::Vector3d force_direction(F_task_(3)/amplitude, F_task_(4)/amplitude, F_task_(5)/amplitude);
+        jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian_.block(3, 0, 3, robotstate.getNrJoints());
         wrenches_pre_alloc_(row_index) = amplitude;
         //std::cout << "Jacobian force row = " << jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) << std::endl;
         ++row_index;
@@ -386,23 +409,21 @@ void CartesianImpedance::apply(RobotState &robotstate) {
 */
 /*
     /// 3: Combine all DoFs
-    double amplitude = sqrt( F_task(0)*F_task(0) + F_task(1)*F_task(1) + F_task(2)*F_task(2) + F_task(3)*F_task(3) + F_task(4)*F_task(4) + F_task(5)*F_task(5) );
+    double amplitude = sqrt( F_task_(0)*F_task_(0) + F_task_(1)*F_task_(1) + F_task_(2)*F_task_(2) + F_task_(3)*F_task_(3) + F_task_(4)*F_task_(4) + F_task_(5)*F_task_(5) );
     Eigen::VectorXd force_direction(6);
-    for (unsigned int i = 0;i < 6; i++) force_direction(i) = F_task(i)/amplitude;
-    jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian.data.block(0, 0, 6, robotstate.getNrJoints());
+    for (unsigned int i = 0;i < 6; i++) force_direction(i) = F_task_(i)/amplitude;
+    jacobian_pre_alloc_.block(row_index, 0, 1, robotstate.getNrJoints()) = force_direction.transpose() * partial_jacobian_.block(0, 0, 6, robotstate.getNrJoints());
     wrenches_pre_alloc_(row_index) = amplitude;
     ++row_index;
 */
-    /// Extract total Jacobian and vector with wrenches
+    /// Extract total Jacobian (only reallocates if the number of constrained DoFs changes)
     jacobian_ = jacobian_pre_alloc_.block(0, 0, row_index, robotstate.getNrJoints());
-    Eigen::VectorXd wrenches = wrenches_pre_alloc_.block(0, 0, row_index, 1);
-    //std::cout << "Wrenches: \n" << wrenches_new_ << std::endl;
 
     /// Multiply to get torques
-    torques_ = jacobian_.transpose() * wrenches;
+    torques_.noalias() = jacobian_.transpose() * wrenches_pre_alloc_.head(row_index);
 
     /// Compute costs
-    cost_ = F_task.norm();
+    cost_ = F_task_.norm();
     //std::cout << "Torque due to Cartesian impedance = " << torques_ << std::endl;
 
     /// Log data when active
@@ -412,7 +433,7 @@ void CartesianImpedance::apply(RobotState &robotstate) {
         //tracer_.collectTracing(7,  frame_root_tip);
         tracer_.collectTracing(7,  frame_root_tip * frame_tip_offset.Inverse());
         tracer_.collectTracing(13, ref_root_error);
-        tracer_.collectTracing(19, F_task);
+        tracer_.collectTracing(19, F_task_);
     }
 
     if (convergedConstraints() >= num_constrained_dofs_ && status_ == 2) {
@@ -425,65 +446,26 @@ void CartesianImpedance::apply(RobotState &robotstate) {
 	/// Set the tip velocity
     frame_root_tip_previous_ = frame_root_tip;
 
-    /// visualize the goal constraint
-    visualization_msgs::Marker marker;
-    marker.header.frame_id = "map";
-    marker.header.stamp = ros::Time();
-    marker.ns = tip_frame_;
-    marker.id = 0;
-    marker.lifetime = ros::Duration(0.1);
-    marker.action = visualization_msgs::Marker::ADD;
-
-    switch (constraint_type_) {
-    case arm_navigation_msgs::Shape::SPHERE:
-        marker.type = visualization_msgs::Marker::SPHERE;
-        marker.scale.x = sphere_tolerance_;
-        marker.scale.y = sphere_tolerance_;
-        marker.scale.z = sphere_tolerance_;
-        break;
-    default:
-        ROS_ERROR_ONCE("unknown constraint shape %ui", constraint_type_);
-    }
+    /// Visualize the goal constraint and an arrow from tip to goal
+    /// The markers are only filled and published if someone listens, publishing allocates memory
+    if (vis_pub.getNumSubscribers() > 0) {
+        switch (constraint_type_) {
+        case arm_navigation_msgs::Shape::SPHERE:
+            marker_.scale.x = sphere_tolerance_;
+            marker_.scale.y = sphere_tolerance_;
+            marker_.scale.z = sphere_tolerance_;
+            break;
+        default:
+            ROS_ERROR_ONCE("unknown constraint shape %ui", constraint_type_);
+        }
 
-    tf::poseKDLToMsg(frame_map_goal, marker.pose);
+        tf::poseKDLToMsg(frame_map_goal, marker_.pose);
+        tf::pointKDLToMsg(frame_map_ee.p,   marker_arrow_.points[0]);
+        tf::pointKDLToMsg(frame_map_goal.p, marker_arrow_.points[1]);
 
-    marker.color.a = 1.0;
-    if (tip_frame_ == "grippoint_right") {
-        marker.color.r = 1.0;
-        marker.color.g = 0.0;
-        marker.color.b = 0.0;
-    } else if (tip_frame_ == "grippoint_left") {
-        marker.color.r = 0.0;
-        marker.color.g = 0.0;
-        marker.color.b = 1.0;
-    } else {
-        marker.color.r = 0.0;
-        marker.color.g = 1.0;
-        marker.color.b = 0.0;
+        vis_pub.publish(marker_);
+        vis_pub.publish(marker_arrow_);
     }
-
-    /// visualize an arrow from tip to goal
-
-    visualization_msgs::Marker marker_arrow;
-    marker_arrow.header.frame_id = "map";
-    marker_arrow.header.stamp = ros::Time();
-    marker_arrow.ns = tip_frame_ + "_arrow";
-    marker_arrow.id = 0;
-    marker_arrow.lifetime = ros::Duration(0.1);
-    marker_arrow.action = visualization_msgs::Marker::ADD;
-
-    marker_arrow.type = visualization_msgs::Marker::ARROW;
-    marker_arrow.color = marker.color;
-    marker_arrow.color.a = 0.7;
-    marker_arrow.scale.x = 0.02;
-    marker_arrow.scale.y = 0.05;
-
-    marker_arrow.points.resize(2);
-    tf::pointKDLToMsg(frame_map_ee.p,   marker_arrow.points[0]);
-    tf::pointKDLToMsg(frame_map_goal.p, marker_arrow.points[1]);
-
-    vis_pub.publish(marker);
-    vis_pub.publish(marker_arrow);
 }
 
 KDL::Twist CartesianImpedance::getError() {
@@ -578,13 +560,36 @@ void CartesianImpedance::refGeneration(KDL::Frame& goal, KDL::Frame& ref)
 
 }
 
-bool CartesianImpedance::lookupTransform(const RobotState &robotstate, const std::string &in_frame, KDL::Frame &out_frame)
+bool CartesianImpedance::resolveFrames(const RobotState &robotstate)
 {
-    std::map<std::string, KDL::Frame>::const_iterator it = robotstate.fk_poses_.find(in_frame);
+    /// The tip frame must be part of the tree, otherwise no Jacobian can be computed
+    tip_frame_handle_ = robotstate.getFrameHandle(tip_frame_);
+    if (tip_frame_handle_ < 0) {
+        ROS_ERROR("rejecting CartesianImpedance because the tip_frame_ '%s' can not be found", tip_frame_.c_str());
+        return false;
+    }
 
-    /// first try if we already have this transform in the fk_poses_
-    if (it != robotstate.fk_poses_.end()) {
-        out_frame = it->second;
+    /// The root frame may also be a tf frame outside of the tree
+    root_frame_handle_ = robotstate.getFrameHandle(root_frame_);
+
+    return true;
+}
+
+bool CartesianImpedance::lookupCurrentTransform(const RobotState &robotstate, int frame_handle, const std::string &in_frame, KDL::Frame &out_frame)
+{
+    /// Frames in the tree are computed from the latest joint positions, same as the tip
+    if (frame_handle >= 0) {
+        out_frame = robotstate.calcFK(frame_handle);
+        return true;
+    }
+    return lookupTransform(robotstate, frame_handle, in_frame, out_frame);
+}
+
+bool CartesianImpedance::lookupTransform(const RobotState &robotstate, int frame_handle, const std::string &in_frame, KDL::Frame &out_frame)
+{
+    /// first try if we already have this transform in the FK solution
+    if (frame_handle >= 0) {
+        out_frame = robotstate.getFK(frame_handle);
     } else { /// if that doesn't work, fallback on tf
         // create a identity transform in the input frame
         tf::Stamped<tf::Pose> pose_in(tf::Pose::getIdentity(), ros::Time(0), in_frame);
@@ -1,5 +1,13 @@
 #include "amigo_whole_body_controller/motionobjectives/CollisionAvoidance.h"
 
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+
+// Eigen
+#include <Eigen/Geometry>
+
 #include <visualization_msgs/MarkerArray.h>
 #include "amigo_whole_body_controller/conversions.h"
 
@@ -34,6 +42,13 @@ struct DistanceData
   {
     done = false;
     verbose = false;
+    analytic = false;
+    cache = NULL;
+    body_results = NULL;
+    pair_results = NULL;
+    batch = NULL;
+    batch_objects = NULL;
+    cutoff = 0.0;
   }
 
   /// @brief Distance request
@@ -42,29 +57,178 @@ struct DistanceData
   /// @brief Distance result
   fcl::DistanceResult result;
 
-  /// @brief Store the robot state for collision group
-  RobotState *robotState;
+  /// @brief Self-collision pairs that are skipped
+  const AllowedCollisionMatrix *allowed_collisions;
 
   /// @brief Whether the distance iteration can stop
   bool done;
 
   bool verbose;
 
+  /// @brief Compute the distance between two primitives with ShapeDistance instead of fcl
+  bool analytic;
+
+  /// @brief Last distances of the pairs, NULL if not cached
+  DistanceCache *cache;
+
+  /// @brief Minimum distance of every body in a pairwise self-collision pass, indexed by CollisionGeometryData::id
+  std::vector<fcl::DistanceResult> *body_results;
+
+  /// @brief Self-collision pairs of a single body within the cutoff (parallel queries)
+  std::vector<fcl::DistanceResult> *pair_results;
+
+  /// @brief Pairs further apart than this are not reported in a pairwise pass or a parallel query
+  double cutoff;
+
+  /// @brief Self-collision pairs of primitives are collected here and computed together afterwards, NULL computes them right away
+  ShapeDistanceBatch *batch;
+  std::vector<std::pair<fcl::CollisionObject*, fcl::CollisionObject*> > *batch_objects;
+
 };
 
+#ifdef USE_FCL
+/// @brief Pose of an fcl object (in map frame)
+void getPose(const fcl::CollisionObject* object, Eigen::Matrix3d& rotation, Eigen::Vector3d& position)
+{
+    const fcl::Matrix3f& R = object->getRotation();
+    const fcl::Vec3f& t = object->getTranslation();
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        for (unsigned int j = 0; j < 3; ++j)
+            rotation(i, j) = R(i, j);
+        position(i) = t[i];
+    }
+}
+
+/// @brief Describes an fcl primitive as a ConvexShape, returns false for meshes and other geometries
+bool getConvexShape(const fcl::CollisionObject* object, ConvexShape& shape)
+{
+    const fcl::CollisionGeometry* geometry = object->getCollisionGeometry();
+    if (geometry->getObjectType() != fcl::OT_GEOM)
+        return false;
+
+    switch (geometry->getNodeType())
+    {
+    case fcl::GEOM_BOX: {
+        const fcl::Box* box = static_cast<const fcl::Box*>(geometry);
+        shape.type = ConvexShape::BOX;
+        shape.dimensions << box->side[0]/2, box->side[1]/2, box->side[2]/2;
+        break;
+    }
+    case fcl::GEOM_SPHERE: {
+        const fcl::Sphere* sphere = static_cast<const fcl::Sphere*>(geometry);
+        shape.type = ConvexShape::SPHERE;
+        shape.dimensions << sphere->radius, sphere->radius, 0;
+        break;
+    }
+    case fcl::GEOM_CAPSULE: {
+        const fcl::Capsule* capsule = static_cast<const fcl::Capsule*>(geometry);
+        shape.type = ConvexShape::CAPSULE;
+        shape.dimensions << capsule->radius, capsule->radius, capsule->lz/2;
+        break;
+    }
+    case fcl::GEOM_CYLINDER: {
+        const fcl::Cylinder* cylinder = static_cast<const fcl::Cylinder*>(geometry);
+        shape.type = ConvexShape::CYLINDER;
+        shape.dimensions << cylinder->radius, cylinder->radius, cylinder->lz/2;
+        break;
+    }
+    case fcl::GEOM_CONE: {
+        const fcl::Cone* cone = static_cast<const fcl::Cone*>(geometry);
+        shape.type = ConvexShape::CONE;
+        shape.dimensions << cone->radius, cone->radius, cone->lz/2;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    getPose(object, shape.rotation, shape.position);
+    return true;
+}
+
+/// @brief Distance between two objects, computed by ShapeDistance if both are primitives, the nearest points are in world
+void computeDistance(const fcl::CollisionObject* o1, const fcl::CollisionObject* o2, const DistanceData& cdata, fcl::DistanceResult& result)
+{
+    ConvexShape shape1, shape2;
+    if (cdata.analytic && getConvexShape(o1, shape1) && getConvexShape(o2, shape2)) {
+        Eigen::Vector3d p1, p2;
+        double distance = ShapeDistance::compute(shape1, shape2, p1, p2);
+        result.update(distance, o1->getCollisionGeometry(), o2->getCollisionGeometry(), fcl::DistanceResult::NONE, fcl::DistanceResult::NONE,
+                      fcl::Vec3f(p1.x(), p1.y(), p1.z()), fcl::Vec3f(p2.x(), p2.y(), p2.z()));
+    } else {
+        fcl::distance(o1, o2, cdata.request, result);
+    }
+}
+
+/// @brief Adds a pair to the batch of cdata if both objects are primitives, returns false if it has to be computed right away
+bool addToBatch(fcl::CollisionObject* o1, fcl::CollisionObject* o2, DistanceData& cdata)
+{
+    ConvexShape shape1, shape2;
+    if (!cdata.batch || !cdata.analytic || !getConvexShape(o1, shape1) || !getConvexShape(o2, shape2))
+        return false;
+
+    cdata.batch->add(shape1, shape2);
+    cdata.batch_objects->push_back(std::make_pair(o1, o2));
+    return true;
+}
+
+/// @brief Result of pair i of the computed batch of cdata, as computeDistance would update it, and the ids of its bodies.
+/// Stores the distance in the cache, as the distance functions do for the pairs that are computed right away
+void getBatchResult(const DistanceData& cdata, unsigned int i, fcl::DistanceResult& result, unsigned int& id_a, unsigned int& id_b)
+{
+    const fcl::CollisionGeometry* geometry_a = (*cdata.batch_objects)[i].first->getCollisionGeometry();
+    const fcl::CollisionGeometry* geometry_b = (*cdata.batch_objects)[i].second->getCollisionGeometry();
+    const CollisionGeometryData* cgd_a = static_cast<const CollisionGeometryData*>(geometry_a->getUserData());
+    const CollisionGeometryData* cgd_b = static_cast<const CollisionGeometryData*>(geometry_b->getUserData());
+    id_a = cgd_a->id;
+    id_b = cgd_b->id;
+
+    Eigen::Vector3d p1, p2;
+    double distance = cdata.batch->getDistance(i, p1, p2);
+    result.update(distance, geometry_a, geometry_b, fcl::DistanceResult::NONE, fcl::DistanceResult::NONE,
+                  fcl::Vec3f(p1.x(), p1.y(), p1.z()), fcl::Vec3f(p2.x(), p2.y(), p2.z()));
+
+    if (cdata.cache) {
+        cdata.cache->setSelfPair(id_a, id_b, result.min_distance);
+    }
+    if (distance <= 0) {
+        ROS_WARN_THROTTLE(1, "\ttouch between %s and %s", cgd_a->ptr.link->frame_id.c_str(), cgd_b->ptr.link->frame_id.c_str());
+    }
+}
+#endif
+
 CollisionAvoidance::CollisionAvoidance(collisionAvoidanceParameters &parameters, const double Ts)
-    : ca_param_(parameters), Ts_ (Ts), world_client_(NULL), octomap_(NULL)
+    : ca_param_(parameters), Ts_ (Ts), backend_(FCL), world_client_(NULL)
 {
     /// Status is always 2 (always active)
     type_     = "CollisionAvoidance";
     status_   = 2;
     priority_ = 1;
     cost_     = 0.0;
+
+    traced_link_ = "grippoint_right";
+
+    num_rows_ = 0;
+
+    timer_name_apply_                 = "CollisionAvoidance::apply";
+    timer_name_self_collision_        = "CollisionAvoidance::selfCollision";
+    timer_name_self_collision_fast_   = "CollisionAvoidance::selfCollisionFast";
+    timer_name_environment_collision_ = "CollisionAvoidance::environmentCollisionVWM";
+    timer_name_environment_field_     = "CollisionAvoidance::environmentCollisionField";
+    timer_name_repulsive_force_       = "CollisionAvoidance::calculateRepulsiveForce";
+    timer_name_wrenches_              = "CollisionAvoidance::calculateWrenches";
+    timer_name_visualize_             = "CollisionAvoidance::visualize";
+
+#ifdef USE_FCL
+    environment_manager_ = NULL;
+#endif
+
+    setUpdatePeriod(ca_param_.update_period, ca_param_.first_order_hold);
 }
 
 CollisionAvoidance::~CollisionAvoidance()
 {
-    delete octomap_;
     delete depthSolver;
     delete simplexSolver;
 }
@@ -76,6 +240,16 @@ bool CollisionAvoidance::initialize(RobotState &robotstate)
     ROS_INFO_STREAM("Initializing Obstacle Avoidance, ");
     ROS_INFO_STREAM("using fcl version " << FCL_VERSION);
 
+    if (ca_param_.distance_backend == "fcl") {
+        backend_ = FCL;
+    } else if (ca_param_.distance_backend == "bullet") {
+        backend_ = BULLET;
+    } else {
+        ROS_ERROR("Unknown collision distance backend '%s', choose fcl or bullet", ca_param_.distance_backend.c_str());
+        return false;
+    }
+    ROS_INFO_STREAM("Self-collision distances computed by " << ca_param_.distance_backend << (ca_param_.cross_validation ? ", cross validating with both backends" : ""));
+
     // Get node handle
     ros::NodeHandle n("~");
 
@@ -87,25 +261,47 @@ bool CollisionAvoidance::initialize(RobotState &robotstate)
     pub_bbx_marker_        = n.advertise<visualization_msgs::MarkerArray>("bbx_markers/",                  10);
 
     // Initialize OctoMap
-    octomap_ = new octomap::OcTreeStamped(ca_param_.environment_collision.octomap_resolution);
+    octomap_.reset(new OctreeType(ca_param_.environment_collision.octomap_resolution));
 
     // Initialize a frame that indicates no fix is required from a FK pose to the collision shape
     no_fix_.Identity();
 
     initializeCollisionModel(robotstate);
 
+    // Initialize the signed distance field of the octomap, distances are clamped beyond the environment cutoff
+    if (ca_param_.distance_field.enabled) {
+        initializeDistanceField(robotstate);
+        double cutoff = ca_param_.environment_collision.d_threshold * ca_param_.environment_collision.visualization_force_factor;
+        environment_field_.initialize(ca_param_.distance_field.resolution,
+                                      Eigen::Vector3d(ca_param_.distance_field.size_xy, ca_param_.distance_field.size_xy, ca_param_.distance_field.size_z),
+                                      cutoff + ca_param_.distance_field.resolution);
+        ROS_INFO("Environment distance field of %.1f x %.1f x %.1f m with a resolution of %.3f m", ca_param_.distance_field.size_xy,
+                 ca_param_.distance_field.size_xy, ca_param_.distance_field.size_z, ca_param_.distance_field.resolution);
+    }
+
+#ifdef USE_FCL
+    // Initialize the region of the world within reach of the robot
+    world_region_.initialize(ca_param_.region_of_interest.margin);
+#endif
+
     // Initialize solver for distance calculation
     depthSolver = new btMinkowskiPenetrationDepthSolver;
     simplexSolver = new btVoronoiSimplexSolver;
 
     /// Initialize vector and matrix objects
+    /// Every body gets at most one repulsive force per source of distances: self-collision, the world model and the distance field
     unsigned int number_joints = robot_state_->getNrJoints();
-    jacobian_.resize(0,number_joints);
+    unsigned int number_sources = 1;
+#ifdef USE_FCL
+    number_sources += ca_param_.distance_field.enabled ? 2 : 1;
+#endif
+    jacobian_.resize(number_sources * bodies_.size(), number_joints);
     jacobian_.setZero();
-    jacobian_pre_alloc_.resize(100,number_joints);//ToDo: can't we do this any nicer?
-    jacobian_pre_alloc_.setZero();
-    wrenches_pre_alloc_.resize(100);//ToDo: can't we do this any nicer?
+    num_rows_ = 0;
+    wrenches_pre_alloc_.resize(jacobian_.rows());
     wrenches_pre_alloc_.setZero();
+    partial_jacobian_.resize(6,number_joints);
+    partial_jacobian_.setZero();
     torques_.resize(number_joints);
     torques_.setZero();
 
@@ -134,11 +330,9 @@ bool CollisionAvoidance::initialize(RobotState &robotstate)
 
 void CollisionAvoidance::apply(RobotState &robotstate)
 {
-    statsPublisher_.startTimer("CollisionAvoidance::apply");
+    statsPublisher_.startTimer(timer_name_apply_);
 
-    /// Reset stuff
-    jacobian_pre_alloc_.setZero();
-    wrenches_pre_alloc_.setZero();
+    /// Reset stuff, calculateWrenches overwrites the rows that are used
     torques_.setZero();
     cost_ = 0.0;
 
@@ -146,27 +340,38 @@ void CollisionAvoidance::apply(RobotState &robotstate)
     calculateTransform();
 
     // Calculate the wrenches as a result of (self-)collision avoidance
-    std::vector<Distance> min_distances_total;
-    std::vector<Distance2> min_distances_total_fcl;
-    std::vector<RepulsiveForce> repulsive_forces_total;  // this will get removed eventually
-    std::vector<RepulsiveForce> repulsive_forces_total_fcl;
-
-    // Calculate the repulsive forces as a result of the self-collision avoidance.
+    // Clearing keeps the capacity, hence these do not allocate in steady state
+    min_distances_total_.clear();
+    min_distances_total_fcl_.clear();
+    repulsive_forces_total_.clear();
+
+    // Calculate the minimum distances of the self-collision avoidance, only with the selected backend unless cross validating
+    if (backend_ == BULLET || ca_param_.cross_validation) {
+        statsPublisher_.startTimer(timer_name_self_collision_);
+        selfCollision(min_distances_total_);
+        statsPublisher_.stopTimer(timer_name_self_collision_);
+    }
 
-    statsPublisher_.startTimer("CollisionAvoidance::selfCollision");
-    selfCollision(min_distances_total);
-    statsPublisher_.stopTimer("CollisionAvoidance::selfCollision");
+    if (backend_ == FCL || ca_param_.cross_validation) {
+        statsPublisher_.startTimer(timer_name_self_collision_fast_);
+        selfCollisionFast(min_distances_total_fcl_);
+        statsPublisher_.stopTimer(timer_name_self_collision_fast_);
+    }
 
-    statsPublisher_.startTimer("CollisionAvoidance::selfCollisionFast");
-    selfCollisionFast(min_distances_total_fcl);
-    statsPublisher_.stopTimer("CollisionAvoidance::selfCollisionFast");
+    if (ca_param_.cross_validation) {
+        crossValidate(min_distances_total_, min_distances_total_fcl_);
+        // Only the distances of the selected backend result in forces
+        if (backend_ == BULLET) {
+            min_distances_total_fcl_.clear();
+        }
+    }
 
     // Calculate the repulsive forces as a result of the environment collision avoidance.
     /*
     if (octomap_){
         if (octomap_->size() > 0)
         {
-            environmentCollision(min_distances_total);
+            environmentCollision(min_distances_total_);
         }
         else{
             ROS_WARN_ONCE("Collision Avoidance: No octomap created!");
@@ -175,71 +380,102 @@ void CollisionAvoidance::apply(RobotState &robotstate)
     */
 
 #ifdef USE_FCL
-    statsPublisher_.startTimer("CollisionAvoidance::environmentCollisionVWM");
+    statsPublisher_.startTimer(timer_name_environment_collision_);
+
+    // Calculate the repulsive forces as a result of the volumetric world model (FCL, for both backends)
+    environmentCollisionVWM(min_distances_total_fcl_);
+
+    statsPublisher_.stopTimer(timer_name_environment_collision_);
+
+    if (ca_param_.distance_field.enabled) {
+        statsPublisher_.startTimer(timer_name_environment_field_);
 
-    // Calculate the repulsive forces as a result of the volumetric world model
-    environmentCollisionVWM(min_distances_total_fcl);
+        // Calculate the minimum distances to the octomap from its signed distance field
+        environmentCollisionField(min_distances_total_fcl_);
 
-    statsPublisher_.stopTimer("CollisionAvoidance::environmentCollisionVWM");
+        statsPublisher_.stopTimer(timer_name_environment_field_);
+    }
 #endif
 
-    statsPublisher_.startTimer("CollisionAvoidance::calculateRepulsiveForce");
+    statsPublisher_.startTimer(timer_name_repulsive_force_);
 
     /// Calculate the repulsive forces and the corresponding 'wrenches' and Jacobians from the minimum distances
-    calculateRepulsiveForce(min_distances_total,     repulsive_forces_total,     ca_param_.self_collision);
+    if (backend_ == BULLET) {
+        calculateRepulsiveForce(min_distances_total_, repulsive_forces_total_, ca_param_.self_collision);
+    }
 #ifdef USE_FCL
-    calculateRepulsiveForce(min_distances_total_fcl, repulsive_forces_total_fcl, ca_param_.self_collision);
+    calculateRepulsiveForce(min_distances_total_fcl_, repulsive_forces_total_, ca_param_.self_collision);
 #endif
 
-    statsPublisher_.stopTimer("CollisionAvoidance::calculateRepulsiveForce");
+    statsPublisher_.stopTimer(timer_name_repulsive_force_);
 
 
-    std::vector<Distance2>::const_iterator min_distance = findMinimumDistance(min_distances_total_fcl, "grippoint_right");
-    std::vector<RepulsiveForce>::const_iterator max_force = findMaxRepulsiveForce(repulsive_forces_total_fcl, "grippoint_right");
+    std::vector<Distance2>::const_iterator min_distance = findMinimumDistance(min_distances_total_fcl_, traced_link_);
+    std::vector<RepulsiveForce>::const_iterator max_force = findMaxRepulsiveForce(repulsive_forces_total_, traced_link_);
 
-    if (min_distance != min_distances_total_fcl.end()
-            || max_force != repulsive_forces_total_fcl.end()) {
+    if (min_distance != min_distances_total_fcl_.end()
+            || max_force != repulsive_forces_total_.end()) {
         tracer_.newLine();
     }
 
-    if (min_distance != min_distances_total_fcl.end()) {
+    if (min_distance != min_distances_total_fcl_.end()) {
         const Distance2 &distance = *min_distance;
         tracer_.collectTracing(1, distance.result.min_distance);
     }
 
-    if (max_force != repulsive_forces_total_fcl.end()) {
+    if (max_force != repulsive_forces_total_.end()) {
         const RepulsiveForce &rp = *max_force;
         tracer_.collectTracing(2, rp.amplitude);
         tracer_.collectTracing(3, rp.direction);
     }
 
-    statsPublisher_.startTimer("CollisionAvoidance::calculateWrenches");
+    statsPublisher_.startTimer(timer_name_wrenches_);
 
-    calculateWrenches(repulsive_forces_total_fcl);
+    calculateWrenches(repulsive_forces_total_);
 
-    statsPublisher_.stopTimer("CollisionAvoidance::calculateWrenches");
+    statsPublisher_.stopTimer(timer_name_wrenches_);
 
 
     /// Output
-    statsPublisher_.startTimer("CollisionAvoidance::visualize");
+    statsPublisher_.startTimer(timer_name_visualize_);
 
-    visualize(min_distances_total);
-    visualizeRepulsiveForces(min_distances_total_fcl);
+    // Only if someone listens: building and publishing the markers allocates memory
+    if (pub_model_marker_.getNumSubscribers() > 0 || pub_model_marker_fcl_.getNumSubscribers() > 0 ||
+            pub_forces_marker_.getNumSubscribers() > 0 || pub_bbx_marker_.getNumSubscribers() > 0) {
+        visualize(min_distances_total_);
+    }
+    if (pub_forces_marker_fcl_.getNumSubscribers() > 0) {
+        visualizeRepulsiveForces(min_distances_total_fcl_);
+    }
 
-    statsPublisher_.stopTimer("CollisionAvoidance::visualize");
+    statsPublisher_.stopTimer(timer_name_visualize_);
 
-    statsPublisher_.stopTimer("CollisionAvoidance::apply");
+    unsigned int num_skipped, num_computed;
+    distance_cache_.getStatistics(num_skipped, num_computed);
+    ROS_DEBUG_NAMED("CollisionAvoidance", "Distance cache: %u pairs skipped, %u computed", num_skipped, num_computed);
+#ifdef USE_FCL
+    unsigned int num_added, num_removed;
+    world_region_.getStatistics(num_added, num_removed);
+    ROS_DEBUG_NAMED("CollisionAvoidance", "World region: %u objects, %u added, %u removed", world_region_.getNrObjects(), num_added, num_removed);
+#endif
+
+    statsPublisher_.stopTimer(timer_name_apply_);
     statsPublisher_.publish();
 }
 
-std::vector<CollisionAvoidance::Distance2>::const_iterator CollisionAvoidance::findMinimumDistance(const std::vector<Distance2> &distances, std::string link)
+unsigned int CollisionAvoidance::getNrRows()
+{
+    return num_rows_;
+}
+
+std::vector<CollisionAvoidance::Distance2>::const_iterator CollisionAvoidance::findMinimumDistance(const std::vector<Distance2> &distances, const std::string& link)
 {
     std::vector<Distance2>::const_iterator min_distance = distances.end();
     for(std::vector<Distance2>::const_iterator it = distances.begin(); it != distances.end(); it++) {
-        if (it->frame_id == link) {
+        if (it->body->frame_id == link) {
             if (min_distance != distances.end()) {
                 if (it->result.min_distance < min_distance->result.min_distance) {
-                    ROS_WARN_THROTTLE(5.0, "multiple minimum distances found for %s", it->frame_id.c_str());
+                    ROS_WARN_THROTTLE(5.0, "multiple minimum distances found for %s", it->body->frame_id.c_str());
                     min_distance = it;
                 }
             } else {
@@ -250,14 +486,14 @@ std::vector<CollisionAvoidance::Distance2>::const_iterator CollisionAvoidance::f
     return min_distance;
 }
 
-std::vector<CollisionAvoidance::RepulsiveForce>::const_iterator CollisionAvoidance::findMaxRepulsiveForce(const std::vector<RepulsiveForce> &forces, std::string link)
+std::vector<CollisionAvoidance::RepulsiveForce>::const_iterator CollisionAvoidance::findMaxRepulsiveForce(const std::vector<RepulsiveForce> &forces, const std::string& link)
 {
     std::vector<RepulsiveForce>::const_iterator max_force = forces.end();
     for(std::vector<RepulsiveForce>::const_iterator it = forces.begin(); it != forces.end(); it++) {
-        if (it->frame_id == link) {
+        if (it->body->frame_id == link) {
             if (max_force != forces.end()) {
                 if (it->amplitude > max_force->amplitude) {
-                    ROS_WARN("multiple maximum repulsive forces found for %s", it->frame_id.c_str());
+                    ROS_WARN("multiple maximum repulsive forces found for %s", it->body->frame_id.c_str());
                     max_force = it;
                 }
             } else {
@@ -273,56 +509,6 @@ void CollisionAvoidance::setCollisionWorld(WorldClient *world_client)
     world_client_ = world_client;
 }
 
-void CollisionAvoidance::addObjectCollisionModel(const std::string& frame_id) {
-
-    /// Dimensions: // ToDo: make variable;
-    double x_dim = 0.05;
-    double y_dim = 0.05;
-    double z_dim = 0.10;
-    double r     = 0.05/2;
-
-    /// Initialize collision body
-    RobotState::CollisionBody object_collision_body;
-    object_collision_body.name_collision_body = "object";           //ToDo: possibly add WM ID?
-    object_collision_body.collision_shape.shape_type = "CylinderZ"; //ToDo: make this variable
-    object_collision_body.collision_shape.dimensions.x = x_dim;     //ToDo: make this variable
-    object_collision_body.collision_shape.dimensions.y = y_dim;     //ToDo: make this variable
-    object_collision_body.collision_shape.dimensions.z = z_dim;     //ToDo: make this variable
-    object_collision_body.frame_id = frame_id;
-
-#ifdef USE_BULLET
-    object_collision_body.bt_shape = new btCylinderShapeZ(btVector3(x_dim, y_dim, z_dim));
-#endif
-#ifdef USE_FCL
-    boost::shared_ptr<fcl::CollisionGeometry> fcl_shape = shapeToMesh(fcl::Cylinder(r, z_dim));
-
-    // also set the user data so we can find out which link was in collision after a collision check
-    fcl_shape->setUserData(new CollisionGeometryData(&object_collision_body));
-
-    object_collision_body.fcl_object = boost::shared_ptr<fcl::CollisionObject>(new fcl::CollisionObject(fcl_shape));
-#endif
-
-    object_collision_body.fix_pose.Identity();                      //ToDo: is now initialized as p = [0,0,0], M = [0,0,0,1]
-
-    /// Add collision body to correct frame/group/etc.
-    // Robotstate pointer is member variable
-    // ToDo
-
-    /// Add to exclusions
-    // ToDo
-
-}
-
-void CollisionAvoidance::removeObjectCollisionModel() {
-
-    /// Remove object collision model from frame/group/etc.
-    // ToDo
-
-    /// Remove from exclusions
-    // ToDo
-
-}
-
 void CollisionAvoidance::selfCollision(std::vector<Distance> &min_distances)
 {
     // Loop through all collision groups
@@ -335,38 +521,25 @@ void CollisionAvoidance::selfCollision(std::vector<Distance> &min_distances)
             std::vector<Distance> distanceCollection;
             RobotState::CollisionBody &currentBody = *itrBody;
 
-            // Distance check with other groups if the name of the groups is different than the current group
+            // Distance check with the bodies of other groups that are not excluded
+            unsigned int currentId = getCollisionBodyId(currentBody);
             for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrCollisionGroup = robot_state_->robot_.groups.begin(); itrCollisionGroup != robot_state_->robot_.groups.end(); ++itrCollisionGroup)
             {
                 std::vector<RobotState::CollisionBody> &collisionGroup = *itrCollisionGroup;
-                if (collisionGroup.front().name_collision_body != Group.front().name_collision_body)
+                // Loop trough al the bodies of the group
+                for (std::vector<RobotState::CollisionBody>::iterator itrCollisionBody = collisionGroup.begin(); itrCollisionBody != collisionGroup.end(); ++itrCollisionBody)
                 {
-                    // Loop trough al the bodies of the group
-                    for (std::vector<RobotState::CollisionBody>::iterator itrCollisionBody = collisionGroup.begin(); itrCollisionBody != collisionGroup.end(); ++itrCollisionBody)
+                    RobotState::CollisionBody &collisionBody = *itrCollisionBody;
+
+                    if (!allowed_collisions_.isAllowed(currentId, getCollisionBodyId(collisionBody)))
                     {
-                        RobotState::CollisionBody &collisionBody = *itrCollisionBody;
-
-                        // Check for exclusions
-                        bool skip_check = false;
-                        for (std::vector<RobotState::Exclusion> ::iterator itrExcl = robot_state_->exclusion_checks.checks.begin(); itrExcl != robot_state_->exclusion_checks.checks.end(); ++itrExcl)
-                        {
-                            RobotState::Exclusion &excluded_bodies = *itrExcl;
-                            if ( (currentBody.name_collision_body == excluded_bodies.name_body_A && collisionBody.name_collision_body == excluded_bodies.name_body_B) ||
-                                 (collisionBody.name_collision_body == excluded_bodies.name_body_A && currentBody.name_collision_body == excluded_bodies.name_body_B) )
-                            {
-                                skip_check = true;
-                            }
-                        }
-
-                        if (skip_check == false)
-                        {
 #ifdef USE_BULLET
-                            Distance distance;
-                            distance.frame_id = currentBody.frame_id;
-                            distanceCalculation(*currentBody.bt_shape, *collisionBody.bt_shape, currentBody.bt_transform, collisionBody.bt_transform, distance.bt_distance);
-                            distanceCollection.push_back(distance);
+                        Distance distance;
+                        distance.frame_handle = currentBody.frame_handle;
+                        distance.body = &currentBody;
+                        distanceCalculation(*currentBody.bt_shape, *collisionBody.bt_shape, currentBody.bt_transform, collisionBody.bt_transform, distance.bt_distance);
+                        distanceCollection.push_back(distance);
 #endif
-                        }
                     }
                 }
             }
@@ -379,88 +552,166 @@ void CollisionAvoidance::selfCollision(std::vector<Distance> &min_distances)
 }
 
 #ifdef USE_FCL
-bool selfCollisionDistanceFunction(fcl::CollisionObject* co_other, fcl::CollisionObject* co_self, void* cdata_, fcl::FCL_REAL& dist)
+/// @brief Updates the minimum distances of both bodies of a pair, the nearest point of a body comes first
+void updateMinimumDistances(const fcl::DistanceResult& result, fcl::DistanceResult& result_a, fcl::DistanceResult& result_b)
+{
+    if (result.min_distance < result_a.min_distance) {
+        result_a = result;
+    }
+    if (result.min_distance < result_b.min_distance) {
+        result_b = result;
+        std::swap(result_b.o1, result_b.o2);
+        std::swap(result_b.b1, result_b.b2);
+        std::swap(result_b.nearest_points[0], result_b.nearest_points[1]);
+    }
+}
+
+bool selfCollisionDistanceFunction(fcl::CollisionObject* co_a, fcl::CollisionObject* co_b, void* cdata_, fcl::FCL_REAL& dist)
 {
     DistanceData* cdata = static_cast<DistanceData*>(cdata_);
 
-    if(cdata->done)
-        return true;
+    // pairs further apart than the cutoff are pruned by the broadphase
+    dist = cdata->cutoff;
 
-    const CollisionGeometryData* cgd_self  = static_cast<const CollisionGeometryData*>(co_self ->getCollisionGeometry()->getUserData());
-    const CollisionGeometryData* cgd_other = static_cast<const CollisionGeometryData*>(co_other->getCollisionGeometry()->getUserData());
+    const CollisionGeometryData* cgd_a = static_cast<const CollisionGeometryData*>(co_a->getCollisionGeometry()->getUserData());
+    const CollisionGeometryData* cgd_b = static_cast<const CollisionGeometryData*>(co_b->getCollisionGeometry()->getUserData());
 
     // do not collision check geoms part of the same object / link / attached body
-    if (cgd_self->sameObject(*cgd_other)) {
+    if (cgd_a->sameObject(*cgd_b)) {
 #ifdef VERBOSE_SELFCOLLISION_CHECKS
         ROS_INFO("\tskip collision the same link");
 #endif
         return false;
     }
 
-    const RobotState::CollisionBody *link_self  = cgd_self ->ptr.link;
-    const RobotState::CollisionBody *link_other = cgd_other->ptr.link;
+    const RobotState::CollisionBody *link_a = cgd_a->ptr.link;
+    const RobotState::CollisionBody *link_b = cgd_b->ptr.link;
 
-    std::vector< std::vector<RobotState::CollisionBody> >::iterator group_self = cdata->robotState->robot_.groups.end();
-    std::vector< std::vector<RobotState::CollisionBody> >::iterator group_other  = cdata->robotState->robot_.groups.end();
+    // skip pairs in the same collision group and excluded pairs
+    if (cdata->allowed_collisions->isAllowed(cgd_a->id, cgd_b->id)) {
+#ifdef VERBOSE_SELFCOLLISION_CHECKS
+        ROS_INFO("\tskip collision between %s and %s", link_a->frame_id.c_str(), link_b->frame_id.c_str());
+#endif
+        return false;
+    }
 
-    // find the collision group
-    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroup = cdata->robotState->robot_.groups.begin(); itrGroup != cdata->robotState->robot_.groups.end(); ++itrGroup)
-    {
-        for (std::vector<RobotState::CollisionBody>::iterator itrBody = itrGroup->begin(); itrBody != itrGroup->end(); ++itrBody)
-        {
-            if (&(*itrBody) == link_self)
-                group_self = itrGroup;
-            if (&(*itrBody) == link_other)
-                group_other = itrGroup;
-        }
+    fcl::DistanceResult& result_a = (*cdata->body_results)[cgd_a->id];
+    fcl::DistanceResult& result_b = (*cdata->body_results)[cgd_b->id];
+
+    // the pair only matters if it can be closer than the minimum distance of one of its bodies
+    double min_distance = std::max(result_a.min_distance, result_b.min_distance);
+
+    // skip pairs that can not have come closer than this since their last distance
+    if (cdata->cache && cdata->cache->isSelfPairBeyond(cgd_a->id, cgd_b->id, min_distance)) {
+        return false;
     }
 
-    // check if the link is in a group
-    assert(group_self  != cdata->robotState->robot_.groups.end());
-    assert(group_other != cdata->robotState->robot_.groups.end());
+    // primitive pairs are computed together after the pass
+    if (addToBatch(co_a, co_b, *cdata)) {
+        return false;
+    }
+
+    fcl::DistanceResult result(min_distance);
+    computeDistance(co_a, co_b, *cdata, result);
+
+    // the result is the distance of this pair or, if not closer, min_distance: a lower bound in both cases
+    if (cdata->cache) {
+        cdata->cache->setSelfPair(cgd_a->id, cgd_b->id, result.min_distance);
+    }
 
-    if (group_self == group_other) {
 #ifdef VERBOSE_SELFCOLLISION_CHECKS
-        ROS_INFO("\tskip collision in same group between %s and %s", link_self->frame_id.c_str(), link_other->frame_id.c_str());
+    ROS_INFO("\tcollision between %15s and %15s, %2.3f", link_a->frame_id.c_str(), link_b->frame_id.c_str(), result.min_distance);
 #endif
+
+    updateMinimumDistances(result, result_a, result_b);
+
+    if (result.min_distance <= 0) {
+        ROS_WARN_THROTTLE(1, "\ttouch between %s and %s", link_a->frame_id.c_str(), link_b->frame_id.c_str());
+    }
+
+    // all pairs are needed for the minima of all bodies
+    return false;
+}
+
+bool selfCollisionBodyDistanceFunction(fcl::CollisionObject* co_other, fcl::CollisionObject* co_self, void* cdata_, fcl::FCL_REAL& dist)
+{
+    DistanceData* cdata = static_cast<DistanceData*>(cdata_);
+
+    // the other body may need this pair for its own minimum, hence only the cutoff prunes
+    dist = cdata->cutoff;
+
+    const CollisionGeometryData* cgd_self  = static_cast<const CollisionGeometryData*>(co_self ->getCollisionGeometry()->getUserData());
+    const CollisionGeometryData* cgd_other = static_cast<const CollisionGeometryData*>(co_other->getCollisionGeometry()->getUserData());
+
+    // every pair is computed by the query of its body with the lowest id
+    if (cgd_other->id <= cgd_self->id || cgd_self->sameObject(*cgd_other)) {
         return false;
     }
 
-    for (std::vector<RobotState::Exclusion> ::iterator itrExcl = cdata->robotState->exclusion_checks.checks.begin(); itrExcl != cdata->robotState->exclusion_checks.checks.end(); ++itrExcl)
-    {
-        RobotState::Exclusion &excluded_bodies = *itrExcl;
+    // skip pairs in the same collision group and excluded pairs
+    if (cdata->allowed_collisions->isAllowed(cgd_self->id, cgd_other->id)) {
+        return false;
+    }
 
-        if ( (link_self->name_collision_body == excluded_bodies.name_body_A && link_other->name_collision_body == excluded_bodies.name_body_B)
-          || (link_self->name_collision_body == excluded_bodies.name_body_B && link_other->name_collision_body == excluded_bodies.name_body_A) )
-        {
-#ifdef VERBOSE_SELFCOLLISION_CHECKS
-            ROS_INFO("\texcluded collision check between %s and %s", link_self->frame_id.c_str(), link_other->frame_id.c_str());
-#endif
-            return false;
-        }
+    if (cdata->cache && cdata->cache->isSelfPairBeyond(cgd_self->id, cgd_other->id, cdata->cutoff)) {
+        return false;
     }
 
-    const fcl::DistanceRequest& request = cdata->request;
-    fcl::DistanceResult& result = cdata->result;
+    // primitive pairs are computed together after the query
+    if (addToBatch(co_self, co_other, *cdata)) {
+        return false;
+    }
 
-    fcl::distance(co_self, co_other, request, result);
+    fcl::DistanceResult result(cdata->cutoff);
+    computeDistance(co_self, co_other, *cdata, result);
 
-#ifdef VERBOSE_SELFCOLLISION_CHECKS
-    if (dist >= FLT_MAX) {
-        ROS_INFO("\tcollision between %15s and %15s, inf  -> %2.3f",  link_self->frame_id.c_str(), link_other->frame_id.c_str(), result.min_distance);
-    } else {
-        ROS_INFO("\tcollision between %15s and %15s, %2.3f -> %2.3f", link_self->frame_id.c_str(), link_other->frame_id.c_str(), dist, result.min_distance);
+    if (cdata->cache) {
+        cdata->cache->setSelfPair(cgd_self->id, cgd_other->id, result.min_distance);
     }
-#endif
 
-    dist = result.min_distance;
+    if (result.min_distance < cdata->cutoff) {
+        cdata->pair_results->push_back(result);
+        if (result.min_distance <= 0) {
+            ROS_WARN_THROTTLE(1, "\ttouch between %s and %s", cgd_self->ptr.link->frame_id.c_str(), cgd_other->ptr.link->frame_id.c_str());
+        }
+    }
+
+    return false;
+}
 
-    if(dist <= 0) {
-        ROS_WARN_THROTTLE(1, "\ttouch between %s and %s", link_self->frame_id.c_str(), link_other->frame_id.c_str());
-        return true; // in collision or in touch
+void CollisionAvoidance::selfCollisionQuery(unsigned int id)
+{
+    DistanceData cdata;
+    cdata.allowed_collisions = &allowed_collisions_;
+    cdata.analytic = ca_param_.analytic_distances;
+    cdata.cache = ca_param_.distance_caching ? &distance_cache_ : NULL;
+    cdata.pair_results = &self_pair_results_[id];
+    cdata.cutoff = ca_param_.self_collision.d_threshold * ca_param_.self_collision.visualization_force_factor;
+    cdata.request.enable_nearest_points = true;
+
+    if (ca_param_.batched_distances) {
+        cdata.batch = &self_pair_batches_[id];
+        cdata.batch_objects = &self_pair_objects_[id];
+        cdata.batch->clear();
+        cdata.batch_objects->clear();
     }
 
-    return cdata->done;
+    cdata.pair_results->clear();
+    selfCollisionManager.distance(bodies_[id]->fcl_object.get(), &cdata, selfCollisionBodyDistanceFunction);
+
+    /// Compute the primitive pairs together and keep those within the cutoff
+    if (cdata.batch) {
+        cdata.batch->compute();
+        for (unsigned int i = 0; i < cdata.batch->size(); ++i)
+        {
+            fcl::DistanceResult result(cdata.cutoff);
+            unsigned int id_self, id_other;
+            getBatchResult(cdata, i, result, id_self, id_other);
+            if (result.min_distance < cdata.cutoff) {
+                cdata.pair_results->push_back(result);
+            }
+        }
+    }
 }
 
 void CollisionAvoidance::selfCollisionFast(std::vector<Distance2> &min_distances)
@@ -469,37 +720,108 @@ void CollisionAvoidance::selfCollisionFast(std::vector<Distance2> &min_distances
     assert(min_distance >= ca_param_.self_collision.d_threshold && min_distance > 0);
     ROS_INFO_ONCE_NAMED("CollisionAvoidance", "selfCollision: ignoring distances bigger than %f", min_distance);
 
-    // Loop through all collision groups
+    // Every allowed pair is evaluated once and updates the minimum distance of both of its bodies
+    unsigned int num_bodies = bodies_.size();
+    self_distances_.assign(num_bodies, fcl::DistanceResult(min_distance));
+
+    if (distance_pool_.getNrThreads() == 0) {
+        DistanceData cdata;
+        cdata.allowed_collisions = &allowed_collisions_;
+        cdata.analytic = ca_param_.analytic_distances;
+        cdata.cache = ca_param_.distance_caching ? &distance_cache_ : NULL;
+        cdata.body_results = &self_distances_;
+        cdata.cutoff = min_distance;
+        cdata.request.enable_nearest_points = true;
+        if (ca_param_.batched_distances) {
+            cdata.batch = &self_pair_batches_.back();
+            cdata.batch_objects = &self_pair_objects_.back();
+            cdata.batch->clear();
+            cdata.batch_objects->clear();
+        }
+
+        selfCollisionManager.distance(&cdata, selfCollisionDistanceFunction);
+
+        /// Compute the primitive pairs together, then update the minima of their bodies in the order of the pass
+        if (cdata.batch) {
+            cdata.batch->compute();
+            for (unsigned int i = 0; i < cdata.batch->size(); ++i)
+            {
+                fcl::DistanceResult result(min_distance);
+                unsigned int id_a, id_b;
+                getBatchResult(cdata, i, result, id_a, id_b);
+                updateMinimumDistances(result, self_distances_[id_a], self_distances_[id_b]);
+            }
+        }
+    } else {
+        // Query every body in parallel, then merge the pairs in the order of the bodies
+        distance_pool_.run(num_bodies, self_collision_task_);
+        for (unsigned int id = 0; id < num_bodies; ++id)
+        {
+            for (std::vector<fcl::DistanceResult>::const_iterator itrPair = self_pair_results_[id].begin(); itrPair != self_pair_results_[id].end(); ++itrPair)
+            {
+                unsigned int other_id = static_cast<const CollisionGeometryData*>(itrPair->o2->getUserData())->id;
+                updateMinimumDistances(*itrPair, self_distances_[id], self_distances_[other_id]);
+            }
+        }
+    }
+
+    // Collect the minimum distance of every body
     for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroup = robot_state_->robot_.groups.begin(); itrGroup != robot_state_->robot_.groups.end(); ++itrGroup)
     {
         std::vector<RobotState::CollisionBody> &Group = *itrGroup;
         for (std::vector<RobotState::CollisionBody>::iterator itrBody = Group.begin(); itrBody != Group.end(); ++itrBody)
         {
-            // Loop through al the bodies of the group
             RobotState::CollisionBody &currentBody = *itrBody;
+            const fcl::DistanceResult& result = self_distances_[getCollisionBodyId(currentBody)];
 
-#ifdef VERBOSE_SELFCOLLISION_CHECKS
-            ROS_INFO("selfcollision for %s", currentBody.frame_id.c_str());
-#endif
-
-            DistanceData cdata;
-            cdata.robotState = robot_state_;
-            cdata.verbose = true;
-            cdata.request.enable_nearest_points = true;
-            cdata.result.min_distance = min_distance;
-
-            selfCollisionManager.distance(currentBody.fcl_object.get(), &cdata, selfCollisionDistanceFunction);
-
-            if (!cdata.result.o1 || !cdata.result.o2)
+            if (!result.o1 || !result.o2)
                 continue; // no object found within self_collision.d_threshold
 
             Distance2 distance2;
-            distance2.result = cdata.result;
-            distance2.frame_id = currentBody.frame_id;
+            distance2.result = result;
+            distance2.frame_handle = currentBody.frame_handle;
+            distance2.body = &currentBody;
             min_distances.push_back(distance2);
         }
     }
 }
+
+void CollisionAvoidance::crossValidate(const std::vector<Distance> &min_distances, const std::vector<Distance2> &min_distances_fcl) const
+{
+    // FCL only reports distances below the cutoff, larger distances are compared as the cutoff
+    double cutoff = ca_param_.self_collision.d_threshold * ca_param_.self_collision.visualization_force_factor;
+
+    unsigned int num_disagreements = 0;
+    double max_difference = 0.0;
+    const Distance* worst = NULL;
+    double worst_fcl = cutoff;
+    for (std::vector<Distance>::const_iterator itrBt = min_distances.begin(); itrBt != min_distances.end(); ++itrBt)
+    {
+        double d_fcl = cutoff;
+        for (std::vector<Distance2>::const_iterator itrFcl = min_distances_fcl.begin(); itrFcl != min_distances_fcl.end(); ++itrFcl)
+        {
+            if (itrFcl->body == itrBt->body) {
+                d_fcl = itrFcl->result.min_distance;
+                break;
+            }
+        }
+
+        double difference = std::abs(std::min((double)itrBt->bt_distance.m_distance, cutoff) - d_fcl);
+        if (difference > ca_param_.cross_validation_tolerance) {
+            ++num_disagreements;
+            if (difference > max_difference) {
+                max_difference = difference;
+                worst = &(*itrBt);
+                worst_fcl = d_fcl;
+            }
+        }
+    }
+
+    if (worst) {
+        ROS_WARN_THROTTLE(1.0, "Collision backends disagree on %u bodies, worst is %s: bullet %f, fcl %f (distances above %f are not compared)",
+                          num_disagreements, worst->body->name_collision_body.c_str(), worst->bt_distance.m_distance, worst_fcl, cutoff);
+    }
+}
 #endif
 
 void CollisionAvoidance::environmentCollision(std::vector<Distance> &min_distances)
@@ -611,7 +933,8 @@ void CollisionAvoidance::environmentCollision(std::vector<Distance> &min_distanc
                 envBody.bt_shape = new btBoxShape(btVector3(0.5*vox.size_voxel,0.5*vox.size_voxel,0.5*vox.size_voxel));
                 setTransform(vox.center_point, no_fix_, envBody.bt_transform);
 
-                distance.frame_id = collisionBody.frame_id;
+                distance.frame_handle = collisionBody.frame_handle;
+                distance.body = &collisionBody;
                 distanceCalculation(*collisionBody.bt_shape,*envBody.bt_shape,collisionBody.bt_transform,envBody.bt_transform,distance.bt_distance);
 
                 distanceCollection.push_back(distance);
@@ -627,7 +950,6 @@ void CollisionAvoidance::environmentCollision(std::vector<Distance> &min_distanc
 bool environmentCollisionDistanceFunction(fcl::CollisionObject* co_other, fcl::CollisionObject* co_self, void* cdata_, fcl::FCL_REAL& dist)
 {
     DistanceData* cdata = static_cast<DistanceData*>(cdata_);
-    const fcl::DistanceRequest& request = cdata->request;
     fcl::DistanceResult& result = cdata->result;
 
     if(cdata->done) { dist = result.min_distance; return true; }
@@ -638,8 +960,16 @@ bool environmentCollisionDistanceFunction(fcl::CollisionObject* co_other, fcl::C
     const RobotState::CollisionBody *link_self  = cgd_self ->ptr.link;
     //const RobotState::CollisionBody *link_other = cgd_other->ptr.link;
 
+    if (cdata->cache && cdata->cache->isWorldPairBeyond(cgd_self->id, co_other, result.min_distance)) {
+        return false;
+    }
+
     fcl::DistanceResult distance_result;
-    fcl::distance(co_self, co_other, request, distance_result);
+    computeDistance(co_self, co_other, *cdata, distance_result);
+
+    if (cdata->cache) {
+        cdata->cache->setWorldPair(cgd_self->id, co_other, distance_result.min_distance);
+    }
 
 #ifdef VERBOSE_ENVIRONMENTCOLLISION_CHECKS
     if (dist >= FLT_MAX) {
@@ -671,33 +1001,145 @@ void CollisionAvoidance::environmentCollisionVWM(std::vector<Distance2> &min_dis
     assert(min_distance >= ca_param_.environment_collision.d_threshold && min_distance > 0);
     ROS_INFO_ONCE_NAMED("CollisionAvoidance", "environmentCollision: ignoring environment distances bigger than %f", min_distance);
 
+    // latest snapshot of the world, does not block on the world model
     WorldPtr world = world_client_->getWorld();
+    if (!world) {
+        ROS_WARN_ONCE("no world published yet, environment collisions are skipped until then");
+        return;
+    }
     fcl::BroadPhaseCollisionManager *manager = world->getCollisionManager();
 
-    /// for each RobotState::CollisionBody, get a minimum distance to the world
+    // cached environment distances are only valid for the same version of the world
+    distance_cache_.setWorld(world.get(), world->getVersion());
+
+    /// Only query the objects within reach: the envelope is the bounding box of the bodies enlarged by the cutoff
+    if (ca_param_.region_of_interest.enabled && !bodies_.empty()) {
+        fcl::AABB envelope = bodies_[0]->fcl_object->getAABB();
+        for (unsigned int id = 1; id < bodies_.size(); ++id)
+        {
+            envelope += bodies_[id]->fcl_object->getAABB();
+        }
+        fcl::Vec3f cutoff(min_distance, min_distance, min_distance);
+        envelope = fcl::AABB(envelope.min_ - cutoff, envelope.max_ + cutoff);
+
+        manager = world_region_.update(world, envelope);
+    }
+
+    /// for each RobotState::CollisionBody, get a minimum distance to the world (in parallel)
+    environment_manager_ = manager;
+    distance_pool_.run(bodies_.size(), environment_collision_task_);
+
+    /// Collect them in the order of the collision groups
     for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robot_state_->robot_.groups.begin(); itrGroups != robot_state_->robot_.groups.end(); ++itrGroups)
     {
         std::vector<RobotState::CollisionBody> &group = *itrGroups;
         for (std::vector<RobotState::CollisionBody>::iterator itrBodies = group.begin(); itrBodies != group.end(); ++itrBodies)
         {
             RobotState::CollisionBody &collisionBody = *itrBodies;
+            const fcl::DistanceResult& result = environment_distances_[getCollisionBodyId(collisionBody)];
+
+            if (!result.o1 || !result.o2)
+                continue; // no object found within environment_collision.d_threshold;
 
+            Distance2 distance;
+            distance.frame_handle = collisionBody.frame_handle;
+            distance.body = &collisionBody;
+            distance.result = result;
+            min_distances.push_back(distance);
+        }
+    }
+}
+
+void CollisionAvoidance::environmentCollisionQuery(unsigned int id)
+{
 #ifdef VERBOSE_ENVIRONMENTCOLLISION_CHECKS
-            ROS_INFO("environmentcollision for %s", collisionBody.frame_id.c_str());
+    ROS_INFO("environmentcollision for %s", bodies_[id]->frame_id.c_str());
 #endif
 
-            DistanceData cdata;
-            cdata.request.enable_nearest_points = true;
-            cdata.result.min_distance = min_distance;
+    DistanceData cdata;
+    cdata.analytic = ca_param_.analytic_distances;
+    cdata.cache = ca_param_.distance_caching ? &distance_cache_ : NULL;
+    cdata.request.enable_nearest_points = true;
+    cdata.result.min_distance = ca_param_.environment_collision.d_threshold * ca_param_.environment_collision.visualization_force_factor;
 
-            manager->distance(collisionBody.fcl_object.get(), &cdata, environmentCollisionDistanceFunction);
+    environment_manager_->distance(bodies_[id]->fcl_object.get(), &cdata, environmentCollisionDistanceFunction);
+    environment_distances_[id] = cdata.result;
+}
 
-            if (!cdata.result.o1 || !cdata.result.o2)
-                continue; // no object found within environment_collision.d_threshold;
+void CollisionAvoidance::environmentCollisionField(std::vector<Distance2> &min_distances)
+{
+    /// Move the window of the field along with the robot, the grid of this cycle is kept even if a new one is published
+    const KDL::Vector& base = robot_state_->amcl_pose_.p;
+    environment_field_.setRobotPosition(Eigen::Vector3d(base.x(), base.y(), base.z()));
+
+    boost::shared_ptr<const EnvironmentDistanceField::Grid> grid = environment_field_.getGrid();
+    if (!grid) {
+        ROS_WARN_ONCE("Collision Avoidance: No environment distance field yet, waiting for an octomap");
+        return;
+    }
+
+    double cutoff = ca_param_.environment_collision.d_threshold * ca_param_.environment_collision.visualization_force_factor;
+
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robot_state_->robot_.groups.begin(); itrGroups != robot_state_->robot_.groups.end(); ++itrGroups)
+    {
+        std::vector<RobotState::CollisionBody> &group = *itrGroups;
+        for (std::vector<RobotState::CollisionBody>::iterator itrBodies = group.begin(); itrBodies != group.end(); ++itrBodies)
+        {
+            RobotState::CollisionBody &collisionBody = *itrBodies;
+            unsigned int id = getCollisionBodyId(collisionBody);
+            const std::vector<Eigen::Vector3d>& samples = field_samples_[id];
+            double margin = field_margins_[id];
+
+            KDL::Frame pose = collisionBody.fk_pose * collisionBody.fix_pose;
+            Eigen::Matrix3d rotation;
+            Eigen::Vector3d position;
+            for (unsigned int i = 0; i < 3; ++i)
+            {
+                for (unsigned int j = 0; j < 3; ++j)
+                    rotation(i, j) = pose.M(i, j);
+                position(i) = pose.p(i);
+            }
+
+            /// Sample with the smallest distance
+            double min_distance = cutoff;
+            double sample_distance = 0.0;
+            Eigen::Vector3d point, gradient, nearest_point, nearest_gradient;
+            for (std::vector<Eigen::Vector3d>::const_iterator itrSample = samples.begin(); itrSample != samples.end(); ++itrSample)
+            {
+                point.noalias() = rotation * (*itrSample);
+                point += position;
+                double distance = grid->getDistance(point, gradient);
+                if (distance - margin < min_distance)
+                {
+                    min_distance = distance - margin;
+                    sample_distance = distance;
+                    nearest_point = point;
+                    nearest_gradient = gradient;
+                }
+            }
+
+            if (min_distance >= cutoff)
+                continue; // no occupied voxel within the cutoff
+
+            double norm = nearest_gradient.norm();
+            if (norm < 1e-6) {
+                ROS_WARN_THROTTLE(1.0, "Collision Avoidance: no direction away from the octomap for %s", collisionBody.frame_id.c_str());
+                continue;
+            }
+            nearest_gradient /= norm;
+
+            /// Nearest point on the body and on the octomap along the gradient. If the body penetrates the octomap, the point on
+            /// the octomap is mirrored such that the difference still points away from the octomap (as ShapeDistance does)
+            Eigen::Vector3d p0 = nearest_point - margin * nearest_gradient;
+            Eigen::Vector3d p1 = nearest_point - sample_distance * nearest_gradient;
+            if (min_distance < 0.0)
+                p1 = p0 + min_distance * nearest_gradient;
 
             Distance2 distance;
-            distance.frame_id = collisionBody.frame_id;
-            distance.result = cdata.result;
+            distance.frame_handle = collisionBody.frame_handle;
+            distance.body = &collisionBody;
+            distance.result.update(min_distance, collisionBody.fcl_object->getCollisionGeometry(), NULL, fcl::DistanceResult::NONE, fcl::DistanceResult::NONE,
+                                   fcl::Vec3f(p0.x(), p0.y(), p0.z()), fcl::Vec3f(p1.x(), p1.y(), p1.z()));
             min_distances.push_back(distance);
         }
     }
@@ -707,6 +1149,14 @@ void CollisionAvoidance::environmentCollisionVWM(std::vector<Distance2> &min_dis
 void CollisionAvoidance::calculateWrenches(const std::vector<RepulsiveForce> &repulsive_forces)
 {
     //std::cout << "CA calculate wrenches" << std::endl;
+    /// A row per repulsive force, the buffers are sized for the maximum number of forces at initialization
+    if (repulsive_forces.size() > (unsigned int)jacobian_.rows()) {
+        ROS_WARN("CollisionAvoidance: %u repulsive forces exceed the %u rows of the Jacobian, growing",
+                 (unsigned int)repulsive_forces.size(), (unsigned int)jacobian_.rows());
+        jacobian_.conservativeResize(repulsive_forces.size(), Eigen::NoChange);
+        wrenches_pre_alloc_.conservativeResize(repulsive_forces.size());
+    }
+
     unsigned int row_index = 0;
     for (std::vector<RepulsiveForce>::const_iterator itrRF = repulsive_forces.begin(); itrRF != repulsive_forces.end(); ++itrRF)
     {
@@ -722,50 +1172,16 @@ void CollisionAvoidance::calculateWrenches(const std::vector<RepulsiveForce> &re
         //double dpx = 0.0; double dpy =  0.0; double dpz = 0.0;
      // End Testcase
         */
-        KDL::Frame p0;
-        Eigen::VectorXd wrench_calc(6);
-        wrench_calc.setZero();
-
-
-        /// Find the frame of the kinematic model on which the wrench acts.
-        for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robot_state_->robot_.groups.begin(); itrGroups != robot_state_->robot_.groups.end(); ++itrGroups)
-        {
-            std::vector<RobotState::CollisionBody> &group = *itrGroups;
-            for (std::vector<RobotState::CollisionBody>::iterator itrBodies = group.begin(); itrBodies != group.end(); ++itrBodies)
-            {
-                RobotState::CollisionBody &collisionBody = *itrBodies;
-                if (collisionBody.frame_id == RF.frame_id )
-                {
-                    p0 = collisionBody.fk_pose;
-                }
-            }
-        }
-
-        /// Calculate delta p in map coordinates
-        double dpx = RF.pointOnA[0] - p0.p.x();
-        double dpy = RF.pointOnA[1] - p0.p.y();
-        double dpz = RF.pointOnA[2] - p0.p.z();
-
-        /// Compute 6xn Jacobian (this is w.r.t.root frame of the kinematic tree, so in this case: base_link)
-        Eigen::MatrixXd temp_jacobian(6,robot_state_->getNrJoints());// ToDo: get rid of this
-        KDL::Jacobian partial_jacobian(robot_state_->getNrJoints());
-        robot_state_->tree_.calcPartialJacobian(RF.frame_id, temp_jacobian);
-        partial_jacobian.data = temp_jacobian;
-
-        /// Change reference point: the force does not always act at the end of a certain link
-        partial_jacobian.changeRefPoint(KDL::Vector(dpx, dpy, dpz));
-
-        /// Change base: the Jacobian is computed w.r.t. base_link instead of map, while the force is expressed in map
-        std::map<std::string, KDL::Frame>::iterator itrFK = robot_state_->fk_poses_.find("base_link"); //ToDo: don't hardcode???
-        KDL::Frame BaseFrame_in_map = itrFK->second;
-        partial_jacobian.changeBase(BaseFrame_in_map.M);
+        /// Compute 6xn Jacobian in map frame of the point on which the force acts
+        /// (the force does not always act at the end of a certain link)
+        robot_state_->getPointJacobian(RF.frame_handle, KDL::Vector(RF.pointOnA[0], RF.pointOnA[1], RF.pointOnA[2]), partial_jacobian_);
 
         /// Premultiply first three rows with force direction to get one row
         //std::cout << "Force on " << RF.frame_id << " in direction " << RF.direction.getX() << ", " << RF.direction.getY() << ", " << RF.direction.getZ() << std::endl;
         //ROS_INFO("Multiplying [%i, %i] x [%i, %i] into [%i,%i]", force_direction.rows(), force_direction.cols(),
-        //         partial_jacobian.data.block(0,0,3,robot_state_->getNrJoints()).rows(), partial_jacobian.data.block(0,0,3,robot_state_->getNrJoints()).cols(),
-        //         jacobian_pre_alloc_.block(row_index, 0, 1, robot_state_->getNrJoints()).rows(), jacobian_pre_alloc_.block(row_index, 0, 1, robot_state_->getNrJoints()).cols());
-        jacobian_pre_alloc_.block(row_index, 0, 1, robot_state_->getNrJoints()) =  RF.direction.transpose() * partial_jacobian.data.block(0, 0, 3, robot_state_->getNrJoints());
+        //         partial_jacobian_.block(0,0,3,robot_state_->getNrJoints()).rows(), partial_jacobian_.block(0,0,3,robot_state_->getNrJoints()).cols(),
+        //         jacobian_.block(row_index, 0, 1, robot_state_->getNrJoints()).rows(), jacobian_.block(row_index, 0, 1, robot_state_->getNrJoints()).cols());
+        jacobian_.row(row_index).noalias() = RF.direction.transpose() * partial_jacobian_.topRows(3);
 
         /// Add force magnitude to list
         wrenches_pre_alloc_(row_index) = RF.amplitude;
@@ -777,13 +1193,11 @@ void CollisionAvoidance::calculateWrenches(const std::vector<RepulsiveForce> &re
 
     }
 
-    /// Extract total Jacobian and vector with wrenches
-    jacobian_ = jacobian_pre_alloc_.block(0, 0, row_index, robot_state_->getNrJoints());
-    Eigen::VectorXd wrenches = wrenches_pre_alloc_.block(0, 0, row_index, 1);
-    //std::cout << "Wrenches: \n" << wrenches_new_ << std::endl;
+    /// Only the first rows of the Jacobian are used, it is not resized
+    num_rows_ = row_index;
 
     /// Multiply to get torques
-    torques_ = jacobian_.transpose() * wrenches;
+    torques_.noalias() = jacobian_.topRows(num_rows_).transpose() * wrenches_pre_alloc_.head(num_rows_);
     //std::cout << "CA Torques: \n" << torques_ << std::endl;
 }
 
@@ -833,6 +1247,7 @@ void CollisionAvoidance::visualizeRepulsiveForces(std::vector<Distance2> &min_di
 
 void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
 {
+    unsigned int id = 0;
     for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robotstate.robot_.groups.begin(); itrGroups != robotstate.robot_.groups.end(); ++itrGroups)
     {
         std::vector<RobotState::CollisionBody> &group = *itrGroups;
@@ -850,6 +1265,7 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
             std::cout << "\tz: " << z << std::endl;
 
             boost::shared_ptr<fcl::CollisionGeometry> fcl_shape;
+            fcl::Transform3f local_transform;
 
             if (type=="Box")
             {
@@ -857,7 +1273,10 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
                 collisionBody.bt_shape = new btBoxShape(btVector3(x,y,z));
 #endif
 #ifdef USE_FCL
-                fcl_shape = shapeToMesh(fcl::Box(x*2, y*2, z*2));
+                if (ca_param_.analytic_distances)
+                    fcl_shape.reset(new fcl::Box(x*2, y*2, z*2));
+                else
+                    fcl_shape = shapeToMesh(fcl::Box(x*2, y*2, z*2));
 #endif
             }
             else if (type == "Sphere")
@@ -866,7 +1285,25 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
                 collisionBody.bt_shape = new btSphereShape(x);
 #endif
 #ifdef USE_FCL
-                fcl_shape = shapeToMesh(fcl::Sphere(x));
+                if (ca_param_.analytic_distances)
+                    fcl_shape.reset(new fcl::Sphere(x));
+                else
+                    fcl_shape = shapeToMesh(fcl::Sphere(x));
+#endif
+            }
+            else if (type == "Capsule")
+            {
+                // x: radius, z: half length of the segment between the centers of the spheres
+#ifdef USE_BULLET
+                collisionBody.bt_shape = new btCapsuleShapeZ(x, 2*z);
+#endif
+#ifdef USE_FCL
+                if (ca_param_.analytic_distances) {
+                    fcl_shape.reset(new fcl::Capsule(x, 2*z));
+                } else {
+                    ROS_WARN("Capsule %s is approximated by a cylinder mesh, enable analytic_distances", collisionBody.name_collision_body.c_str());
+                    fcl_shape = shapeToMesh(fcl::Cylinder(x, 2*(z+x)));
+                }
 #endif
             }
             else if (type == "Cone")
@@ -875,7 +1312,10 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
                 collisionBody.bt_shape = new btConeShapeZ(x-0.05,2*z);
 #endif
 #ifdef USE_FCL
-                fcl_shape = shapeToMesh(fcl::Cone(x, 2*z));
+                if (ca_param_.analytic_distances)
+                    fcl_shape.reset(new fcl::Cone(x, 2*z));
+                else
+                    fcl_shape = shapeToMesh(fcl::Cone(x, 2*z));
                 assert(x == y);
 #endif
             }
@@ -889,7 +1329,12 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
                 // fcl cylinders are oriented around the z axis, so we must rotate pi/2 around x
                 fcl::Quaternion3f q;
                 q.fromAxisAngle(fcl::Vec3f(1, 0, 0), M_PI_2);
-                fcl_shape = shapeToMesh(fcl::Cylinder(x, y*2), fcl::Transform3f(q));
+                if (ca_param_.analytic_distances) {
+                    fcl_shape.reset(new fcl::Cylinder(x, y*2));
+                    local_transform = fcl::Transform3f(q);
+                } else {
+                    fcl_shape = shapeToMesh(fcl::Cylinder(x, y*2), fcl::Transform3f(q));
+                }
 #endif
             }
             else if (type == "CylinderZ")
@@ -899,7 +1344,10 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
 #endif
 #ifdef USE_FCL
                 assert(x == y);
-                fcl_shape = shapeToMesh(fcl::Cylinder(x, z*2)); // TODO: check what happens with z
+                if (ca_param_.analytic_distances)
+                    fcl_shape.reset(new fcl::Cylinder(x, z*2));
+                else
+                    fcl_shape = shapeToMesh(fcl::Cylinder(x, z*2)); // TODO: check what happens with z
 #endif
             }
             else
@@ -910,7 +1358,9 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
             collisionBody.fcl_object = boost::shared_ptr<fcl::CollisionObject>(new fcl::CollisionObject(fcl_shape));
 
             // also set the user data so we can find out which link was in collision after a collision check
-            fcl_shape.get()->setUserData(new CollisionGeometryData(&collisionBody));
+            CollisionGeometryData* geometry_data = new CollisionGeometryData(&collisionBody, id++);
+            geometry_data->local_transform = local_transform;
+            fcl_shape.get()->setUserData(geometry_data);
 
             selfCollisionManager.registerObject(collisionBody.fcl_object.get());
 #endif
@@ -918,11 +1368,169 @@ void CollisionAvoidance::initializeCollisionModel(RobotState& robotstate)
     }
 
     selfCollisionManager.setup();
+
+    initializeAllowedCollisions(robotstate);
+
+    // Radius of every body around the origin of its fcl object, bounds the motion of its points
+    std::vector<double> radii;
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robotstate.robot_.groups.begin(); itrGroups != robotstate.robot_.groups.end(); ++itrGroups)
+    {
+        for (std::vector<RobotState::CollisionBody>::iterator itrBodies = itrGroups->begin(); itrBodies != itrGroups->end(); ++itrBodies)
+        {
+            const fcl::CollisionGeometry* geometry = itrBodies->fcl_object->getCollisionGeometry();
+            radii.push_back(geometry->aabb_center.length() + geometry->aabb_radius);
+        }
+    }
+    distance_cache_.initialize(radii);
+
+    // Bodies by id and the result slots of the distance queries
+    bodies_.clear();
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robotstate.robot_.groups.begin(); itrGroups != robotstate.robot_.groups.end(); ++itrGroups)
+    {
+        for (std::vector<RobotState::CollisionBody>::iterator itrBodies = itrGroups->begin(); itrBodies != itrGroups->end(); ++itrBodies)
+        {
+            bodies_.push_back(&(*itrBodies));
+        }
+    }
+    self_pair_results_.resize(bodies_.size());
+    for (unsigned int id = 0; id < bodies_.size(); ++id)
+    {
+        self_pair_results_[id].reserve(bodies_.size());
+    }
+    if (ca_param_.batched_distances)
+    {
+        self_pair_batches_.resize(bodies_.size() + 1);
+        self_pair_objects_.resize(bodies_.size() + 1);
+        for (unsigned int id = 0; id < bodies_.size(); ++id)
+        {
+            self_pair_batches_[id].reserve(bodies_.size());
+            self_pair_objects_[id].reserve(bodies_.size());
+        }
+        self_pair_batches_.back().reserve(bodies_.size() * bodies_.size() / 2);
+        self_pair_objects_.back().reserve(bodies_.size() * bodies_.size() / 2);
+    }
+    environment_distances_.resize(bodies_.size());
+
+    self_collision_task_ = boost::bind(&CollisionAvoidance::selfCollisionQuery, this, _1);
+    environment_collision_task_ = boost::bind(&CollisionAvoidance::environmentCollisionQuery, this, _1);
+    distance_pool_.initialize(std::max(0, ca_param_.distance_threads));
+}
+
+void CollisionAvoidance::initializeDistanceField(RobotState& robotstate)
+{
+    field_samples_.clear();
+    field_margins_.clear();
+    for (std::vector< std::vector<RobotState::CollisionBody> >::iterator itrGroups = robotstate.robot_.groups.begin(); itrGroups != robotstate.robot_.groups.end(); ++itrGroups)
+    {
+        for (std::vector<RobotState::CollisionBody>::iterator itrBodies = itrGroups->begin(); itrBodies != itrGroups->end(); ++itrBodies)
+        {
+            RobotState::CollisionBody &collisionBody = *itrBodies;
+            assert(getCollisionBodyId(collisionBody) == field_samples_.size());
+            std::string type = collisionBody.collision_shape.shape_type;
+            double x = collisionBody.collision_shape.dimensions.x;
+            double y = collisionBody.collision_shape.dimensions.y;
+            double z = collisionBody.collision_shape.dimensions.z;
+
+            // Shape in the frame of fk_pose * fix_pose, with the axis of capsules, cylinders and cones along z
+            ConvexShape shape;
+            shape.rotation.setIdentity();
+            shape.position.setZero();
+            shape.dimensions << x, y, z;
+            if (type == "Box") {
+                shape.type = ConvexShape::BOX;
+            } else if (type == "Sphere") {
+                shape.type = ConvexShape::SPHERE;
+            } else if (type == "Capsule") {
+                shape.type = ConvexShape::CAPSULE;
+            } else if (type == "Cone") {
+                shape.type = ConvexShape::CONE;
+            } else if (type == "CylinderY") {
+                shape.type = ConvexShape::CYLINDER;
+                shape.dimensions << x, x, y;
+                shape.rotation = Eigen::AngleAxisd(M_PI_2, Eigen::Vector3d::UnitX()).toRotationMatrix();
+            } else if (type == "CylinderZ") {
+                shape.type = ConvexShape::CYLINDER;
+            } else {
+                field_samples_.push_back(std::vector<Eigen::Vector3d>());
+                field_margins_.push_back(0.0);
+                continue;
+            }
+
+            // Samples at the resolution of the field, finer sampling does not add information
+            field_samples_.push_back(std::vector<Eigen::Vector3d>());
+            field_margins_.push_back(EnvironmentDistanceField::sampleShape(shape, ca_param_.distance_field.resolution, field_samples_.back()));
+        }
+    }
+}
+
+void CollisionAvoidance::initializeAllowedCollisions(RobotState& robotstate)
+{
+    // Group and name of every body, indexed by id
+    std::vector<unsigned int> body_groups;
+    std::vector<std::string> body_names;
+    for (unsigned int g = 0; g < robotstate.robot_.groups.size(); ++g)
+    {
+        const std::vector<RobotState::CollisionBody> &group = robotstate.robot_.groups[g];
+        for (std::vector<RobotState::CollisionBody>::const_iterator itrBodies = group.begin(); itrBodies != group.end(); ++itrBodies)
+        {
+            assert(getCollisionBodyId(*itrBodies) == body_groups.size());
+            body_groups.push_back(g);
+            body_names.push_back(itrBodies->name_collision_body);
+        }
+    }
+
+    unsigned int num_bodies = body_groups.size();
+    allowed_collisions_.initialize(num_bodies);
+
+    // Bodies in the same group (including a body with itself) are not checked
+    for (unsigned int a = 0; a < num_bodies; ++a)
+    {
+        for (unsigned int b = a; b < num_bodies && body_groups[b] == body_groups[a]; ++b)
+        {
+            allowed_collisions_.allow(a, b);
+        }
+    }
+
+    // Excluded pairs
+    unsigned int num_excluded = 0;
+    for (std::vector<RobotState::Exclusion>::const_iterator itrExcl = robotstate.exclusion_checks.checks.begin(); itrExcl != robotstate.exclusion_checks.checks.end(); ++itrExcl)
+    {
+        for (unsigned int a = 0; a < num_bodies; ++a)
+        {
+            if (body_names[a] != itrExcl->name_body_A) continue;
+            for (unsigned int b = 0; b < num_bodies; ++b)
+            {
+                if (body_names[b] == itrExcl->name_body_B)
+                {
+                    allowed_collisions_.allow(a, b);
+                    ++num_excluded;
+                }
+            }
+        }
+    }
+
+    ROS_INFO("Allowed collision matrix of %u bodies, %u excluded pairs", num_bodies, num_excluded);
+}
+
+unsigned int CollisionAvoidance::getCollisionBodyId(const RobotState::CollisionBody &collisionBody)
+{
+    return static_cast<const CollisionGeometryData*>(collisionBody.fcl_object->getCollisionGeometry()->getUserData())->id;
 }
 
 
 void CollisionAvoidance::calculateTransform()
 {
+    // Pose of the root of the robot, the motion of the bodies relative to it bounds the change of the self-collision distances
+    Eigen::Matrix3d root_rotation;
+    Eigen::Vector3d root_position;
+    const KDL::Frame& root = robot_state_->amcl_pose_;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        for (unsigned int j = 0; j < 3; ++j)
+            root_rotation(i, j) = root.M(i, j);
+        root_position(i) = root.p(i);
+    }
+
     // Loop throught the collision bodies and calculate the transform from /map frame to the collision bodies center frame.
     for (std::vector< std::vector<RobotState::CollisionBody> >::iterator it = robot_state_->robot_.groups.begin(); it != robot_state_->robot_.groups.end(); ++it)
     {
@@ -941,7 +1549,14 @@ void CollisionAvoidance::calculateTransform()
 #ifdef USE_FCL
             fcl::Transform3f fcl_transform;
             setTransform(collisionBody.fk_pose, collisionBody.fix_pose, fcl_transform);
-            collisionBody.fcl_object.get()->setTransform(fcl_transform);
+            const CollisionGeometryData* geometry_data = static_cast<const CollisionGeometryData*>(collisionBody.fcl_object->getCollisionGeometry()->getUserData());
+            collisionBody.fcl_object.get()->setTransform(fcl_transform * geometry_data->local_transform);
+            collisionBody.fcl_object.get()->computeAABB();
+
+            Eigen::Matrix3d rotation;
+            Eigen::Vector3d position;
+            getPose(collisionBody.fcl_object.get(), rotation, position);
+            distance_cache_.updatePose(geometry_data->id, rotation, position, root_rotation, root_position);
 #endif
 
 #ifdef VERBOSE_TRANSFORMS
@@ -1183,8 +1798,9 @@ void CollisionAvoidance::visualizeCollisionModel(RobotState::CollisionBody colli
         pub_model_marker_.publish(marker_array);
     }
 
-    else if (type == "CylinderZ")
+    else if (type == "CylinderZ" || type == "Capsule")
     {
+        // capsules are shown as a cylinder that includes the caps
         modelviz.type = visualization_msgs::Marker::CYLINDER;
         modelviz.header.frame_id = frame_id;
         modelviz.header.stamp = ros::Time::now();
@@ -1192,7 +1808,7 @@ void CollisionAvoidance::visualizeCollisionModel(RobotState::CollisionBody colli
 
         modelviz.scale.x = 2*x;
         modelviz.scale.y = 2*y;
-        modelviz.scale.z = 2*z;
+        modelviz.scale.z = (type == "Capsule") ? 2*(z+x) : 2*z;
 
         modelviz.pose.position.x = transform.getOrigin().getX();
         modelviz.pose.position.y = transform.getOrigin().getY();
@@ -1327,7 +1943,8 @@ void CollisionAvoidance::calculateRepulsiveForce(const std::vector<Distance> &mi
         const Distance &dmin = *itrMinDist;
         if (dmin.bt_distance.m_distance <= param.d_threshold )
         {
-            F.frame_id = dmin.frame_id;
+            F.body = dmin.body;
+            F.frame_handle = dmin.frame_handle;
 
             F.direction = Eigen::Vector3d(
                         dmin.bt_distance.m_normalOnBInWorld.getX(),
@@ -1371,7 +1988,8 @@ void CollisionAvoidance::calculateRepulsiveForce(const std::vector<Distance2> &m
                                dmin.result.nearest_points[1][1],
                                dmin.result.nearest_points[1][2]);
 
-            F.frame_id  = dmin.frame_id;
+            F.body = dmin.body;
+            F.frame_handle = dmin.frame_handle;
 
             // The vector must point into the opposite direction of
             // the vector from the current object to the other object
@@ -1532,10 +2150,12 @@ void CollisionAvoidance::visualizeBBX(octomath::Vector3 min, octomath::Vector3 m
 }
 
 
-void CollisionAvoidance::setOctoMap(octomap::OcTreeStamped* octree)
+void CollisionAvoidance::setOctoMap(const boost::shared_ptr<OctreeType>& octree)
 {
-    delete octomap_;
     octomap_ = octree;
+    if (ca_param_.distance_field.enabled) {
+        environment_field_.setOctoMap(octomap_);
+    }
 }
 
 
@@ -1629,12 +2249,21 @@ void CollisionAvoidance::removeOctomapBBX(const geometry_msgs::Point& goal, cons
             octomap::point3d min(bbx_min.x, bbx_min.y, bbx_min.z);
             octomap::point3d max(bbx_max.x, bbx_max.y, bbx_max.z);
 
+            // The distance field may still be reading the current tree
+            if (ca_param_.distance_field.enabled) {
+                octomap_.reset(new OctreeType(*octomap_));
+            }
+
             for(OctreeType::leaf_bbx_iterator it = octomap_->begin_leafs_bbx(min,max),
                 end=octomap_->end_leafs_bbx(); it!= end; ++it){
 
                 it->setLogOdds(octomap::logodds(0.0));
             }
             octomap_->updateInnerOccupancy();
+
+            if (ca_param_.distance_field.enabled) {
+                environment_field_.setOctoMap(octomap_);
+            }
         }
     }
 }
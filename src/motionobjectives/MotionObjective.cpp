@@ -1,6 +1,6 @@
 #include "amigo_whole_body_controller/motionobjectives/MotionObjective.h"
 
-MotionObjective::MotionObjective() {
+MotionObjective::MotionObjective() : update_period_(0.0), first_order_hold_(false) {
 
 }
 
@@ -20,14 +20,31 @@ double MotionObjective::getCost() {
     return cost_;
 }
 
-Eigen::VectorXd MotionObjective::getTorques() {
+const Eigen::VectorXd& MotionObjective::getTorques() {
     return torques_;
 }
 
-Eigen::MatrixXd MotionObjective::getJacobian() {
+const Eigen::MatrixXd& MotionObjective::getJacobian() {
     return jacobian_;
 }
 
+unsigned int MotionObjective::getNrRows() {
+    return jacobian_.rows();
+}
+
 unsigned int MotionObjective::getPriority() {
     return priority_;
 }
+
+double MotionObjective::getUpdatePeriod() const {
+    return update_period_;
+}
+
+bool MotionObjective::useFirstOrderHold() const {
+    return first_order_hold_;
+}
+
+void MotionObjective::setUpdatePeriod(double period, bool first_order_hold) {
+    update_period_ = period;
+    first_order_hold_ = first_order_hold;
+}
@@ -40,8 +40,6 @@ void PostureControl::initialize(const KDL::JntArray& q_min, const KDL::JntArray&
 void PostureControl::update(const KDL::JntArray& q_in, Eigen::VectorXd& tau_out) {
 
     current_cost_ = 0;
-    Eigen::VectorXd tau_ps;
-    tau_ps.resize(num_joints_);
     for (uint i = 0; i < num_joints_; i++) {
 		double d_tau = K_[i]*(q0_[i] - q_in(i));
         tau_out(i) += d_tau;
@@ -80,7 +78,7 @@ bool PostureControl::setJointTarget(const std::string& joint_name, const double&
 
 }
 
-double PostureControl::getJointTarget(std::string joint_name)
+double PostureControl::getJointTarget(const std::string& joint_name)
 {
     std::map<std::string, unsigned int>::const_iterator index_iter = joint_name_to_index_.find(joint_name);
     if (index_iter != joint_name_to_index_.end())
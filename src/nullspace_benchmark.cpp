@@ -0,0 +1,207 @@
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+#include <ros/time.h>
+
+#include <Eigen/SVD>
+
+#include "ComputeNullspace.h"
+#include "TaskStack.h"
+
+/**
+  * Compares the computation time of the nullspace projections of the decompositions in ComputeNullspace
+  * with the dense SVD reference (an nxn projection per level), for a random task hierarchy
+  * Usage: nullspace_benchmark [joints] [collision rows] [iterations]
+  */
+
+/**
+  * Dense reference: N_i = N_(i-1) - Jr^T * Jpinv^T with Jr = J * N_(i-1)^T, tau = t_0 + N_0 * t_1 + ...
+  * Singular values are zero below the same fraction of the largest squared row norm as in ComputeNullspace
+  * @param ranks Output (optional): rank of every level but the lowest
+  */
+void denseReference(const TaskStack& task_stack, Eigen::VectorXd& tau, std::vector<unsigned int>* ranks = NULL)
+{
+    unsigned int num_joints = tau.rows();
+    Eigen::MatrixXd N = Eigen::MatrixXd::Identity(num_joints, num_joints);
+    tau = task_stack.getTorques(0);
+    for (unsigned int i = 0; i + 1 < task_stack.getNrLevels(); ++i)
+    {
+        unsigned int num_rows = task_stack.getNrRows(i);
+        unsigned int rank = 0;
+        if (num_rows > 0)
+        {
+            Eigen::MatrixXd J = task_stack.getJacobian(i).topRows(num_rows);
+            double threshold = 1e-10 * J.rowwise().squaredNorm().maxCoeff();
+            Eigen::MatrixXd Jr = J * N.transpose();
+            Eigen::MatrixXd WJ = Jr * Jr.transpose();
+            Eigen::JacobiSVD<Eigen::MatrixXd> svd(WJ, Eigen::ComputeThinU | Eigen::ComputeFullV);
+            Eigen::VectorXd Sinv = svd.singularValues();
+            for (int k = 0; k < Sinv.rows(); ++k)
+            {
+                rank += (Sinv(k) > threshold);
+                Sinv(k) = (Sinv(k) > threshold) ? 1.0 / Sinv(k) : 0.0;
+            }
+            Eigen::MatrixXd Jpinv = Jr.transpose() * svd.matrixV() * Sinv.asDiagonal() * svd.matrixU().transpose();
+            N -= Jr.transpose() * Jpinv.transpose();
+        }
+        tau += N * task_stack.getTorques(i+1);
+        if (ranks)
+        {
+            ranks->push_back(rank);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int num_joints = (argc > 1) ? atoi(argv[1]) : 21;
+    unsigned int collision_rows = (argc > 2) ? atoi(argv[2]) : 8;
+    unsigned int iterations = (argc > 3) ? atoi(argv[3]) : 10000;
+
+    /// Collision avoidance, a redundant constraint level, two Cartesian impedances and the posture level
+    TaskStack task_stack;
+    task_stack.initialize(4, num_joints, 12);
+    std::srand(0);
+    task_stack.addTask(0, Eigen::MatrixXd::Random(collision_rows, num_joints), Eigen::VectorXd::Random(num_joints));
+    Eigen::MatrixXd constraint = Eigen::MatrixXd::Random(6, num_joints);
+    constraint.bottomRows(3) = constraint.topRows(3);
+    task_stack.addTask(1, constraint, Eigen::VectorXd::Random(num_joints));
+    task_stack.addTask(2, Eigen::MatrixXd::Random(6, num_joints), Eigen::VectorXd::Random(num_joints));
+    task_stack.addTask(2, Eigen::MatrixXd::Random(6, num_joints), Eigen::VectorXd::Random(num_joints));
+    task_stack.addTask(3, Eigen::MatrixXd(0, num_joints), Eigen::VectorXd::Random(num_joints));
+
+    std::cout << num_joints << " joints, rows per level:";
+    for (unsigned int i = 0; i < task_stack.getNrLevels(); ++i)
+    {
+        std::cout << " " << task_stack.getNrRows(i);
+    }
+    std::cout << std::endl;
+
+    Eigen::VectorXd tau_reference(num_joints);
+    ros::WallTime t_start = ros::WallTime::now();
+    for (unsigned int k = 0; k < iterations; ++k)
+    {
+        denseReference(task_stack, tau_reference);
+    }
+    std::cout << "Dense SVD: " << 1e6 * (ros::WallTime::now() - t_start).toSec() / iterations << " us" << std::endl;
+
+    const char* names[] = {"svd", "qr", "ldlt"};
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        ComputeNullspace::Decomposition decomposition;
+        ComputeNullspace::getDecomposition(names[d], decomposition);
+        ComputeNullspace nullspace;
+        nullspace.initialize(num_joints, Eigen::MatrixXd::Identity(num_joints, num_joints), decomposition, false);
+
+        Eigen::VectorXd tau(num_joints);
+        t_start = ros::WallTime::now();
+        for (unsigned int k = 0; k < iterations; ++k)
+        {
+            nullspace.update(task_stack, tau);
+        }
+        double time = (ros::WallTime::now() - t_start).toSec();
+
+        std::cout << names[d] << ": " << 1e6 * time / iterations << " us"
+                  << ", ranks " << nullspace.getRank(0) << " " << nullspace.getRank(1) << " " << nullspace.getRank(2)
+                  << ", max difference with reference " << (tau - tau_reference).cwiseAbs().maxCoeff() << std::endl;
+    }
+
+    /// Branches of AMIGO: torso (1), left arm (7), right arm (7) and head (2), no collisions
+    /// Cartesian impedances of both grippers and a gaze task, with and without the torso in the arm chains
+    const unsigned int num_branch_joints = 17;
+    std::cout << "Independent branches (" << num_branch_joints << " joints):" << std::endl;
+    for (unsigned int torso = 0; torso < 2; ++torso)
+    {
+        Eigen::MatrixXd left = Eigen::MatrixXd::Zero(6, num_branch_joints);
+        Eigen::MatrixXd right = Eigen::MatrixXd::Zero(6, num_branch_joints);
+        Eigen::MatrixXd head = Eigen::MatrixXd::Zero(2, num_branch_joints);
+        left.middleCols(1, 7).setRandom();
+        right.middleCols(8, 7).setRandom();
+        head.rightCols(2).setRandom();
+        if (torso)
+        {
+            left.col(0).setRandom();
+            right.col(0).setRandom();
+        }
+
+        task_stack.initialize(4, num_branch_joints, 12);
+        task_stack.addTask(0, Eigen::MatrixXd(0, num_branch_joints), Eigen::VectorXd::Random(num_branch_joints));
+        task_stack.addTask(2, left, Eigen::VectorXd::Random(num_branch_joints));
+        task_stack.addTask(2, right, Eigen::VectorXd::Random(num_branch_joints));
+        task_stack.addTask(2, head, Eigen::VectorXd::Random(num_branch_joints));
+        task_stack.addTask(3, Eigen::MatrixXd(0, num_branch_joints), Eigen::VectorXd::Random(num_branch_joints));
+        Eigen::VectorXd tau_branches(num_branch_joints);
+        denseReference(task_stack, tau_branches);
+
+        for (unsigned int block_sparse = 0; block_sparse < 2; ++block_sparse)
+        {
+            ComputeNullspace nullspace;
+            nullspace.initialize(num_branch_joints, Eigen::MatrixXd::Identity(num_branch_joints, num_branch_joints), ComputeNullspace::LDLT, block_sparse);
+
+            Eigen::VectorXd tau(num_branch_joints);
+            t_start = ros::WallTime::now();
+            for (unsigned int k = 0; k < iterations; ++k)
+            {
+                nullspace.update(task_stack, tau);
+            }
+            double time = (ros::WallTime::now() - t_start).toSec();
+
+            std::cout << (torso ? "with torso, " : "without torso, ") << (block_sparse ? "block sparse ldlt: " : "ldlt: ")
+                      << 1e6 * time / iterations << " us, blocks " << nullspace.getNrBlocks(2)
+                      << ", max difference with reference " << (tau - tau_branches).cwiseAbs().maxCoeff() << std::endl;
+        }
+    }
+
+    /// Restricted levels that are rank deficient: collision rows on the torso and both shoulders, a left arm impedance that
+    /// shares the torso and the left shoulder with them and a right arm impedance with a dependent row, once the
+    /// collision rows are removed. The pivots of the restricted levels are much smaller than their unrestricted rows
+    std::cout << "Restricted, rank deficient levels (" << num_branch_joints << " joints):" << std::endl;
+    Eigen::MatrixXd collision = Eigen::MatrixXd::Zero(6, num_branch_joints);
+    Eigen::MatrixXd shoulders = Eigen::MatrixXd::Random(6, 2);
+    collision.col(0).setRandom();
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        collision(i, 1 + i % 3) = shoulders(i, 0);
+        collision(i, 8 + i % 2) = 0.1 * shoulders(i, 1);
+    }
+    Eigen::MatrixXd left = Eigen::MatrixXd::Zero(6, num_branch_joints);
+    Eigen::MatrixXd right = Eigen::MatrixXd::Zero(6, num_branch_joints);
+    left.col(0).setRandom();
+    left.middleCols(1, 7).setRandom();
+    right.middleCols(8, 7).setRandom();
+    right.row(5) = 0.5 * right.row(3) - right.row(4);
+
+    task_stack.initialize(4, num_branch_joints, 12);
+    task_stack.addTask(0, collision, Eigen::VectorXd::Random(num_branch_joints));
+    task_stack.addTask(1, left, Eigen::VectorXd::Random(num_branch_joints));
+    task_stack.addTask(2, right, Eigen::VectorXd::Random(num_branch_joints));
+    task_stack.addTask(3, Eigen::MatrixXd(0, num_branch_joints), Eigen::VectorXd::Random(num_branch_joints));
+    Eigen::VectorXd tau_restricted(num_branch_joints);
+    std::vector<unsigned int> ranks_restricted;
+    denseReference(task_stack, tau_restricted, &ranks_restricted);
+    std::cout << "reference ranks " << ranks_restricted[0] << " " << ranks_restricted[1] << " " << ranks_restricted[2] << std::endl;
+
+    const char* restricted_names[] = {"svd", "qr", "ldlt", "block sparse ldlt"};
+    for (unsigned int d = 0; d < 4; ++d)
+    {
+        ComputeNullspace::Decomposition decomposition;
+        ComputeNullspace::getDecomposition(d < 3 ? restricted_names[d] : "ldlt", decomposition);
+        ComputeNullspace nullspace;
+        nullspace.initialize(num_branch_joints, Eigen::MatrixXd::Identity(num_branch_joints, num_branch_joints), decomposition, d == 3);
+
+        Eigen::VectorXd tau(num_branch_joints);
+        t_start = ros::WallTime::now();
+        for (unsigned int k = 0; k < iterations; ++k)
+        {
+            nullspace.update(task_stack, tau);
+        }
+        double time = (ros::WallTime::now() - t_start).toSec();
+
+        std::cout << restricted_names[d] << ": " << 1e6 * time / iterations << " us"
+                  << ", ranks " << nullspace.getRank(0) << " " << nullspace.getRank(1) << " " << nullspace.getRank(2)
+                  << ", max difference with reference " << (tau - tau_restricted).cwiseAbs().maxCoeff() << std::endl;
+    }
+
+    return 0;
+}
@@ -77,6 +77,23 @@ wbc::CollisionAvoidance::collisionAvoidanceParameters WholeBodyControllerNode::l
 
     n.getParam("map_3d/resolution", ca_param.environment_collision.octomap_resolution);
 
+    n.param<double> (ns+"/update_period",       ca_param.update_period, 0.0);
+    n.param<bool>   (ns+"/first_order_hold",    ca_param.first_order_hold, false);
+
+    n.param<std::string> (ns+"/distance_backend",       ca_param.distance_backend, "fcl");
+    n.param<bool>   (ns+"/cross_validation",            ca_param.cross_validation, false);
+    n.param<double> (ns+"/cross_validation_tolerance",  ca_param.cross_validation_tolerance, 0.01);
+    n.param<bool>   (ns+"/analytic_distances",          ca_param.analytic_distances, true);
+    n.param<bool>   (ns+"/batched_distances",           ca_param.batched_distances, false);
+    n.param<bool>   (ns+"/distance_caching",            ca_param.distance_caching, true);
+    n.param<int>    (ns+"/distance_threads",            ca_param.distance_threads, 0);
+    n.param<bool>   (ns+"/distance_field/enabled",      ca_param.distance_field.enabled, false);
+    n.param<double> (ns+"/distance_field/resolution",   ca_param.distance_field.resolution, 0.05);
+    n.param<double> (ns+"/distance_field/size_xy",      ca_param.distance_field.size_xy, 4.0);
+    n.param<double> (ns+"/distance_field/size_z",       ca_param.distance_field.size_z, 2.0);
+    n.param<bool>   (ns+"/region_of_interest/enabled",  ca_param.region_of_interest.enabled, true);
+    n.param<double> (ns+"/region_of_interest/margin",   ca_param.region_of_interest.margin, 0.5);
+
     assert(ca_param.self_collision.visualization_force_factor >= 1.0);
     assert(ca_param.environment_collision.visualization_force_factor >= 1.0);
 
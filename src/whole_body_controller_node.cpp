@@ -5,8 +5,8 @@
 
 #include "amigo_whole_body_controller/motionobjectives/CollisionAvoidance.h"
 #include "amigo_whole_body_controller/motionobjectives/CartesianImpedance.h"
+#include "OctomapIngestion.h"
 
-#include <octomap_msgs/conversions.h>
 #include <profiling/StatsPublisher.h>
 #include <tf/transform_listener.h>
 
@@ -24,30 +24,14 @@ WholeBodyController* wholeBodyController;
 /// For using a static octomap during grasp
 bool octomap_cb = true;
 
-
+/// Converts the octomaps in the background
+OctomapIngestion* octomap_ingestion;
 
 void octoMapCallback(const octomap_msgs::Octomap::ConstPtr& msg)
 {
     if (octomap_cb) {
-        octomap::AbstractOcTree* tree = octomap_msgs::msgToMap(*msg);
-        if (tree) {
-            octomap::OcTreeStamped* octree = dynamic_cast<octomap::OcTreeStamped*>(tree);
-            if (!octree) {
-                ROS_ERROR("No Octomap created");
-            }
-            else
-            {
-                collision_avoidance->setOctoMap(octree);
-            }
-            // delete tree;
-         }
-         else
-         {
-            ROS_ERROR("Octomap conversion error");
-            exit(1);
-         }
-        // delete tree;
-     }
+        octomap_ingestion->setMessage(msg);
+    }
 }
 
 void CancelCB() {
@@ -151,6 +135,23 @@ void loadParameterFiles(wbc::CollisionAvoidance::collisionAvoidanceParameters &c
 
     n.getParam("map_3d/resolution", ca_param.environment_collision.octomap_resolution);
 
+    n.param<double> (ns+"/update_period",       ca_param.update_period, 0.0);
+    n.param<bool>   (ns+"/first_order_hold",    ca_param.first_order_hold, false);
+
+    n.param<std::string> (ns+"/distance_backend",       ca_param.distance_backend, "fcl");
+    n.param<bool>   (ns+"/cross_validation",            ca_param.cross_validation, false);
+    n.param<double> (ns+"/cross_validation_tolerance",  ca_param.cross_validation_tolerance, 0.01);
+    n.param<bool>   (ns+"/analytic_distances",          ca_param.analytic_distances, true);
+    n.param<bool>   (ns+"/batched_distances",           ca_param.batched_distances, false);
+    n.param<bool>   (ns+"/distance_caching",            ca_param.distance_caching, true);
+    n.param<int>    (ns+"/distance_threads",            ca_param.distance_threads, 0);
+    n.param<bool>   (ns+"/distance_field/enabled",      ca_param.distance_field.enabled, false);
+    n.param<double> (ns+"/distance_field/resolution",   ca_param.distance_field.resolution, 0.05);
+    n.param<double> (ns+"/distance_field/size_xy",      ca_param.distance_field.size_xy, 4.0);
+    n.param<double> (ns+"/distance_field/size_z",       ca_param.distance_field.size_z, 2.0);
+    n.param<bool>   (ns+"/region_of_interest/enabled",  ca_param.region_of_interest.enabled, true);
+    n.param<double> (ns+"/region_of_interest/margin",   ca_param.region_of_interest.margin, 0.5);
+
     assert(ca_param.self_collision.visualization_force_factor >= 1.0);
     assert(ca_param.environment_collision.visualization_force_factor >= 1.0);
 }
@@ -164,7 +165,8 @@ int main(int argc, char **argv) {
     ros::NodeHandle nh;
     ros::NodeHandle nh_private("~");
 
-    nh_private.subscribe<octomap_msgs::Octomap>("/octomap_binary", 10, &octoMapCallback);
+    octomap_ingestion = new OctomapIngestion;
+    ros::Subscriber octomap_sub = nh_private.subscribe<octomap_msgs::Octomap>("/octomap_binary", 10, &octoMapCallback);
 
     // Load parameter files
     CollisionAvoidance::collisionAvoidanceParameters ca_param;
@@ -240,6 +242,12 @@ int main(int argc, char **argv) {
         /// Set base pose in whole-body controller (remaining joints are set implicitly in the callback functions in robot_interface)
         robot_interface.setAmclPose();
 
+        /// Swap in the latest octomap that was converted in the background
+        boost::shared_ptr<octomap::OcTreeStamped> octree;
+        if (octomap_cb && octomap_ingestion->getOctoMap(octree)) {
+            collision_avoidance->setOctoMap(octree);
+        }
+
         /// Update whole-body controller
         Eigen::VectorXd q_ref, qdot_ref;
         sp.startTimer("wbcupdate");
@@ -271,6 +279,7 @@ int main(int argc, char **argv) {
     // ToDo: delete all motion objectives
     delete add_motion_objective_server_;
     delete collision_avoidance;
+    delete octomap_ingestion;
     delete wholeBodyController;
     delete cartesian_impedance;
 
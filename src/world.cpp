@@ -2,7 +2,7 @@
 
 namespace wbc {
 
-World::World()
+World::World() : version_(0)
 {
 }
 
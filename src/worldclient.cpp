@@ -2,8 +2,59 @@
 
 namespace wbc {
 
-WorldClient::WorldClient()
+WorldClient::WorldClient() : middle_(1), back_(0), front_(2), version_(0)
 {
 }
 
+WorldClient::~WorldClient()
+{
+}
+
+WorldPtr WorldClient::getWorld()
+{
+    /// Take the middle slot if it holds a newer world, the writer never touches the front slot
+    if (middle_ & FRESH) {
+        front_ = exchangeMiddle(front_) & INDEX_MASK;
+    }
+    return slots_[front_];
+}
+
+unsigned long WorldClient::getVersion() const
+{
+    return version_;
+}
+
+void WorldClient::publishWorld(const WorldPtr& world)
+{
+    /// The reader only copies the front slot, so the world in the back slot is unique unless the controller still
+    /// holds a copy of it: retire it then instead of letting the controller drop the last reference
+    releaseRetired();
+    if (slots_[back_] && !slots_[back_].unique()) {
+        retired_.push_back(slots_[back_]);
+    }
+
+    world->setVersion(version_ + 1);
+    slots_[back_] = world;
+    back_ = exchangeMiddle(back_ | FRESH) & INDEX_MASK;
+    __sync_fetch_and_add(&version_, 1);
+}
+
+unsigned int WorldClient::exchangeMiddle(unsigned int middle)
+{
+    /// __sync_lock_test_and_set is only an acquire barrier, the slot that is handed over must be written before
+    __sync_synchronize();
+    return __sync_lock_test_and_set(&middle_, middle);
+}
+
+void WorldClient::releaseRetired()
+{
+    for (std::vector<WorldPtr>::iterator it = retired_.begin(); it != retired_.end(); ) {
+        if (it->unique()) {
+            it = retired_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 } // namespace
@@ -0,0 +1,182 @@
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <ros/ros.h>
+
+#include "AllocationCounter.h"
+#include "WholeBodyController.h"
+#include "amigo_whole_body_controller/fileworldclient.h"
+#include "amigo_whole_body_controller/motionobjectives/CartesianImpedance.h"
+#include "amigo_whole_body_controller/motionobjectives/CollisionAvoidance.h"
+
+/**
+  * Drives WholeBodyController::update with collision avoidance against a scene (private parameter scene, see
+  * FileWorldClient) and a Cartesian impedance towards the table while the joints move, and checks that no cycle
+  * allocates after the warm-up.
+  * Built with the counting allocator (AllocationCounter), run by test/allocation_test.test
+  */
+
+/** Number of cycles of a period of the joint motion */
+static const unsigned int PERIOD = 100;
+
+/** Amplitude of the joint motion around the initial positions [rad] */
+static const double AMPLITUDE = 0.3;
+
+/** Parameters of the collision avoidance, as in parameters/collision_avoidance.yaml */
+wbc::CollisionAvoidance::collisionAvoidanceParameters getParameters(int distance_threads, bool batched_distances)
+{
+    wbc::CollisionAvoidance::collisionAvoidanceParameters ca_param;
+    ca_param.self_collision.f_max = 18.0;
+    ca_param.self_collision.f_min_percent = 5.0;
+    ca_param.self_collision.d_threshold = 0.066;
+    ca_param.self_collision.order = 2;
+    ca_param.self_collision.octomap_resolution = 0.05;
+    ca_param.self_collision.visualization_force_factor = 5.0;
+    ca_param.environment_collision = ca_param.self_collision;
+    ca_param.update_period = 0.0;
+    ca_param.first_order_hold = false;
+    ca_param.distance_backend = "fcl";
+    ca_param.cross_validation = false;
+    ca_param.cross_validation_tolerance = 0.01;
+    ca_param.analytic_distances = true;
+    ca_param.batched_distances = batched_distances;
+    ca_param.distance_caching = true;
+    ca_param.distance_threads = distance_threads;
+    ca_param.distance_field.enabled = false;
+    ca_param.distance_field.resolution = 0.05;
+    ca_param.distance_field.size_xy = 4.0;
+    ca_param.distance_field.size_z = 2.0;
+    ca_param.region_of_interest.enabled = true;
+    ca_param.region_of_interest.margin = 0.5;
+    return ca_param;
+}
+
+/** Cartesian impedance of the left gripper with a goal above the table, which it does not reach while the joints are moved */
+void setImpedanceGoal(CartesianImpedance& cartesian_impedance)
+{
+    geometry_msgs::PoseStamped goal_pose;
+    goal_pose.header.frame_id = "base_link";
+    goal_pose.pose.position.x = 0.45;
+    goal_pose.pose.position.y = 0.3;
+    goal_pose.pose.position.z = 0.95;
+    goal_pose.pose.orientation.w = 1.0;
+    cartesian_impedance.setGoal(goal_pose);
+
+    geometry_msgs::Wrench stiffness;
+    stiffness.force.x = stiffness.force.y = stiffness.force.z = 70.0;
+    stiffness.torque.x = stiffness.torque.y = stiffness.torque.z = 5.0;
+    cartesian_impedance.setImpedance(stiffness);
+
+    arm_navigation_msgs::Shape position_tolerance;
+    position_tolerance.type = arm_navigation_msgs::Shape::SPHERE;
+    position_tolerance.dimensions.push_back(0.03);
+    cartesian_impedance.setPositionTolerance(position_tolerance);
+    cartesian_impedance.setOrientationTolerance(0.0, 0.0, 0.0);
+}
+
+/** Moves every joint along a sine around its initial position */
+void moveJoints(WholeBodyController& wbc, const std::vector<double>& q_initial, unsigned int cycle)
+{
+    const std::vector<std::string>& joint_names = wbc.getJointNames();
+    double offset = AMPLITUDE * std::sin(2.0 * M_PI * cycle / PERIOD);
+    for (unsigned int i = 0; i < joint_names.size(); ++i)
+    {
+        wbc.setMeasuredJointPosition(joint_names[i], q_initial[i] + offset);
+    }
+}
+
+/** Runs the controller for a warm-up of two periods, then expects three periods without allocations */
+void testAllocations(int distance_threads, bool batched_distances = false)
+{
+    ros::NodeHandle n("~");
+    std::string scene;
+    ASSERT_TRUE(n.getParam("scene", scene)) << "Private parameter scene is not set";
+
+    wbc::FileWorldClient world_client(scene);
+    world_client.initialize();
+    ASSERT_TRUE(world_client.isLoaded()) << "Could not load " << scene;
+    world_client.start();
+
+    WholeBodyController wbc(1.0 / PERIOD);
+    wbc::CollisionAvoidance::collisionAvoidanceParameters ca_param = getParameters(distance_threads, batched_distances);
+    wbc::CollisionAvoidance collision_avoidance(ca_param, 1.0 / PERIOD);
+    ASSERT_TRUE(wbc.addMotionObjective(&collision_avoidance));
+    collision_avoidance.setCollisionWorld(&world_client);
+
+    /// The goal is in base_link, which is part of the tree, hence no tf listener is needed
+    CartesianImpedance cartesian_impedance("grippoint_left", 1.0 / PERIOD, NULL);
+    setImpedanceGoal(cartesian_impedance);
+    ASSERT_TRUE(wbc.addMotionObjective(&cartesian_impedance));
+
+    const std::vector<std::string>& joint_names = wbc.getJointNames();
+    ASSERT_FALSE(joint_names.empty());
+    std::vector<double> q_initial(joint_names.size());
+    for (unsigned int i = 0; i < joint_names.size(); ++i)
+    {
+        q_initial[i] = wbc.getJointPosition(joint_names[i]);
+    }
+
+    Eigen::VectorXd q_reference, qdot_reference;
+    unsigned int cycle = 0;
+
+    /// The warm-up allocates (e.g. the references above), which also shows that the library is counted
+    unsigned long allocations_warmup = 0;
+    for (; cycle < 2 * PERIOD; ++cycle)
+    {
+        moveJoints(wbc, q_initial, cycle);
+        ASSERT_TRUE(wbc.update(q_reference, qdot_reference));
+        allocations_warmup += wbc.getNrAllocations();
+    }
+    EXPECT_GT(allocations_warmup, 0u);
+
+    for (; cycle < 5 * PERIOD; ++cycle)
+    {
+        moveJoints(wbc, q_initial, cycle);
+        ASSERT_TRUE(wbc.update(q_reference, qdot_reference));
+        ASSERT_EQ(0u, wbc.getNrAllocations()) << "Cycle " << cycle << " allocated";
+    }
+    EXPECT_EQ(2u, cartesian_impedance.getStatus()) << "The impedance goal is not active anymore";
+
+    wbc.removeMotionObjective(&cartesian_impedance);
+    wbc.removeMotionObjective(&collision_avoidance);
+}
+
+TEST(AllocationTest, CounterIsEnabled)
+{
+    ASSERT_TRUE(AllocationCounter::enabled());
+
+    unsigned long allocations_start = AllocationCounter::count();
+    void* ptr = std::malloc(16);
+    EXPECT_EQ(allocations_start + 1, AllocationCounter::count());
+    std::free(ptr);
+
+    allocations_start = AllocationCounter::count();
+    Eigen::MatrixXd matrix(8, 8);
+    EXPECT_LT(allocations_start, AllocationCounter::count());
+}
+
+TEST(AllocationTest, SerialDistances)
+{
+    testAllocations(0);
+}
+
+TEST(AllocationTest, ConcurrentDistances)
+{
+    testAllocations(2);
+}
+
+TEST(AllocationTest, BatchedDistances)
+{
+    testAllocations(0, true);
+    testAllocations(2, true);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    ros::init(argc, argv, "allocation_test");
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Geometry>
+
+#include "ShapeDistance.h"
+
+/**
+  * Checks ShapeDistance against closed form references on random pairs, its symmetry, and that ShapeDistanceBatch
+  * returns the same results as ShapeDistance::compute
+  */
+
+/** Number of random pairs of every reference check */
+static const unsigned int NUM_PAIRS = 100000;
+
+/** Uniform random number in [min, max] */
+double random(double min, double max)
+{
+    return min + (max - min) * std::rand() / (double)RAND_MAX;
+}
+
+/** Random rotation, from a random axis and angle */
+Eigen::Matrix3d randomRotation()
+{
+    Eigen::Vector3d axis(random(-1.0, 1.0), random(-1.0, 1.0), random(-1.0, 1.0));
+    if (axis.norm() < 1e-3)
+    {
+        axis = Eigen::Vector3d::UnitZ();
+    }
+    return Eigen::AngleAxisd(random(-M_PI, M_PI), axis.normalized()).toRotationMatrix();
+}
+
+/** Random shape of a type, with dimensions of links of a robot, within 0.6 m of the origin */
+ConvexShape randomShape(ConvexShape::Type type)
+{
+    ConvexShape shape;
+    shape.type = type;
+    shape.dimensions = Eigen::Vector3d(random(0.02, 0.2), random(0.02, 0.2), random(0.02, 0.3));
+    if (type != ConvexShape::BOX)
+    {
+        shape.dimensions.y() = shape.dimensions.x();
+    }
+    shape.rotation = randomRotation();
+    shape.position = Eigen::Vector3d(random(-0.6, 0.6), random(-0.6, 0.6), random(-0.6, 0.6));
+    return shape;
+}
+
+/** Distance between a point and a box or a cylinder (0 if the point is inside) */
+double pointDistance(const ConvexShape& shape, const Eigen::Vector3d& point)
+{
+    Eigen::Vector3d local = shape.rotation.transpose() * (point - shape.position);
+    const Eigen::Vector3d& d = shape.dimensions;
+    if (shape.type == ConvexShape::BOX)
+    {
+        Eigen::Vector3d clamped = local.cwiseMax(-d).cwiseMin(d);
+        return (local - clamped).norm();
+    }
+    double radial = std::max(0.0, local.head<2>().norm() - d.x());
+    double axial = std::max(0.0, std::abs(local.z()) - d.z());
+    return std::sqrt(radial * radial + axial * axial);
+}
+
+/** Compares the distance between a sphere and a box or cylinder with the distance of its center to the shape */
+void testSphereReference(ConvexShape::Type type)
+{
+    std::srand(1);
+    unsigned int num_separated = 0;
+    for (unsigned int k = 0; k < NUM_PAIRS; ++k)
+    {
+        ConvexShape shape = randomShape(type);
+        ConvexShape sphere = randomShape(ConvexShape::SPHERE);
+
+        double reference = pointDistance(shape, sphere.position) - sphere.dimensions.x();
+        if (reference <= 1e-6)
+        {
+            continue;
+        }
+        ++num_separated;
+
+        Eigen::Vector3d point_shape, point_sphere;
+        double distance = ShapeDistance::compute(shape, sphere, point_shape, point_sphere);
+        ASSERT_NEAR(reference, distance, 1e-6) << "Pair " << k;
+        ASSERT_NEAR(distance, (point_shape - point_sphere).norm(), 1e-6) << "Pair " << k;
+        ASSERT_LT(pointDistance(shape, point_shape), 1e-6) << "Pair " << k;
+        ASSERT_NEAR(sphere.dimensions.x(), (point_sphere - sphere.position).norm(), 1e-6) << "Pair " << k;
+    }
+    EXPECT_GT(num_separated, NUM_PAIRS / 2);
+}
+
+TEST(ShapeDistanceTest, BoxSphere)
+{
+    testSphereReference(ConvexShape::BOX);
+}
+
+TEST(ShapeDistanceTest, CylinderSphere)
+{
+    testSphereReference(ConvexShape::CYLINDER);
+}
+
+TEST(ShapeDistanceTest, CapsuleCapsule)
+{
+    /// The closest points of the axis segments are bracketed by a dense sampling of both segments
+    std::srand(2);
+    const unsigned int num_samples = 200;
+    for (unsigned int k = 0; k < NUM_PAIRS / 100; ++k)
+    {
+        ConvexShape a = randomShape(ConvexShape::CAPSULE);
+        ConvexShape b = randomShape(ConvexShape::CAPSULE);
+        Eigen::Vector3d axis_a = a.rotation.col(2) * a.dimensions.z();
+        Eigen::Vector3d axis_b = b.rotation.col(2) * b.dimensions.z();
+
+        double sampled = std::numeric_limits<double>::infinity();
+        for (unsigned int i = 0; i <= num_samples; ++i)
+        {
+            Eigen::Vector3d p = a.position + (2.0 * i / num_samples - 1.0) * axis_a;
+            for (unsigned int j = 0; j <= num_samples; ++j)
+            {
+                Eigen::Vector3d q = b.position + (2.0 * j / num_samples - 1.0) * axis_b;
+                sampled = std::min(sampled, (p - q).norm());
+            }
+        }
+        sampled -= a.dimensions.x() + b.dimensions.x();
+
+        Eigen::Vector3d point_a, point_b;
+        double distance = ShapeDistance::compute(a, b, point_a, point_b);
+        double step = 2.0 * (a.dimensions.z() + b.dimensions.z()) / num_samples;
+        ASSERT_LE(distance, sampled + 1e-9) << "Pair " << k;
+        ASSERT_GE(distance, sampled - step) << "Pair " << k;
+    }
+}
+
+TEST(ShapeDistanceTest, Symmetry)
+{
+    std::srand(3);
+    for (unsigned int k = 0; k < NUM_PAIRS / 10; ++k)
+    {
+        ConvexShape a = randomShape((ConvexShape::Type)(k % 5));
+        ConvexShape b = randomShape((ConvexShape::Type)((k / 5) % 5));
+
+        Eigen::Vector3d point_a, point_b, point_b2, point_a2;
+        double distance = ShapeDistance::compute(a, b, point_a, point_b);
+        double distance2 = ShapeDistance::compute(b, a, point_b2, point_a2);
+        ASSERT_NEAR(distance, distance2, 1e-6) << "Pair " << k << " of types " << a.type << " and " << b.type;
+        if (distance > 1e-6)
+        {
+            ASSERT_NEAR(distance, (point_a - point_b).norm(), 1e-6) << "Pair " << k << " of types " << a.type << " and " << b.type;
+        }
+    }
+}
+
+TEST(ShapeDistanceTest, Batch)
+{
+    /// Random batches of mostly sphere pairs (even and odd numbers of them) with other pairs in between
+    std::srand(4);
+    ShapeDistanceBatch batch;
+    batch.reserve(64);
+    std::vector<ConvexShape> shapes_a, shapes_b;
+    for (unsigned int k = 0; k < 200; ++k)
+    {
+        batch.clear();
+        shapes_a.clear();
+        shapes_b.clear();
+        unsigned int num_pairs = 1 + std::rand() % 64;
+        for (unsigned int i = 0; i < num_pairs; ++i)
+        {
+            bool spheres = (std::rand() % 4 != 0);
+            shapes_a.push_back(randomShape(spheres ? ConvexShape::SPHERE : (ConvexShape::Type)(std::rand() % 5)));
+            shapes_b.push_back(randomShape(spheres ? ConvexShape::SPHERE : (ConvexShape::Type)(std::rand() % 5)));
+            ASSERT_EQ(i, batch.add(shapes_a[i], shapes_b[i]));
+        }
+        ASSERT_EQ(num_pairs, batch.size());
+        batch.compute();
+
+        for (unsigned int i = 0; i < num_pairs; ++i)
+        {
+            Eigen::Vector3d point_a, point_b, reference_a, reference_b;
+            double distance = batch.getDistance(i, point_a, point_b);
+            double reference = ShapeDistance::compute(shapes_a[i], shapes_b[i], reference_a, reference_b);
+            ASSERT_NEAR(reference, distance, 1e-12) << "Batch " << k << ", pair " << i;
+            ASSERT_LT((point_a - reference_a).norm(), 1e-12) << "Batch " << k << ", pair " << i;
+            ASSERT_LT((point_b - reference_b).norm(), 1e-12) << "Batch " << k << ", pair " << i;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}